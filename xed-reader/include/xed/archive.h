@@ -0,0 +1,55 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// Depth Archive -- the depth frames of a .xed file, losslessly compressed, with a frame table for random access
+// Dan Jackson, 2013
+
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "xed/xed.h"
+
+// Archive creation flags
+#define XED_ARCHIVE_TEMPORAL        0x01    // Encode each frame as its difference from the previous frame, where that is smaller (reading a frame then decodes from the last key frame)
+
+#define XED_ARCHIVE_DEFAULT_KEY_INTERVAL 30 // With XED_ARCHIVE_TEMPORAL, at least one key frame in this many frames (bounds the cost of a seek)
+
+struct xed_archive;
+
+// Compress the depth frames of a stream (frames of width * height 16-bit values, e.g. stream 0) into a new archive file
+int XedArchiveCreate(struct xed_reader *reader, int stream, const char *filename, int flags, int keyInterval);
+
+// An open archive is read by one thread at a time (it keeps the last decoded frame, so sequential reads only decode one frame each)
+struct xed_archive *XedOpenArchive(const char *filename);
+int XedCloseArchive(struct xed_archive *archive);
+int XedArchiveGetNumFrames(struct xed_archive *archive);
+// As XedReadEvent: the event header and frame information of the original event, and its payload (big-endian depth values) exactly as in the original file (any bytes beyond the buffer size are not written)
+int XedArchiveReadFrame(struct xed_archive *archive, int index, xed_event_t *event, xed_frame_info_t *frameInfo, void *buffer, size_t bufferSize);
+
+#endif
@@ -0,0 +1,81 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// Depth Frame Processing
+// Dan Jackson, 2013
+
+
+#ifndef DEPTH_H
+#define DEPTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Depth frames (stream 0) are 16-bit big-endian values, with the depth (mm) in the lower 12 bits.
+#define XED_DEPTH_MASK          0x0fff
+#define XED_DEPTH_VALUES        4096
+
+// Colormap output pixel formats
+#define XED_PIXEL_RGB555        0   // 16-bit little-endian, 0RRRRRGG GGGBBBBB (as a 16-bit BMP)
+#define XED_PIXEL_RGB24         1   // 3 bytes: R, G, B
+#define XED_PIXEL_RGBA32        2   // 4 bytes: R, G, B, A (= 255)
+
+// Colormap palettes (stretched over the near to far range)
+#define XED_PALETTE_HUE         0   // Red, yellow, green, cyan, blue, magenta (as xed_decode)
+#define XED_PALETTE_GREY        1   // Black (near) to white (far)
+
+// Depth unpack flags
+#define XED_UNPACK_KEEP_PLAYER  0x01    // Keep the top 4 (player index) bits rather than masking them off
+
+// SIMD levels (XedDepthSetSimdLevel)
+#define XED_SIMD_NONE           0
+#define XED_SIMD_SSE2           1
+#define XED_SIMD_AVX2           2
+
+// Depth colormap: a lookup table from every 12-bit depth value to an output pixel
+typedef struct
+{
+    int format;                             // XED_PIXEL_*
+    int bytesPerPixel;
+    uint32_t lut[XED_DEPTH_VALUES];         // Output pixel bytes (little-endian) for each depth value -- entries may be changed by the caller (e.g. lut[0] for 'no reading')
+} xed_depth_colormap_t;
+
+// Build a colormap: depths below nearDepth map to the first palette color, above farDepth to the last (e.g. 850, 4000)
+int XedDepthColormapInit(xed_depth_colormap_t *colormap, int format, int nearDepth, int farDepth, int palette);
+// Build a colormap from a custom palette of 0xRRGGBB colors, linearly interpolated over the near to far range (count >= 2)
+int XedDepthColormapInitCustom(xed_depth_colormap_t *colormap, int format, int nearDepth, int farDepth, const uint32_t *colors, int count);
+
+// Colorize a depth frame (big-endian 16-bit source) into the colormap's pixel format. For RGB555, dst may be the same as src.
+int XedDepthColorize(const xed_depth_colormap_t *colormap, const void *src, size_t srcStride, void *dst, size_t dstStride, int width, int height);
+
+// Unpack big-endian depth pixels to host-order depth (mm), XED_UNPACK_* flags
+int XedUnpackDepth(const void *src, uint16_t *dst, size_t pixels, int flags);
+// Unpack big-endian depth pixels in one pass to any of: depth (mm), player index (top 4 bits), depth (meters) -- unused outputs may be NULL
+int XedUnpackDepthPlanes(const void *src, uint16_t *depth, uint8_t *player, float *meters, size_t pixels);
+
+// Limit the SIMD instruction set used (for testing and benchmarks), returns the level that will be used (by default, the best available)
+int XedDepthSetSimdLevel(int maxLevel);
+
+#endif
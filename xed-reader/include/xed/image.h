@@ -0,0 +1,50 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// Image File -- BMP, PGM and PPM images, each assembled in memory and written with a single write
+// Dan Jackson, 2013
+
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+
+// Image formats and their input pixels (rows of inputStride bytes, top row first)
+#define IMAGE_FORMAT_BMP    0   // bitsPerPixel 8 (greyscale palette), 16 (RGB555), 24 (B, G, R) or 32 (B, G, R, X) -- as BitmapWrite
+#define IMAGE_FORMAT_PGM    1   // bitsPerPixel 1-8 (a byte per pixel) or 9-16 (a host-order 16-bit value per pixel, e.g. 12 for depth), maximum value (1 << bitsPerPixel) - 1
+#define IMAGE_FORMAT_PPM    2   // bitsPerPixel 24 (R, G, B bytes) or 48 (R, G, B host-order 16-bit values)
+
+typedef struct image_stream image_stream_t;
+
+// Write one image file
+int ImageWrite(const char *filename, int format, const void *buffer, int bitsPerPixel, int width, int inputStride, int height);
+
+// Append images to one file (a PGM/PPM file of several images is a valid Netpbm stream, BMP images are simply concatenated and can be split by their bfSize)
+image_stream_t *ImageStreamOpen(const char *filename);
+int ImageStreamWrite(image_stream_t *stream, int format, const void *buffer, int bitsPerPixel, int width, int inputStride, int height);
+int ImageStreamClose(image_stream_t *stream);
+
+#endif
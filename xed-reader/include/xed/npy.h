@@ -0,0 +1,44 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// NPY File -- a numpy .npy array of 16-bit frames, written in one sequential pass
+// Dan Jackson, 2013
+
+
+#ifndef NPY_H
+#define NPY_H
+
+#include <stdint.h>
+
+typedef struct npy_writer npy_writer_t;
+
+// Create an array of uint16[frames][height][width] (host byte order, frames counted as they are written)
+npy_writer_t *NpyWriterOpen(const char *filename, int width, int height);
+// The next frame to fill in (width * height values in the write buffer, valid until the next call)
+uint16_t *NpyWriterNextFrame(npy_writer_t *writer);
+// Write the remaining frames and the final shape, returns the number of frames (-1 on error)
+int NpyWriterClose(npy_writer_t *writer);
+
+#endif
@@ -247,6 +247,17 @@ typedef struct
 } xed_index_t;
 
 
+// Read-only view of an event (XedMapEvent)
+typedef struct
+{
+    xed_event_t event;
+    xed_frame_info_t frameInfo;
+    const void *data;           // Payload (read-only, valid until XedUnmapEvent)
+    size_t length;              // Payload length
+    void *_buffer;              // (internal) Allocated copy of the payload if the reader is not mapped (or the frame cache entry)
+} xed_event_view_t;
+
+
 // Return codes
 //#define XED_TRUE                1
 //#define XED_FALSE               0
@@ -261,6 +272,7 @@ typedef struct
 #define XED_E_ABORT             -8
 #define XED_E_ACCESS_DENIED     -9
 #define XED_E_INVALID_DATA      -10
+#define XED_E_NOT_FOUND         -11
 #define XED_SUCCEEDED(value)    ((value) >= 0)
 #define XED_FAILED(value)       ((value) < 0)
 
@@ -268,11 +280,174 @@ struct xed_reader;
 
 #define XED_STREAM_ALL -1
 
+// Once a reader is open, XedGetNumEvents, XedGetIndexEntry, XedReadEvent and XedMapEvent/XedUnmapEvent may be called concurrently 
+// from multiple threads on the same reader: events are read with positional reads, so there is no shared file position.
 struct xed_reader *XedNewReader(const char *filename);
+struct xed_reader *XedNewReaderMapped(const char *filename);   // Reads via a read-only memory mapping of the whole file (falls back to buffered reads if it cannot be mapped)
+#define XED_READER_MAPPED       0x01    // As XedNewReaderMapped
+#define XED_READER_INDEX_CACHE  0x02    // Load the indexes from a sidecar cache file (<filename>.idx), (re)writing it if it is missing or stale
+#define XED_READER_RECOVER      0x04    // If the file's index is missing or damaged (e.g. a truncated recording), rebuild it by scanning the events (with XED_READER_INDEX_CACHE, the repaired index is cached)
+#define XED_READER_DIRECT       0x08    // Read without filling the page cache (e.g. one pass over recordings larger than memory), see below
+#define XED_STREAM_MASK_ALL     0xffffffff  // All streams (streamMask bit n selects stream n, 0 is the same as all)
+// Only the end information is read when opening: each stream's index is loaded on its first use, and the global (XED_STREAM_ALL) index is only built if used.
+// Streams not in the mask are never indexed (XED_E_INVALID_ARG), and are not in the global index. (With XED_READER_INDEX_CACHE, all streams are indexed on opening;
+// with XED_READER_RECOVER, the selected streams are indexed on opening, so a damaged index is found.)
+// With XED_READER_DIRECT, the file is read with direct I/O (O_DIRECT, FILE_FLAG_NO_BUFFERING) through a window of large aligned reads, which suits reading in file order
+// (reads through the window are serialized); where the filesystem does not support direct I/O, buffered reads are used and the ranges read are dropped from the cache (posix_fadvise, logged as a note). The file is not mapped.
+struct xed_reader *XedNewReaderEx(const char *filename, uint32_t streamMask, int flags);
 int XedCloseReader(struct xed_reader *reader);
 int XedGetNumEvents(struct xed_reader *reader, int stream);
 const xed_index_t *XedGetIndexEntry(struct xed_reader *reader, int stream, int index);
+// Find an event by index timestamp (in XED_EVENT_TICKS_PER_SECOND units), returns the index in the stream (or XED_E_NOT_FOUND). With XED_STREAM_ALL, each stream is searched
+// (their timestamps need not be in file order), and the result is the global index of the closest event of any stream (ties go to the earlier event in the file, or for FLOOR the later).
+#define XED_FIND_NEAREST 0          // Closest event (exact matches give the first, equal distances the earlier)
+#define XED_FIND_FLOOR   1          // Last event at or before the timestamp
+#define XED_FIND_CEIL    2          // First event at or after the timestamp
+int XedFindEventByTime(struct xed_reader *reader, int stream, uint64_t timestamp, int mode);
+int XedGetStartTime(struct xed_reader *reader, uint64_t *timestamp);     // Earliest index timestamp of any indexed stream (the origin for times within the recording), XED_E_NOT_FOUND if none
 int XedReadEvent(struct xed_reader *reader, int stream, int index, xed_event_t *frame, xed_frame_info_t *frameInfo, void *buffer, size_t bufferSize);
+// Read several events of a stream (or XED_STREAM_ALL): the requests are sorted by file offset, and nearby events are merged into single (vectored) reads straight into the buffers.
+// The results are in the caller's order: events[i], frameInfos[i] and buffers[i] (bufferSize bytes each, as XedReadEvent) are for indices[i]. Returns XED_OK, or the first error in request order.
+int XedReadEvents(struct xed_reader *reader, int stream, const int *indices, int count, xed_event_t *events, xed_frame_info_t *frameInfos, void **buffers, size_t bufferSize);
+int XedMapEvent(struct xed_reader *reader, int stream, int index, xed_event_view_t *view);   // Zero-copy for mapped readers (the payload points into the file mapping), otherwise a copy
+int XedUnmapEvent(struct xed_reader *reader, xed_event_view_t *view);
+
+// Reader I/O and timing counters, accumulated since the reader was opened (including opening it)
+typedef struct
+{
+    uint64_t bytesRead;             // Bytes read from the file, or copied from the mapping (not counting the payloads of zero-copy views)
+    uint64_t reads;                 // Read calls (pread/ReadFile, none for a mapped reader)
+    uint64_t seeks;                 // Reads not starting where the previous one ended (positional reads need no seek calls, this counts the discontinuities)
+    uint64_t eventsDecoded;         // Event headers decoded
+    uint64_t cacheHits;             // Indexes loaded from the index cache, and events returned by a frame cache without reading the file
+    uint64_t metadataTime;          // Nanoseconds reading and parsing the header, end information, indexes and event headers
+    uint64_t payloadTime;           // Nanoseconds reading event payloads
+} xed_reader_stats_t;
+
+int XedGetStats(struct xed_reader *reader, xed_reader_stats_t *stats);     // (The counters are updated concurrently, so are not a consistent snapshot while other threads are reading)
+
+// Diagnostics: library messages are passed to a callback (by default, written to stderr as "ERROR: ...", etc.)
+#define XED_LOG_NONE            0
+#define XED_LOG_ERROR           1
+#define XED_LOG_WARNING         2
+#define XED_LOG_NOTE            3
+#define XED_LOG_DEBUG           4       // Per-event tracing, only compiled in to debug builds (XED_DEBUG or _DEBUG defined)
+typedef void (*xed_log_callback_t)(void *arg, int level, const char *message);     // message has no trailing newline
+
+void XedSetLogCallback(xed_log_callback_t callback, void *arg, int maxLevel);      // callback NULL for the default, messages above maxLevel are discarded (default XED_LOG_NOTE) -- set before opening readers
+
+struct xed_stream;
+
+// Forward-only streaming reader for non-seekable input (pipes, stdin, a recording still being written): events are returned in file order
+// and the file's index is not used (index blocks are skipped). Memory use is bounded by the largest event.
+struct xed_stream *XedOpenStream(FILE *fp);                                   // Reads the file header from fp (which remains owned by the caller)
+int XedNextEvent(struct xed_stream *stream, xed_event_view_t *view);          // The payload is valid until the next call, XED_E_ABORT at the end of the events
+int XedCloseStream(struct xed_stream *stream);
+
+// Readahead cursor for sequential playback: a background thread reads the following events of a stream (or XED_STREAM_ALL) into a ring of buffers
+typedef struct
+{
+    uint64_t eventsRead;            // Events read ahead by the thread
+    uint64_t bytesRead;             // Payload bytes read by the thread
+    uint64_t eventsReturned;        // Events returned by XedPrefetchNext
+    uint64_t stalls;                // XedPrefetchNext calls that had to wait for a read (too little readahead)
+    uint64_t fullWaits;             // Times the thread waited for the consumer (the ring or memory budget was full)
+    int queued;                     // Events currently read ahead
+} xed_prefetch_stats_t;
+
+struct xed_prefetch;
+
+// Reads ahead up to queueDepth events (0 = default), and at most memoryBudget bytes of payloads (0 = unlimited, but always at least one event).
+// The reader must stay open until the cursor is closed.
+struct xed_prefetch *XedNewPrefetch(struct xed_reader *reader, int stream, int firstIndex, int queueDepth, size_t memoryBudget);
+int XedPrefetchNext(struct xed_prefetch *prefetch, xed_event_view_t *view);    // The payload is valid until the next call, XED_E_ABORT after the last event
+int XedPrefetchGetStats(struct xed_prefetch *prefetch, xed_prefetch_stats_t *stats);
+int XedClosePrefetch(struct xed_prefetch *prefetch);
+
+// Frame cache for random access (e.g. scrubbing back and forth): recently used payloads, keyed by (stream, index), under a byte budget with LRU eviction.
+// Safe to use from multiple threads: concurrent requests for the same event share one read.
+typedef struct
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t bytesCached;             // Bytes held: each entry's header, and its payload (except for a mapped reader's payloads, which are not copied)
+    int entries;
+} xed_frame_cache_stats_t;
+
+// Optional transform of the raw payload before it is cached (e.g. unpacking depth): sets *data to a malloc()'d buffer of *length bytes, returns XED_OK
+typedef int (*xed_frame_unpack_t)(void *arg, const xed_event_view_t *raw, void **data, size_t *length);
+
+struct xed_frame_cache;
+
+struct xed_frame_cache *XedNewFrameCache(struct xed_reader *reader, size_t budget, xed_frame_unpack_t unpack, void *unpackArg);   // unpack may be NULL for raw payloads
+int XedFrameCacheGet(struct xed_frame_cache *cache, int stream, int index, xed_event_view_t *view);  // The payload stays valid (and cached) until released
+int XedFrameCacheRelease(struct xed_frame_cache *cache, xed_event_view_t *view);                    // (Rather than XedUnmapEvent)
+int XedFrameCacheGetStats(struct xed_frame_cache *cache, xed_frame_cache_stats_t *stats);
+int XedCloseFrameCache(struct xed_frame_cache *cache);                                             // All views must have been released
+
+// Event selection for an iterator (all zero selects every event)
+typedef struct
+{
+    uint32_t streamMask;            // Streams to include (bit n for stream n, 0 = all)
+    uint64_t startTime;             // Time window [startTime, endTime) of event timestamps (XED_EVENT_TICKS_PER_SECOND units) -- if either is set, only timestamped events are included
+    uint64_t endTime;               // (0 = no end)
+    int stride;                     // Every stride-th event of each stream in the window (0 or 1 = every event)
+    int maxCount;                   // At most this many events, the first in file order (0 = no limit)
+} xed_filter_t;
+
+struct xed_iterator;
+
+// The selection is resolved from the stream indexes on creation, and only the selected events are read, in file order (the reader must stay open)
+struct xed_iterator *XedNewIterator(struct xed_reader *reader, const xed_filter_t *filter);     // filter may be NULL for all events
+int XedIteratorCount(struct xed_iterator *iterator);                                            // Number of events selected
+int XedIteratorNext(struct xed_iterator *iterator, xed_event_view_t *view, int *index);         // The payload is valid until the next call, index (optional) is the index in the stream, XED_E_ABORT after the last event
+int XedCloseIterator(struct xed_iterator *iterator);
+
+// Asynchronous reads: many event reads outstanding at once from one thread (e.g. to keep an SSD's queue deep). On Linux, reads are issued through io_uring where
+// the kernel allows it, otherwise (or with XED_ASYNC_THREADS, or a XED_READER_DIRECT reader) a pool of threads makes blocking reads. Each request is resolved from the index when submitted,
+// and read (event header and payload) with a single read of the event's bytes into the caller's buffer.
+typedef struct xed_async_request
+{
+    // Set by the caller
+    int stream;                     // Event to read (stream or XED_STREAM_ALL, and index)
+    int index;
+    void *buffer;                   // Payload destination (bufferSize bytes, any bytes beyond are not read, as XedReadEvent)
+    size_t bufferSize;
+    void (*callback)(struct xed_async_request *request);    // Called from XedPollCompletions when the read completes (may be NULL)
+    void *userData;
+    // Set on completion
+    int result;                     // XED_OK, or an error
+    xed_event_t event;
+    xed_frame_info_t frameInfo;
+    size_t length;                  // Payload bytes in the buffer
+    // (internal)
+    uint64_t _offset;               // From the index entry: file offset, header and payload sizes
+    size_t _headerSize;
+    size_t _payloadSize;
+    unsigned char _header[48];
+    int64_t _bytesRead;
+    struct xed_async_request *_next;
+} xed_async_request_t;
+
+#define XED_ASYNC_THREADS       0x01    // Use the thread pool, even where io_uring is available
+
+struct xed_async;
+
+// An async context is used from one thread (submitting and polling). The reader must stay open until the context is closed.
+struct xed_async *XedNewAsync(struct xed_reader *reader, int queueDepth, int flags);          // At most queueDepth reads outstanding (0 = default)
+int XedSubmitRead(struct xed_async *async, xed_async_request_t *request);                    // The request must stay valid until it completes; XED_E_NOT_VALID_STATE if queueDepth reads are outstanding (poll first)
+int XedPollCompletions(struct xed_async *async, int minCompletions);                         // Waits for at least minCompletions (0 = none) of the outstanding reads, calls their callbacks, returns the number completed
+int XedAsyncIsUring(struct xed_async *async);                                                // 1 if reads are through io_uring, 0 for the thread pool
+int XedCloseAsync(struct xed_async *async);                                                  // Completes any outstanding reads (calling their callbacks)
+
+struct xed_writer;
+
+// Writes an EVENTS1 file: events are indexed as they are added (the first two events of each stream should be its initial and empty events), the indexes and end information are written on closing
+struct xed_writer *XedNewWriter(const char *filename, int numStreams, int maxIndexEntries);    // maxIndexEntries per index block (0 = 1024)
+int XedWriterWriteEvent(struct xed_writer *writer, const xed_event_t *event, const xed_frame_info_t *frameInfo, const void *data);  // frameInfo is required if the event is timestamped, data is event->length bytes
+int XedWriterCopyEvent(struct xed_writer *writer, struct xed_reader *reader, int stream, int index);   // Copies the event's bytes unchanged (file-to-file where supported), the reader must stay open until the writer is closed
+int XedCloseWriter(struct xed_writer *writer);
 
 
 #endif
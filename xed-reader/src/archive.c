@@ -0,0 +1,516 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// Depth Archive -- the depth frames of a .xed file, losslessly compressed, with a frame table for random access
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xed/xed.h"
+#include "xed/archive.h"
+#include "xed_internal.h"
+
+
+// Archive file layout (little-endian, except for the frame information, which is kept big-endian as in the .xed file):
+//   header (32 bytes): @0 "XEDDZ1\0\0", @8 uint32 numFrames, @12 uint32 flags, @16 uint64 tableOffset, @24 uint32 keyInterval, @28 uint32 stream
+//   frames: @0 event header (24 bytes, as xed_event_t), @24 frame information (24 bytes, as xed_frame_info_t), @48 uint32 method, @52 uint32 dataSize, @56 data[dataSize]
+//   frame table at tableOffset (numFrames * 24 bytes): @0 uint64 offset, @8 uint64 timestamp, @16 uint32 size (of the frame record), @20 uint32 keyIndex (frame to start decoding from)
+#define XED_ARCHIVE_HEADER_SIZE 32
+#define XED_ARCHIVE_RECORD_SIZE 56
+#define XED_ARCHIVE_ENTRY_SIZE  24
+
+// Frame encodings
+#define XED_ARCHIVE_METHOD_RAW      0   // The payload as it is (if it would not be smaller encoded)
+#define XED_ARCHIVE_METHOD_RVL      1   // Run-length of zero (no reading) pixels, and variable-length differences between consecutive non-zero pixels (a key frame)
+#define XED_ARCHIVE_METHOD_TEMPORAL 2   // Run-length of unchanged pixels, and variable-length differences from the previous frame of the changed pixels
+
+// Frame table entry
+typedef struct
+{
+    uint64_t offset;
+    uint64_t timestamp;
+    uint32_t size;
+    uint32_t keyIndex;
+} xed_archive_entry_t;
+
+typedef struct xed_archive
+{
+    FILE *fp;
+    int numFrames;
+    xed_archive_entry_t *table;
+    unsigned char *record;          // The most recently read frame record
+    size_t recordSize;
+    uint16_t *frame;                // The most recently decoded frame (host order)
+    size_t framePixels;
+    int current;                    // Index of the decoded frame (-1 if none)
+    xed_event_t event;              // Header and frame information of the decoded frame
+    xed_frame_info_t frameInfo;
+} xed_archive_t;
+
+
+// Utility methods
+static uint32_t get_uint32(const unsigned char *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint64_t get_uint64(const unsigned char *p) { return (uint64_t)get_uint32(p) | ((uint64_t)get_uint32(p + 4) << 32); }
+static void put_uint32(unsigned char *p, uint32_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24); }
+static void put_uint64(unsigned char *p, uint64_t v) { put_uint32(p, (uint32_t)v); put_uint32(p + 4, (uint32_t)(v >> 32)); }
+
+
+// Variable-length codes: 3 bits per nibble (least significant first), the top bit set if more follow; nibbles are packed high then low in each byte
+typedef struct
+{
+    unsigned char *p;
+    int half;                       // The low nibble of *p is next
+} xed_nibble_writer_t;
+
+typedef struct
+{
+    const unsigned char *p;
+    const unsigned char *end;
+    int half;
+} xed_nibble_reader_t;
+
+static void XedArchivePutCode(xed_nibble_writer_t *writer, uint32_t value)
+{
+    do
+    {
+        unsigned int nibble = value & 7;
+        value >>= 3;
+        if (value) { nibble |= 8; }
+        if (writer->half) { *writer->p++ |= (unsigned char)nibble; writer->half = 0; }
+        else { *writer->p = (unsigned char)(nibble << 4); writer->half = 1; }
+    } while (value);
+}
+
+// Returns 0 if the data ends part way through a code
+static int XedArchiveGetCode(xed_nibble_reader_t *reader, uint32_t *value)
+{
+    uint32_t v = 0;
+    int shift = 0;
+    unsigned int nibble;
+
+    do
+    {
+        if (reader->p >= reader->end || shift > 30) { return 0; }
+        if (reader->half) { nibble = *reader->p++ & 0x0f; reader->half = 0; }
+        else { nibble = *reader->p >> 4; reader->half = 1; }
+        v |= (uint32_t)(nibble & 7) << shift;
+        shift += 3;
+    } while (nibble & 8);
+
+    *value = v;
+    return 1;
+}
+
+// Signed differences as unsigned codes (0, -1, 1, -2, 2, ...)
+static uint32_t XedArchiveZigZag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static int32_t XedArchiveUnZigZag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// Maximum encoded size of a frame (every pixel a separate run of the longest code)
+static size_t XedArchiveMaxEncodedSize(size_t pixels) { return pixels * 8 + 16; }
+
+
+// Encode a frame (host order), as a key frame (previous == NULL) or as its differences from the previous frame -- returns the encoded size
+static size_t XedArchiveEncode(const uint16_t *values, const uint16_t *previous, size_t pixels, unsigned char *out)
+{
+    xed_nibble_writer_t writer;
+    int32_t last = 0;
+    size_t i = 0;
+
+    writer.p = out;
+    writer.half = 0;
+    while (i < pixels)
+    {
+        size_t start = i, run;
+
+        // Zero pixels (key frame), or unchanged pixels
+        if (previous == NULL) { while (i < pixels && values[i] == 0) { i++; } }
+        else { while (i < pixels && values[i] == previous[i]) { i++; } }
+        XedArchivePutCode(&writer, (uint32_t)(i - start));
+
+        // Followed by the other pixels
+        start = i;
+        if (previous == NULL) { while (i < pixels && values[i] != 0) { i++; } }
+        else { while (i < pixels && values[i] != previous[i]) { i++; } }
+        XedArchivePutCode(&writer, (uint32_t)(i - start));
+        for (run = start; run < i; run++)
+        {
+            if (previous == NULL) { XedArchivePutCode(&writer, XedArchiveZigZag((int32_t)values[run] - last)); last = values[run]; }
+            else { XedArchivePutCode(&writer, XedArchiveZigZag((int16_t)(values[run] - previous[run]))); }
+        }
+    }
+
+    return (size_t)(writer.p - out) + (writer.half ? 1 : 0);
+}
+
+// Decode a frame in place: a key frame overwrites the values, otherwise the values are the previous frame and are updated
+static int XedArchiveDecode(const unsigned char *data, size_t length, int method, uint16_t *values, size_t pixels)
+{
+    xed_nibble_reader_t reader;
+    int32_t last = 0;
+    size_t i = 0;
+
+    reader.p = data;
+    reader.end = data + length;
+    reader.half = 0;
+    while (i < pixels)
+    {
+        uint32_t skip, count, code;
+
+        if (!XedArchiveGetCode(&reader, &skip) || !XedArchiveGetCode(&reader, &count)) { return XED_E_INVALID_DATA; }
+        if (skip > pixels - i || count > pixels - i - skip) { return XED_E_INVALID_DATA; }
+        if (method == XED_ARCHIVE_METHOD_RVL) { memset(values + i, 0, skip * sizeof(uint16_t)); }
+        i += skip;
+
+        for (; count > 0; count--, i++)
+        {
+            if (!XedArchiveGetCode(&reader, &code)) { return XED_E_INVALID_DATA; }
+            if (method == XED_ARCHIVE_METHOD_RVL) { last += XedArchiveUnZigZag(code); values[i] = (uint16_t)last; }
+            else { values[i] = (uint16_t)(values[i] + XedArchiveUnZigZag(code)); }
+        }
+    }
+
+    return XED_OK;
+}
+
+
+int XedArchiveCreate(xed_reader_t *reader, int stream, const char *filename, int flags, int keyInterval)
+{
+    unsigned char header[XED_ARCHIVE_HEADER_SIZE] = {0};
+    xed_archive_entry_t *table = NULL;
+    int maxFrames = 0, numFrames = 0;
+    uint16_t *values = NULL, *previous = NULL;
+    unsigned char *encoded = NULL, *temporal = NULL;
+    size_t pixels = 0;
+    uint64_t offset = XED_ARCHIVE_HEADER_SIZE;
+    int sinceKey = 0;
+    int numEvents, i;
+    int ret = XED_OK;
+    FILE *fp;
+
+    if (reader == NULL || filename == NULL) { return XED_E_POINTER; }
+    numEvents = XedGetNumEvents(reader, stream);
+    if (numEvents < 0) { return numEvents; }
+    if (keyInterval <= 0) { keyInterval = XED_ARCHIVE_DEFAULT_KEY_INTERVAL; }
+
+    fp = fopen(filename, "wb");
+    if (fp == NULL) { XedLog(XED_LOG_ERROR, "Problem creating archive file: %s", filename); return XED_E_ACCESS_DENIED; }
+    fwrite(header, 1, sizeof(header), fp);                  // (Written on completion)
+
+    for (i = 0; i < numEvents && ret == XED_OK; i++)
+    {
+        unsigned char record[XED_ARCHIVE_RECORD_SIZE];
+        xed_event_view_t view;
+        const unsigned char *src;
+        const unsigned char *data;
+        size_t size, p;
+        int method;
+
+        ret = XedMapEvent(reader, stream, i, &view);
+        if (ret != XED_OK) { break; }
+
+        // Only depth frames (a 16-bit value per pixel)
+        if (view.event.timestamp == 0 || view.frameInfo.width == 0 || view.frameInfo.height == 0 || view.length != (size_t)view.frameInfo.width * view.frameInfo.height * 2)
+        {
+            XedUnmapEvent(reader, &view);
+            continue;
+        }
+
+        if (view.length / 2 != pixels)
+        {
+            // (Re)allocate for the frame size, which starts a new sequence of frames
+            uint16_t *newValues = (uint16_t *)realloc(values, view.length);
+            uint16_t *newPrevious = (uint16_t *)realloc(previous, view.length);
+            if (newValues != NULL) { values = newValues; }
+            if (newPrevious != NULL) { previous = newPrevious; }
+            free(encoded); free(temporal);
+            encoded = (unsigned char *)malloc(XedArchiveMaxEncodedSize(view.length / 2));
+            temporal = (unsigned char *)malloc(XedArchiveMaxEncodedSize(view.length / 2));
+            if (newValues == NULL || newPrevious == NULL || encoded == NULL || temporal == NULL) { XedUnmapEvent(reader, &view); pixels = 0; ret = XED_E_OUT_OF_MEMORY; break; }
+            pixels = view.length / 2;
+            sinceKey = keyInterval;
+        }
+        if (numFrames >= maxFrames)
+        {
+            int newMaxFrames = maxFrames ? 2 * maxFrames : 1024;
+            xed_archive_entry_t *newTable = (xed_archive_entry_t *)realloc(table, newMaxFrames * sizeof(xed_archive_entry_t));
+            if (newTable == NULL) { XedUnmapEvent(reader, &view); ret = XED_E_OUT_OF_MEMORY; break; }
+            table = newTable;
+            maxFrames = newMaxFrames;
+        }
+
+        // Big-endian payload to host order
+        src = (const unsigned char *)view.data;
+        for (p = 0; p < pixels; p++) { values[p] = (uint16_t)((src[2 * p] << 8) | src[2 * p + 1]); }
+
+        // Key frame, or the difference from the previous frame if that is smaller
+        method = XED_ARCHIVE_METHOD_RVL;
+        data = encoded;
+        size = XedArchiveEncode(values, NULL, pixels, encoded);
+        if ((flags & XED_ARCHIVE_TEMPORAL) && sinceKey < keyInterval)
+        {
+            size_t temporalSize = XedArchiveEncode(values, previous, pixels, temporal);
+            if (temporalSize < size) { method = XED_ARCHIVE_METHOD_TEMPORAL; data = temporal; size = temporalSize; }
+        }
+        if (size >= view.length) { method = XED_ARCHIVE_METHOD_RAW; data = src; size = view.length; }
+        if (method == XED_ARCHIVE_METHOD_TEMPORAL) { sinceKey++; }
+        else { sinceKey = 1; }
+
+        table[numFrames].offset = offset;
+        table[numFrames].timestamp = view.event.timestamp;
+        table[numFrames].size = (uint32_t)(XED_ARCHIVE_RECORD_SIZE + size);
+        table[numFrames].keyIndex = (method == XED_ARCHIVE_METHOD_TEMPORAL) ? table[numFrames - 1].keyIndex : (uint32_t)numFrames;
+
+        XedEncodeEvent(record, &view.event);
+        XedEncodeEventFrameInfo(record + 24, &view.frameInfo);
+        put_uint32(record + 48, (uint32_t)method);
+        put_uint32(record + 52, (uint32_t)size);
+        if (fwrite(record, 1, sizeof(record), fp) != sizeof(record) || fwrite(data, 1, size, fp) != size) { ret = XED_E_ACCESS_DENIED; }
+        offset += XED_ARCHIVE_RECORD_SIZE + size;
+        numFrames++;
+
+        XedUnmapEvent(reader, &view);
+        { uint16_t *swap = previous; previous = values; values = swap; }
+    }
+
+    // Frame table, then the header
+    for (i = 0; i < numFrames && ret == XED_OK; i++)
+    {
+        unsigned char entry[XED_ARCHIVE_ENTRY_SIZE];
+        put_uint64(entry + 0, table[i].offset);
+        put_uint64(entry + 8, table[i].timestamp);
+        put_uint32(entry + 16, table[i].size);
+        put_uint32(entry + 20, table[i].keyIndex);
+        if (fwrite(entry, 1, sizeof(entry), fp) != sizeof(entry)) { ret = XED_E_ACCESS_DENIED; }
+    }
+    memcpy(header, "XEDDZ1", 7);
+    put_uint32(header + 8, (uint32_t)numFrames);
+    put_uint32(header + 12, (uint32_t)flags);
+    put_uint64(header + 16, offset);
+    put_uint32(header + 24, (uint32_t)keyInterval);
+    put_uint32(header + 28, (uint32_t)stream);
+    if (ret == XED_OK && (fseek(fp, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), fp) != sizeof(header))) { ret = XED_E_ACCESS_DENIED; }
+    if (fclose(fp) != 0 && ret == XED_OK) { ret = XED_E_ACCESS_DENIED; }
+    if (ret != XED_OK) { XedLog(XED_LOG_ERROR, "Problem writing archive file: %s", filename); remove(filename); }
+
+    free(table);
+    free(values);
+    free(previous);
+    free(encoded);
+    free(temporal);
+    return ret;
+}
+
+
+xed_archive_t *XedOpenArchive(const char *filename)
+{
+    unsigned char header[XED_ARCHIVE_HEADER_SIZE];
+    xed_archive_t *archive;
+    unsigned char *entries;
+    uint64_t tableOffset, fileSize = 0;
+    int i;
+
+    if (filename == NULL) { return NULL; }                  // XED_E_POINTER
+
+    archive = (xed_archive_t *)malloc(sizeof(xed_archive_t));
+    if (archive == NULL) { return NULL; }                   // XED_E_OUT_OF_MEMORY
+    memset(archive, 0, sizeof(xed_archive_t));
+    archive->current = -1;
+
+    archive->fp = fopen(filename, "rb");
+    if (archive->fp == NULL) { XedLog(XED_LOG_ERROR, "Problem opening archive file: %s", filename); XedCloseArchive(archive); return NULL; }
+    if (fread(header, 1, sizeof(header), archive->fp) != sizeof(header) || memcmp(header, "XEDDZ1\0", 8) != 0)
+    {
+        XedLog(XED_LOG_ERROR, "Not a depth archive file: %s", filename);
+        XedCloseArchive(archive);
+        return NULL;
+    }
+    archive->numFrames = (int)get_uint32(header + 8);
+    tableOffset = get_uint64(header + 16);
+
+    // Frame table: must be within the file (checked before allocating for it)
+    if (fseeko(archive->fp, 0, SEEK_END) == 0) { int64_t end = (int64_t)ftello(archive->fp); if (end > 0) { fileSize = (uint64_t)end; } }
+    if (archive->numFrames < 0 || tableOffset < XED_ARCHIVE_HEADER_SIZE || tableOffset > fileSize || (uint64_t)archive->numFrames * XED_ARCHIVE_ENTRY_SIZE > fileSize - tableOffset)
+    {
+        XedLog(XED_LOG_ERROR, "Archive frame table is not within the file: %s", filename);
+        XedCloseArchive(archive);
+        return NULL;
+    }
+    archive->table = (xed_archive_entry_t *)malloc(((size_t)archive->numFrames + 1) * sizeof(xed_archive_entry_t));
+    entries = (unsigned char *)malloc((size_t)archive->numFrames * XED_ARCHIVE_ENTRY_SIZE + 1);
+    if (archive->table == NULL || entries == NULL || fseeko(archive->fp, tableOffset, SEEK_SET) != 0 || fread(entries, XED_ARCHIVE_ENTRY_SIZE, archive->numFrames, archive->fp) != (size_t)archive->numFrames)
+    {
+        XedLog(XED_LOG_ERROR, "Problem reading archive frame table: %s", filename);
+        free(entries);
+        XedCloseArchive(archive);
+        return NULL;
+    }
+    for (i = 0; i < archive->numFrames; i++)
+    {
+        const unsigned char *p = entries + (size_t)i * XED_ARCHIVE_ENTRY_SIZE;
+        archive->table[i].offset = get_uint64(p + 0);
+        archive->table[i].timestamp = get_uint64(p + 8);
+        archive->table[i].size = get_uint32(p + 16);
+        archive->table[i].keyIndex = get_uint32(p + 20);
+        if (archive->table[i].size < XED_ARCHIVE_RECORD_SIZE || archive->table[i].keyIndex > (uint32_t)i) { archive->numFrames = i; break; }   // (Damaged: only the frames before)
+    }
+    free(entries);
+
+    return archive;
+}
+
+
+int XedCloseArchive(xed_archive_t *archive)
+{
+    if (archive == NULL) { return XED_E_POINTER; }
+    if (archive->fp != NULL) { fclose(archive->fp); }
+    free(archive->table);
+    free(archive->record);
+    free(archive->frame);
+    free(archive);
+    return XED_OK;
+}
+
+
+int XedArchiveGetNumFrames(xed_archive_t *archive)
+{
+    if (archive == NULL) { return XED_E_POINTER; }
+    return archive->numFrames;
+}
+
+
+// Read a frame record (its header and encoded data)
+static int XedArchiveReadRecord(xed_archive_t *archive, int index, xed_event_t *event, xed_frame_info_t *frameInfo, int *method, size_t *dataSize)
+{
+    const xed_archive_entry_t *entry = &archive->table[index];
+
+    if (entry->size > archive->recordSize)
+    {
+        unsigned char *newRecord = (unsigned char *)realloc(archive->record, entry->size);
+        if (newRecord == NULL) { return XED_E_OUT_OF_MEMORY; }
+        archive->record = newRecord;
+        archive->recordSize = entry->size;
+    }
+    if (fseeko(archive->fp, entry->offset, SEEK_SET) != 0 || fread(archive->record, 1, entry->size, archive->fp) != entry->size) { return XED_E_ACCESS_DENIED; }
+
+    XedDecodeEvent(archive->record, event);
+    XedDecodeEventFrameInfo(archive->record + 24, frameInfo);
+    *method = (int)get_uint32(archive->record + 48);
+    *dataSize = get_uint32(archive->record + 52);
+    if (*dataSize != entry->size - XED_ARCHIVE_RECORD_SIZE || (event->length & 1)) { return XED_E_INVALID_DATA; }
+    return XED_OK;
+}
+
+// Decode a frame into the archive's frame buffer, from the decoded frame or the frame's key frame
+static int XedArchiveDecodeFrame(xed_archive_t *archive, int index)
+{
+    int first, i;
+
+    first = (int)archive->table[index].keyIndex;
+    if (archive->current >= first && archive->current < index) { first = archive->current + 1; }
+    else if (archive->current == index) { return XED_OK; }
+
+    for (i = first; i <= index; i++)
+    {
+        int decoded = archive->current;
+        size_t dataSize, pixels;
+        int method, ret;
+
+        archive->current = -1;
+        ret = XedArchiveReadRecord(archive, i, &archive->event, &archive->frameInfo, &method, &dataSize);
+        if (ret != XED_OK) { return ret; }
+        pixels = archive->event.length / 2;
+        if (method == XED_ARCHIVE_METHOD_TEMPORAL && (decoded != i - 1 || pixels != archive->framePixels)) { return XED_E_INVALID_DATA; }   // (Only following the decoded previous frame)
+
+        if (pixels > archive->framePixels || archive->frame == NULL)
+        {
+            uint16_t *newFrame = (uint16_t *)realloc(archive->frame, pixels * sizeof(uint16_t) + 1);
+            if (newFrame == NULL) { return XED_E_OUT_OF_MEMORY; }
+            archive->frame = newFrame;
+        }
+        archive->framePixels = pixels;
+
+        if (method == XED_ARCHIVE_METHOD_RAW)
+        {
+            const unsigned char *src = archive->record + XED_ARCHIVE_RECORD_SIZE;
+            size_t p;
+            if (dataSize != pixels * 2) { return XED_E_INVALID_DATA; }
+            for (p = 0; p < pixels; p++) { archive->frame[p] = (uint16_t)((src[2 * p] << 8) | src[2 * p + 1]); }
+        }
+        else if (method == XED_ARCHIVE_METHOD_RVL || method == XED_ARCHIVE_METHOD_TEMPORAL)
+        {
+            ret = XedArchiveDecode(archive->record + XED_ARCHIVE_RECORD_SIZE, dataSize, method, archive->frame, pixels);
+            if (ret != XED_OK) { return ret; }
+        }
+        else { return XED_E_INVALID_DATA; }
+        archive->current = i;
+    }
+
+    return XED_OK;
+}
+
+
+int XedArchiveReadFrame(xed_archive_t *archive, int index, xed_event_t *event, xed_frame_info_t *frameInfo, void *buffer, size_t bufferSize)
+{
+    unsigned char *dst = (unsigned char *)buffer;
+    size_t bytes, p;
+    int method, ret;
+
+    if (archive == NULL || event == NULL || frameInfo == NULL) { return XED_E_POINTER; }
+    if (bufferSize > 0 && buffer == NULL) { return XED_E_POINTER; }
+    if (index < 0 || index >= archive->numFrames) { return XED_E_INVALID_ARG; }
+
+    // Header only (the decoded frame is kept)
+    if (bufferSize == 0 && archive->current != index)
+    {
+        size_t dataSize;
+        return XedArchiveReadRecord(archive, index, event, frameInfo, &method, &dataSize);
+    }
+
+    ret = XedArchiveDecodeFrame(archive, index);
+    if (ret != XED_OK) { return ret; }
+    *event = archive->event;
+    *frameInfo = archive->frameInfo;
+
+    // Host order to big-endian (any bytes beyond the buffer size are not written)
+    bytes = archive->framePixels * 2;
+    if (bytes > bufferSize) { bytes = bufferSize; }
+    for (p = 0; p + 1 < bytes; p += 2)
+    {
+        uint16_t v = archive->frame[p / 2];
+        dst[p] = (unsigned char)(v >> 8);
+        dst[p + 1] = (unsigned char)v;
+    }
+    if (p < bytes) { dst[p] = (unsigned char)(archive->frame[p / 2] >> 8); }
+
+    return XED_OK;
+}
@@ -0,0 +1,423 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// Depth Frame Processing
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#include "xed/xed.h"
+#include "xed/depth.h"
+
+// SSE2 is part of the x64 baseline (and may be enabled for x86); AVX2 is selected at run-time
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XED_HAVE_SSE2
+#include <emmintrin.h>
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define XED_HAVE_AVX2
+#define XED_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1800
+#define XED_HAVE_AVX2
+#define XED_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+#endif
+
+
+// Stretch a 12-bit depth value over the near to far range
+static int XedDepthStretch(int v, int nearDepth, int farDepth)
+{
+    if (v < nearDepth) { return 0; }
+    v = (v - nearDepth) * XED_DEPTH_VALUES / (farDepth - nearDepth);
+    if (v >= XED_DEPTH_VALUES) { v = XED_DEPTH_VALUES - 1; }
+    return v;
+}
+
+// Pack a color as the output pixel bytes (little-endian)
+static uint32_t XedDepthPackPixel(int format, unsigned char r, unsigned char g, unsigned char b)
+{
+    if (format == XED_PIXEL_RGB555) { return ((uint32_t)(r >> 3) << 10) | ((uint32_t)(g >> 3) << 5) | ((uint32_t)(b >> 3) << 0); }
+    if (format == XED_PIXEL_RGB24) { return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16); }
+    return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)0xff << 24);
+}
+
+static int XedDepthBytesPerPixel(int format)
+{
+    if (format == XED_PIXEL_RGB555) { return 2; }
+    if (format == XED_PIXEL_RGB24) { return 3; }
+    if (format == XED_PIXEL_RGBA32) { return 4; }
+    return 0;
+}
+
+
+int XedDepthColormapInit(xed_depth_colormap_t *colormap, int format, int nearDepth, int farDepth, int palette)
+{
+    int v;
+
+    if (colormap == NULL) { return XED_E_POINTER; }
+    if (XedDepthBytesPerPixel(format) == 0 || nearDepth < 0 || farDepth <= nearDepth) { return XED_E_INVALID_ARG; }
+    if (palette != XED_PALETTE_HUE && palette != XED_PALETTE_GREY) { return XED_E_INVALID_ARG; }
+
+    colormap->format = format;
+    colormap->bytesPerPixel = XedDepthBytesPerPixel(format);
+
+    for (v = 0; v < XED_DEPTH_VALUES; v++)
+    {
+        int s = XedDepthStretch(v, nearDepth, farDepth);
+        unsigned char r, g, b;
+
+        if (palette == XED_PALETTE_GREY)
+        {
+            r = g = b = (unsigned char)(s >> 4);
+        }
+        else
+        {
+            #define RGB_MAX 255
+            #define V_MAX XED_DEPTH_VALUES
+            unsigned char z = (unsigned char)(RGB_MAX * (s % (V_MAX / 6 + 1)) / (V_MAX / 6 + 1));
+            if      (s < (1 * V_MAX / 6)) { r = RGB_MAX;     g = z;           b = 0; }
+            else if (s < (2 * V_MAX / 6)) { r = RGB_MAX - z; g = RGB_MAX;     b = 0; }
+            else if (s < (3 * V_MAX / 6)) { r = 0;           g = RGB_MAX;     b = z; }
+            else if (s < (4 * V_MAX / 6)) { r = 0;           g = RGB_MAX - z; b = RGB_MAX; }
+            else if (s < (5 * V_MAX / 6)) { r = z;           g = 0;           b = RGB_MAX; }
+            else                          { r = RGB_MAX;     g = z;           b = RGB_MAX; }
+            #undef RGB_MAX
+            #undef V_MAX
+        }
+
+        colormap->lut[v] = XedDepthPackPixel(format, r, g, b);
+    }
+
+    return XED_OK;
+}
+
+
+int XedDepthColormapInitCustom(xed_depth_colormap_t *colormap, int format, int nearDepth, int farDepth, const uint32_t *colors, int count)
+{
+    int v;
+
+    if (colormap == NULL || colors == NULL) { return XED_E_POINTER; }
+    if (XedDepthBytesPerPixel(format) == 0 || nearDepth < 0 || farDepth <= nearDepth || count < 2) { return XED_E_INVALID_ARG; }
+
+    colormap->format = format;
+    colormap->bytesPerPixel = XedDepthBytesPerPixel(format);
+
+    for (v = 0; v < XED_DEPTH_VALUES; v++)
+    {
+        // Position between two palette entries
+        int pos = XedDepthStretch(v, nearDepth, farDepth) * (count - 1);
+        int i = pos / (XED_DEPTH_VALUES - 1);
+        int f = pos % (XED_DEPTH_VALUES - 1);
+        uint32_t a = colors[i];
+        uint32_t b = colors[(i + 1 < count) ? i + 1 : i];
+        int c[3], j;
+
+        for (j = 0; j < 3; j++)
+        {
+            int ca = (a >> (16 - 8 * j)) & 0xff;
+            int cb = (b >> (16 - 8 * j)) & 0xff;
+            c[j] = ca + (cb - ca) * f / (XED_DEPTH_VALUES - 1);
+        }
+        colormap->lut[v] = XedDepthPackPixel(format, (unsigned char)c[0], (unsigned char)c[1], (unsigned char)c[2]);
+    }
+
+    return XED_OK;
+}
+
+
+// Colorize one row of pixels
+typedef void (*xed_colorize_row_t)(const xed_depth_colormap_t *colormap, const unsigned char *src, unsigned char *dst, int count);
+
+static void XedColorizeRowScalar(const xed_depth_colormap_t *colormap, const unsigned char *src, unsigned char *dst, int count)
+{
+    const uint32_t *lut = colormap->lut;
+    int x;
+
+    for (x = 0; x < count; x++)
+    {
+        uint32_t c = lut[(((unsigned int)src[0] << 8) | src[1]) & XED_DEPTH_MASK];   // Read (big endian), mask for depth-only
+        dst[0] = (unsigned char)c;
+        dst[1] = (unsigned char)(c >> 8);
+        if (colormap->bytesPerPixel > 2) { dst[2] = (unsigned char)(c >> 16); }
+        if (colormap->bytesPerPixel > 3) { dst[3] = (unsigned char)(c >> 24); }
+        src += 2;
+        dst += colormap->bytesPerPixel;
+    }
+}
+
+#ifdef XED_HAVE_SSE2
+// Byte-swap and mask eight pixels at a time, then look them up
+static void XedColorizeRowSse2(const xed_depth_colormap_t *colormap, const unsigned char *src, unsigned char *dst, int count)
+{
+    const uint32_t *lut = colormap->lut;
+    const __m128i mask = _mm_set1_epi16(XED_DEPTH_MASK);
+    uint16_t idx[8];
+    int x, i;
+
+    for (x = 0; x + 8 <= count; x += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * x));
+        v = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)), mask);
+        _mm_storeu_si128((__m128i *)idx, v);
+
+        if (colormap->format == XED_PIXEL_RGB555)
+        {
+            _mm_storeu_si128((__m128i *)(dst + 2 * x), _mm_setr_epi16((short)lut[idx[0]], (short)lut[idx[1]], (short)lut[idx[2]], (short)lut[idx[3]], (short)lut[idx[4]], (short)lut[idx[5]], (short)lut[idx[6]], (short)lut[idx[7]]));
+        }
+        else if (colormap->format == XED_PIXEL_RGBA32)
+        {
+            _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_setr_epi32((int)lut[idx[0]], (int)lut[idx[1]], (int)lut[idx[2]], (int)lut[idx[3]]));
+            _mm_storeu_si128((__m128i *)(dst + 4 * x + 16), _mm_setr_epi32((int)lut[idx[4]], (int)lut[idx[5]], (int)lut[idx[6]], (int)lut[idx[7]]));
+        }
+        else
+        {
+            unsigned char *p = dst + 3 * x;
+            for (i = 0; i < 8; i++)
+            {
+                uint32_t c = lut[idx[i]];
+                p[0] = (unsigned char)c; p[1] = (unsigned char)(c >> 8); p[2] = (unsigned char)(c >> 16);
+                p += 3;
+            }
+        }
+    }
+
+    XedColorizeRowScalar(colormap, src + 2 * x, dst + x * colormap->bytesPerPixel, count - x);
+}
+#endif
+
+#ifdef XED_HAVE_AVX2
+// Byte-swap and mask sixteen pixels at a time, then gather them from the table (RGB555 and RGBA32)
+XED_TARGET_AVX2 static void XedColorizeRowAvx2(const xed_depth_colormap_t *colormap, const unsigned char *src, unsigned char *dst, int count)
+{
+    const int *lut = (const int *)colormap->lut;
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i mask = _mm256_set1_epi16(XED_DEPTH_MASK);
+    int x;
+
+    if (colormap->format == XED_PIXEL_RGB24) { XedColorizeRowSse2(colormap, src, dst, count); return; }
+
+    for (x = 0; x + 16 <= count; x += 16)
+    {
+        __m256i v = _mm256_and_si256(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + 2 * x)), swap), mask);
+        __m256i lo = _mm256_i32gather_epi32(lut, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), 4);
+        __m256i hi = _mm256_i32gather_epi32(lut, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), 4);
+
+        if (colormap->format == XED_PIXEL_RGB555)
+        {
+            // Pack to 16-bit (per 128-bit lane), then restore the pixel order
+            _mm256_storeu_si256((__m256i *)(dst + 2 * x), _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8));
+        }
+        else
+        {
+            _mm256_storeu_si256((__m256i *)(dst + 4 * x), lo);
+            _mm256_storeu_si256((__m256i *)(dst + 4 * x + 32), hi);
+        }
+    }
+
+    XedColorizeRowSse2(colormap, src + 2 * x, dst + x * colormap->bytesPerPixel, count - x);
+}
+#endif
+
+
+// Best SIMD level supported by this build and processor
+static int XedDepthDetectSimd(void)
+{
+    int level = XED_SIMD_NONE;
+#ifdef XED_HAVE_SSE2
+    level = XED_SIMD_SSE2;
+#ifdef XED_HAVE_AVX2
+#ifdef _MSC_VER
+    {
+        int info[4];
+        __cpuid(info, 1);
+        if ((info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6)     // OSXSAVE, and the OS saves the YMM state
+        {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5)) { level = XED_SIMD_AVX2; }
+        }
+    }
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) { level = XED_SIMD_AVX2; }
+#endif
+#endif
+#endif
+    return level;
+}
+
+static int simdLevel = -1;
+
+int XedDepthSetSimdLevel(int maxLevel)
+{
+    int level = XedDepthDetectSimd();
+    if (maxLevel < level) { level = maxLevel; }
+    if (level < XED_SIMD_NONE) { level = XED_SIMD_NONE; }
+    simdLevel = level;
+    return level;
+}
+
+static int XedDepthGetSimdLevel(void)
+{
+    if (simdLevel < 0) { return XedDepthSetSimdLevel(XED_SIMD_AVX2); }
+    return simdLevel;
+}
+
+
+int XedDepthColorize(const xed_depth_colormap_t *colormap, const void *src, size_t srcStride, void *dst, size_t dstStride, int width, int height)
+{
+    xed_colorize_row_t colorizeRow = XedColorizeRowScalar;
+    int level = XedDepthGetSimdLevel();
+    int y;
+
+    if (colormap == NULL || src == NULL || dst == NULL) { return XED_E_POINTER; }
+    if (width < 0 || height < 0 || srcStride < (size_t)width * 2 || dstStride < (size_t)width * colormap->bytesPerPixel) { return XED_E_INVALID_ARG; }
+    if (src == dst && (colormap->format != XED_PIXEL_RGB555 || srcStride != dstStride)) { return XED_E_INVALID_ARG; }
+
+#ifdef XED_HAVE_SSE2
+    if (level >= XED_SIMD_SSE2) { colorizeRow = XedColorizeRowSse2; }
+#endif
+#ifdef XED_HAVE_AVX2
+    if (level >= XED_SIMD_AVX2) { colorizeRow = XedColorizeRowAvx2; }
+#endif
+
+    for (y = 0; y < height; y++)
+    {
+        colorizeRow(colormap, (const unsigned char *)src + y * srcStride, (unsigned char *)dst + y * dstStride, width);
+    }
+
+    return XED_OK;
+}
+
+
+// Unpack a run of pixels to separate outputs (any may be NULL)
+typedef void (*xed_unpack_t)(const unsigned char *src, uint16_t *depth, uint8_t *player, float *meters, size_t count, int keepPlayer);
+
+static void XedUnpackScalar(const unsigned char *src, uint16_t *depth, uint8_t *player, float *meters, size_t count, int keepPlayer)
+{
+    uint16_t mask = keepPlayer ? 0xffff : XED_DEPTH_MASK;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        uint16_t v = (uint16_t)(((unsigned int)src[2 * i] << 8) | src[2 * i + 1]);   // Read (big endian)
+        if (depth != NULL) { depth[i] = v & mask; }
+        if (player != NULL) { player[i] = (uint8_t)(v >> 12); }
+        if (meters != NULL) { meters[i] = (float)(v & XED_DEPTH_MASK) / 1000.0f; }
+    }
+}
+
+#ifdef XED_HAVE_SSE2
+// Byte-swap eight pixels at a time with shifts (SSE2 has no byte shuffle)
+static void XedUnpackSse2(const unsigned char *src, uint16_t *depth, uint8_t *player, float *meters, size_t count, int keepPlayer)
+{
+    const __m128i mask = _mm_set1_epi16(keepPlayer ? (short)0xffff : XED_DEPTH_MASK);
+    const __m128i depthMask = _mm_set1_epi16(XED_DEPTH_MASK);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(1000.0f);
+    size_t i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        if (depth != NULL) { _mm_storeu_si128((__m128i *)(depth + i), _mm_and_si128(v, mask)); }
+        if (player != NULL) { _mm_storel_epi64((__m128i *)(player + i), _mm_packus_epi16(_mm_srli_epi16(v, 12), zero)); }
+        if (meters != NULL)
+        {
+            __m128i d = _mm_and_si128(v, depthMask);
+            _mm_storeu_ps(meters + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(d, zero)), scale));
+            _mm_storeu_ps(meters + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(d, zero)), scale));
+        }
+    }
+
+    XedUnpackScalar(src + 2 * i, depth ? depth + i : NULL, player ? player + i : NULL, meters ? meters + i : NULL, count - i, keepPlayer);
+}
+#endif
+
+#ifdef XED_HAVE_AVX2
+// Byte-swap sixteen pixels at a time with a byte shuffle
+XED_TARGET_AVX2 static void XedUnpackAvx2(const unsigned char *src, uint16_t *depth, uint8_t *player, float *meters, size_t count, int keepPlayer)
+{
+    const __m256i swap = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const __m256i mask = _mm256_set1_epi16(keepPlayer ? (short)0xffff : XED_DEPTH_MASK);
+    const __m256i depthMask = _mm256_set1_epi16(XED_DEPTH_MASK);
+    const __m256 scale = _mm256_set1_ps(1000.0f);
+    size_t i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src + 2 * i)), swap);
+        if (depth != NULL) { _mm256_storeu_si256((__m256i *)(depth + i), _mm256_and_si256(v, mask)); }
+        if (player != NULL)
+        {
+            __m256i p = _mm256_srli_epi16(v, 12);
+            _mm_storeu_si128((__m128i *)(player + i), _mm_packus_epi16(_mm256_castsi256_si128(p), _mm256_extracti128_si256(p, 1)));
+        }
+        if (meters != NULL)
+        {
+            __m256i d = _mm256_and_si256(v, depthMask);
+            _mm256_storeu_ps(meters + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(d))), scale));
+            _mm256_storeu_ps(meters + i + 8, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(d, 1))), scale));
+        }
+    }
+
+    XedUnpackSse2(src + 2 * i, depth ? depth + i : NULL, player ? player + i : NULL, meters ? meters + i : NULL, count - i, keepPlayer);
+}
+#endif
+
+static xed_unpack_t XedDepthUnpackKernel(void)
+{
+    int level = XedDepthGetSimdLevel();
+    (void)level;
+#ifdef XED_HAVE_AVX2
+    if (level >= XED_SIMD_AVX2) { return XedUnpackAvx2; }
+#endif
+#ifdef XED_HAVE_SSE2
+    if (level >= XED_SIMD_SSE2) { return XedUnpackSse2; }
+#endif
+    return XedUnpackScalar;
+}
+
+
+int XedUnpackDepth(const void *src, uint16_t *dst, size_t pixels, int flags)
+{
+    if (src == NULL || dst == NULL) { return XED_E_POINTER; }
+    XedDepthUnpackKernel()((const unsigned char *)src, dst, NULL, NULL, pixels, (flags & XED_UNPACK_KEEP_PLAYER) != 0);
+    return XED_OK;
+}
+
+
+int XedUnpackDepthPlanes(const void *src, uint16_t *depth, uint8_t *player, float *meters, size_t pixels)
+{
+    if (src == NULL) { return XED_E_POINTER; }
+    XedDepthUnpackKernel()((const unsigned char *)src, depth, player, meters, pixels, 0);
+    return XED_OK;
+}
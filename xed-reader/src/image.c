@@ -0,0 +1,249 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// Image File -- BMP, PGM and PPM images, each assembled in memory and written with a single write
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#define open _open
+#define write _write
+#define close _close
+#define IMAGE_OPEN_FLAGS (_O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY), (_S_IREAD | _S_IWRITE)
+#else
+#include <unistd.h>
+#define IMAGE_OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC), 0666
+#endif
+#include "xed/image.h"
+
+
+struct image_stream
+{
+    int fd;
+    unsigned char *buffer;          // Assembled image (kept for the next image)
+    size_t bufferSize;
+};
+
+
+// Little-endian values in the output buffer
+static unsigned char *putshort(unsigned char *p, unsigned int v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); return p + 2; }
+static unsigned char *putlong(unsigned char *p, unsigned long v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24); return p + 4; }
+
+// Ensure the output buffer can hold the image
+static unsigned char *ImageBuffer(unsigned char **buffer, size_t *bufferSize, size_t size)
+{
+    if (size > *bufferSize)
+    {
+        unsigned char *newBuffer = (unsigned char *)realloc(*buffer, size);
+        if (newBuffer == NULL) { return NULL; }
+        *buffer = newBuffer;
+        *bufferSize = size;
+    }
+    return *buffer;
+}
+
+
+// Assemble a BMP file (the same output as BitmapWrite)
+static size_t ImageEncodeBmp(unsigned char **buffer, size_t *bufferSize, const void *src, int bitsPerPixel, int width, int inputStride, int height)
+{
+    int paletteEntries = (bitsPerPixel <= 8) ? (1 << bitsPerPixel) : 0;
+    int stride, len, p, y;
+    size_t size;
+    unsigned char *out;
+
+    bitsPerPixel = ((bitsPerPixel + 7) / 8) * 8;
+    stride = ((((width * bitsPerPixel) + 31) & ~31) >> 3);
+    size = 54 + (size_t)paletteEntries * 4 + (size_t)height * stride;
+    if (ImageBuffer(buffer, bufferSize, size) == NULL) { return 0; }
+    out = *buffer;
+
+    *out++ = 'B'; *out++ = 'M';                             // bfType
+    out = putlong(out, (height * stride) + 54 + (paletteEntries * 4));  // bfSize
+    out = putshort(out, 0);                                 // bfReserved1
+    out = putshort(out, 0);                                 // bfReserved2
+    out = putlong(out, 54 + (paletteEntries * 4));          // bfOffBits
+
+    out = putlong(out, 40);                                 // biSize
+    out = putlong(out, width);                              // biWidth
+    out = putlong(out, height);                             // biHeight
+    out = putshort(out, 1);                                 // biPlanes
+    out = putshort(out, bitsPerPixel);                      // biBitCount
+    out = putlong(out, 0);                                  // biCompression
+    out = putlong(out, height * stride);                    // biSizeImage
+    out = putlong(out, 5000);                               // biXPelsPerMeter
+    out = putlong(out, 5000);                               // biYPelsPerMeter
+    out = putlong(out, 0);                                  // biClrUsed
+    out = putlong(out, 0);                                  // biClrImportant
+
+    // Palette entries
+    for (p = 0; p < paletteEntries; p++)
+    {
+        unsigned char v = (unsigned char)(p * 256 / paletteEntries);
+        *out++ = v; *out++ = v; *out++ = v; *out++ = 0x00;
+    }
+
+    // Bitmap data (bottom row first, each row padded)
+    len = (stride < inputStride) ? stride : inputStride;
+    for (y = height - 1; y >= 0; y--)
+    {
+        memcpy(out, (const unsigned char *)src + (size_t)y * inputStride, len);
+        memset(out + len, 0x00, stride - len);
+        out += stride;
+    }
+
+    return size;
+}
+
+// Assemble a PGM (channels = 1) or PPM (channels = 3) file: samples of one byte, or two bytes (big-endian) above 8 bits per sample
+static size_t ImageEncodeNetpbm(unsigned char **buffer, size_t *bufferSize, const void *src, int channels, int bitsPerSample, int width, int inputStride, int height)
+{
+    char header[64];
+    int headerLength, y;
+    size_t rowValues = (size_t)width * channels;
+    size_t sampleBytes = (bitsPerSample > 8) ? 2 : 1;
+    size_t size;
+    unsigned char *out;
+
+    if (bitsPerSample < 1 || bitsPerSample > 16) { return 0; }
+    headerLength = sprintf(header, "P%c\n%d %d\n%d\n", (channels == 3) ? '6' : '5', width, height, (1 << bitsPerSample) - 1);
+    size = headerLength + rowValues * sampleBytes * height;
+    if (ImageBuffer(buffer, bufferSize, size) == NULL) { return 0; }
+    out = *buffer;
+    memcpy(out, header, headerLength);
+    out += headerLength;
+
+    for (y = 0; y < height; y++)
+    {
+        const unsigned char *row = (const unsigned char *)src + (size_t)y * inputStride;
+        if (sampleBytes == 1)
+        {
+            memcpy(out, row, rowValues);
+            out += rowValues;
+        }
+        else
+        {
+            const uint16_t *values = (const uint16_t *)row;
+            size_t x;
+            for (x = 0; x < rowValues; x++)
+            {
+                *out++ = (unsigned char)(values[x] >> 8);
+                *out++ = (unsigned char)values[x];
+            }
+        }
+    }
+
+    return size;
+}
+
+// Assemble an image in the buffer, returns the size (0 on error)
+static size_t ImageEncode(unsigned char **buffer, size_t *bufferSize, int format, const void *src, int bitsPerPixel, int width, int inputStride, int height)
+{
+    if (src == NULL || width <= 0 || height <= 0) { return 0; }
+    if (format == IMAGE_FORMAT_BMP) { return ImageEncodeBmp(buffer, bufferSize, src, bitsPerPixel, width, inputStride, height); }
+    if (format == IMAGE_FORMAT_PGM) { return ImageEncodeNetpbm(buffer, bufferSize, src, 1, bitsPerPixel, width, inputStride, height); }
+    if (format == IMAGE_FORMAT_PPM && (bitsPerPixel == 24 || bitsPerPixel == 48)) { return ImageEncodeNetpbm(buffer, bufferSize, src, 3, bitsPerPixel / 3, width, inputStride, height); }
+    return 0;
+}
+
+// Write the whole buffer
+static int ImageWriteAll(int fd, const unsigned char *buffer, size_t size)
+{
+    while (size > 0)
+    {
+        int chunk = (size > 0x40000000) ? 0x40000000 : (int)size;
+        int written = (int)write(fd, buffer, chunk);
+        if (written <= 0) { return -1; }
+        buffer += written;
+        size -= written;
+    }
+    return 0;
+}
+
+
+int ImageWrite(const char *filename, int format, const void *buffer, int bitsPerPixel, int width, int inputStride, int height)
+{
+    unsigned char *out = NULL;
+    size_t outSize = 0, size;
+    int fd, ret;
+
+    if (filename == NULL || filename[0] == '\0') { return -1; }
+
+    size = ImageEncode(&out, &outSize, format, buffer, bitsPerPixel, width, inputStride, height);
+    if (size == 0) { free(out); return -1; }
+
+    fd = open(filename, IMAGE_OPEN_FLAGS);
+    if (fd < 0) { free(out); return -1; }
+    ret = ImageWriteAll(fd, out, size);
+    if (close(fd) != 0) { ret = -1; }
+    free(out);
+    return ret;
+}
+
+
+image_stream_t *ImageStreamOpen(const char *filename)
+{
+    image_stream_t *stream;
+
+    if (filename == NULL || filename[0] == '\0') { return NULL; }
+    stream = (image_stream_t *)malloc(sizeof(image_stream_t));
+    if (stream == NULL) { return NULL; }
+    memset(stream, 0, sizeof(image_stream_t));
+    stream->fd = open(filename, IMAGE_OPEN_FLAGS);
+    if (stream->fd < 0) { free(stream); return NULL; }
+    return stream;
+}
+
+
+int ImageStreamWrite(image_stream_t *stream, int format, const void *buffer, int bitsPerPixel, int width, int inputStride, int height)
+{
+    size_t size;
+
+    if (stream == NULL) { return -1; }
+    size = ImageEncode(&stream->buffer, &stream->bufferSize, format, buffer, bitsPerPixel, width, inputStride, height);
+    if (size == 0) { return -1; }
+    return ImageWriteAll(stream->fd, stream->buffer, size);
+}
+
+
+int ImageStreamClose(image_stream_t *stream)
+{
+    int ret = 0;
+
+    if (stream == NULL) { return -1; }
+    if (close(stream->fd) != 0) { ret = -1; }
+    free(stream->buffer);
+    free(stream);
+    return ret;
+}
@@ -0,0 +1,135 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// NPY File -- a numpy .npy array of 16-bit frames, written in one sequential pass
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "xed/npy.h"
+
+
+// The header is a fixed size, so it can be rewritten with the final number of frames (the data then starts 64-byte aligned)
+#define NPY_HEADER_SIZE 128
+#define NPY_BUFFER_SIZE (16 * 1024 * 1024)
+
+struct npy_writer
+{
+    FILE *fp;
+    int width;
+    int height;
+    int frames;                     // Frames returned (the last may still be being filled in)
+    size_t frameValues;
+    uint16_t *buffer;               // Whole frames, written together
+    int bufferFrames;
+    int buffered;                   // Frames in the buffer
+    int failed;
+};
+
+
+// Write the header: magic, version 1.0, header length, then the array description padded with spaces to a newline
+static int NpyWriteHeader(npy_writer_t *writer)
+{
+    char header[NPY_HEADER_SIZE + 1];
+    const uint16_t one = 1;
+    int length;
+
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (char)((NPY_HEADER_SIZE - 10) & 0xff);
+    header[9] = (char)((NPY_HEADER_SIZE - 10) >> 8);
+    length = sprintf(header + 10, "{'descr': '%cu2', 'fortran_order': False, 'shape': (%d, %d, %d), }", (*(const unsigned char *)&one == 1) ? '<' : '>', writer->frames, writer->height, writer->width);
+    memset(header + 10 + length, ' ', NPY_HEADER_SIZE - 10 - length);
+    header[NPY_HEADER_SIZE - 1] = '\n';
+
+    if (fseek(writer->fp, 0, SEEK_SET) != 0 || fwrite(header, 1, NPY_HEADER_SIZE, writer->fp) != NPY_HEADER_SIZE) { return -1; }
+    return 0;
+}
+
+// Write out the buffered frames
+static int NpyWriterFlush(npy_writer_t *writer)
+{
+    size_t values = writer->buffered * writer->frameValues;
+    if (values > 0 && fwrite(writer->buffer, sizeof(uint16_t), values, writer->fp) != values) { writer->failed = 1; }
+    writer->buffered = 0;
+    return writer->failed ? -1 : 0;
+}
+
+
+npy_writer_t *NpyWriterOpen(const char *filename, int width, int height)
+{
+    npy_writer_t *writer;
+
+    if (filename == NULL || filename[0] == '\0' || width <= 0 || height <= 0) { return NULL; }
+
+    writer = (npy_writer_t *)malloc(sizeof(npy_writer_t));
+    if (writer == NULL) { return NULL; }
+    memset(writer, 0, sizeof(npy_writer_t));
+    writer->width = width;
+    writer->height = height;
+    writer->frameValues = (size_t)width * height;
+    writer->bufferFrames = (int)(NPY_BUFFER_SIZE / (writer->frameValues * sizeof(uint16_t)));
+    if (writer->bufferFrames < 1) { writer->bufferFrames = 1; }
+    writer->buffer = (uint16_t *)malloc(writer->bufferFrames * writer->frameValues * sizeof(uint16_t));
+
+    writer->fp = fopen(filename, "wb");
+    if (writer->buffer == NULL || writer->fp == NULL || NpyWriteHeader(writer) != 0)    // (Rewritten on closing)
+    {
+        if (writer->fp != NULL) { fclose(writer->fp); remove(filename); }
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+
+uint16_t *NpyWriterNextFrame(npy_writer_t *writer)
+{
+    if (writer == NULL || writer->failed) { return NULL; }
+    if (writer->buffered >= writer->bufferFrames && NpyWriterFlush(writer) != 0) { return NULL; }
+    writer->frames++;
+    return writer->buffer + (writer->buffered++) * writer->frameValues;
+}
+
+
+int NpyWriterClose(npy_writer_t *writer)
+{
+    int ret;
+
+    if (writer == NULL) { return -1; }
+    NpyWriterFlush(writer);
+    if (!writer->failed && NpyWriteHeader(writer) != 0) { writer->failed = 1; }
+    if (fclose(writer->fp) != 0) { writer->failed = 1; }
+    ret = writer->failed ? -1 : writer->frames;
+    free(writer->buffer);
+    free(writer);
+    return ret;
+}
@@ -28,120 +28,625 @@
 
 #ifdef _WIN32
 #define _CRT_SECURE_NO_WARNINGS
+#else
+#define _GNU_SOURCE                 // O_DIRECT
 #endif
 #define _FILE_OFFSET_BITS 64
+#define _LARGEFILE64_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
 #ifdef _WIN32
-#define fopen64 fopen
-#define fseeko64 _fseeki64
-#define ftello64 _ftelli64
-typedef long long off64_t;
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 #endif
 
 #include "xed/xed.h"
+#include "xed_internal.h"
 
+// Host byte order (the file format is little-endian, apart from the frame information)
+#if defined(_WIN32) || defined(__i386__) || defined(__x86_64__) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define XED_LITTLE_ENDIAN 1
+#else
+#define XED_LITTLE_ENDIAN 0
+#endif
+
+
+// Utility methods (decode little/big-endian values from a byte buffer)
+static uint16_t get_uint16(const unsigned char *p) { return (uint16_t)p[0] | ((uint16_t)p[1] << 8); }
+static uint32_t get_uint32(const unsigned char *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint64_t get_uint64(const unsigned char *p) { return (uint64_t)get_uint32(p) | ((uint64_t)get_uint32(p + 4) << 32); }
+static uint16_t get_uint16_be(const unsigned char *p) { return ((uint16_t)p[0] << 8) | (uint16_t)p[1]; }
+static uint32_t get_uint32_be(const unsigned char *p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3]; }
+
+
+// Diagnostics
+static xed_log_callback_t logCallback = NULL;
+static void *logCallbackArg = NULL;
+static int logMaxLevel = XED_LOG_NOTE;
+
+// Default log callback: stderr
+static void XedLogStderr(void *arg, int level, const char *message)
+{
+    static const char *prefix[] = { "", "ERROR", "WARNING", "NOTE", "DEBUG" };
+    (void)arg;
+    fprintf(stderr, "%s: %s\n", prefix[(level >= XED_LOG_ERROR && level <= XED_LOG_DEBUG) ? level : 0], message);
+}
+
+void XedSetLogCallback(xed_log_callback_t callback, void *arg, int maxLevel)
+{
+    logCallback = callback;
+    logCallbackArg = arg;
+    logMaxLevel = maxLevel;
+}
+
+// Format a diagnostic message for the log callback
+static void XedLogFormat(int level, const char *format, va_list args)
+{
+    char message[512];
+    vsnprintf(message, sizeof(message), format, args);
+    message[sizeof(message) - 1] = '\0';
+    if (logCallback != NULL) { logCallback(logCallbackArg, level, message); }
+    else { XedLogStderr(NULL, level, message); }
+}
+
+// Log a diagnostic message (messages above the log level are not formatted)
+void XedLog(int level, const char *format, ...)
+{
+    va_list args;
+    if (level > logMaxLevel || level <= XED_LOG_NONE) { return; }
+    va_start(args, format);
+    XedLogFormat(level, format, args);
+    va_end(args);
+}
 
-// Utility methods
-static uint16_t fget_uint16(FILE *fp) { uint16_t v = 0; v |= ((uint16_t)fgetc(fp)); v |= (((uint16_t)fgetc(fp)) << 8); return v; }
-static uint32_t fget_uint32(FILE *fp) { uint32_t v = 0; v |= ((uint32_t)fgetc(fp)); v |= (((uint32_t)fgetc(fp)) << 8); v |= (((uint32_t)fgetc(fp)) << 16); v |= (((uint32_t)fgetc(fp)) << 24); return v; }
-static uint64_t fget_uint64(FILE *fp) { uint64_t v = 0; v |= ((uint64_t)fgetc(fp)); v |= (((uint64_t)fgetc(fp)) << 8); v |= (((uint64_t)fgetc(fp)) << 16); v |= (((uint64_t)fgetc(fp)) << 24); v |= (((uint64_t)fgetc(fp)) << 32); v |= (((uint64_t)fgetc(fp)) << 40); v |= (((uint64_t)fgetc(fp)) << 48); v |= (((uint64_t)fgetc(fp)) << 56); return v; }
-static uint16_t fget_uint16_be(FILE *fp) { uint16_t v = 0; v |= ((uint16_t)fgetc(fp) << 8); v |= (((uint16_t)fgetc(fp))); return v; }
-static uint32_t fget_uint32_be(FILE *fp) { uint32_t v = 0; v |= ((uint32_t)fgetc(fp) << 24); v |= (((uint32_t)fgetc(fp)) << 16); v |= (((uint32_t)fgetc(fp)) << 8); v |= (((uint32_t)fgetc(fp))); return v; }
+// Per-event tracing (through XED_TRACE, so only called in debug builds)
+void XedTrace(const char *format, ...)
+{
+    va_list args;
+    if (XED_LOG_DEBUG > logMaxLevel) { return; }
+    va_start(args, format);
+    XedLogFormat(XED_LOG_DEBUG, format, args);
+    va_end(args);
+}
 
 
-// Reader state structure
-typedef struct xed_reader
+// Monotonic time in nanoseconds (for the reader statistics)
+uint64_t XedStatsClock(void)
 {
-    FILE *fp;
-    xed_file_header_t header;
-    xed_end_stream_info_t streamInfo[XED_MAX_STREAMS];
-    xed_index_t *streamIndex[XED_MAX_STREAMS];
-    int totalEvents;
-    xed_index_t **globalIndex;
-} xed_reader_t;
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1.0e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Count bytes read (or copied from the mapping) at an offset, with the number of read calls made
+void XedStatsRead(xed_reader_t *reader, uint64_t offset, uint64_t length, int calls)
+{
+    if (offset != XedAtomicGet64(&reader->lastReadEnd)) { XedStatsAdd(reader, seeks, 1); }
+    XedAtomicSet64(&reader->lastReadEnd, offset + length);     // (Between threads, only approximate)
+    XedStatsAdd(reader, bytesRead, length);
+    if (calls > 0) { XedStatsAdd(reader, reads, calls); }
+}
+
+
 
 
-// Read an index entry (xed_index_entry_t)
-static int XedReadIndexEntry(xed_reader_t *reader, xed_index_entry_t *indexEntry)
+#define XED_DIRECT_ALIGN        4096                // Direct I/O offsets, lengths and buffers (at least the logical block size)
+#define XED_DIRECT_MIN_READ     (64 * 1024)         // Smallest direct read (for reads not following on from the window)
+#define XED_DIRECT_WINDOW       (4 * 1024 * 1024)   // Direct read size when reading on in file order
+
+// Buffers for direct I/O
+static void *XedAlignedAlloc(size_t size)
 {
-    // If reading to nowhere, skip entry
-    if (indexEntry == NULL)
+#ifdef _WIN32
+    return _aligned_malloc(size, XED_DIRECT_ALIGN);
+#else
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, XED_DIRECT_ALIGN, size) != 0) { return NULL; }
+    return buffer;
+#endif
+}
+
+static void XedAlignedFree(void *buffer)
+{
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+// Drop a range that has been read from the page cache (XED_DIRECT_DROP), including the partial pages at either end, which would otherwise stay resident
+static void XedDropCache(xed_reader_t *reader, uint64_t offset, uint64_t length)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    uint64_t start = offset & ~(uint64_t)(XED_DIRECT_ALIGN - 1);
+    uint64_t end = (offset + length + XED_DIRECT_ALIGN - 1) & ~(uint64_t)(XED_DIRECT_ALIGN - 1);
+    posix_fadvise(reader->fd, (off_t)start, (off_t)(end - start), POSIX_FADV_DONTNEED);
+#else
+    (void)reader; (void)offset; (void)length;
+#endif
+}
+
+// Positional read from the file: does not use or move a shared file position, so is safe to call concurrently (returns the number of bytes read, short at the end of the file, or -1 on error)
+static int64_t XedFileRead(xed_reader_t *reader, uint64_t offset, void *buffer, size_t length)
+{
+    size_t total = 0;
+    int calls = 0;
+    while (total < length)
     {
-        fseeko64(reader->fp, 24, SEEK_CUR); 
-        return XED_OK;
+        calls++;
+#ifdef _WIN32
+        OVERLAPPED overlapped = {0};
+        DWORD chunk = (length - total > 0x40000000) ? 0x40000000 : (DWORD)(length - total);
+        DWORD count = 0;
+        overlapped.Offset = (DWORD)(offset + total);
+        overlapped.OffsetHigh = (DWORD)((offset + total) >> 32);
+        if (!ReadFile(reader->file, (char *)buffer + total, chunk, &count, &overlapped))
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF) { break; }
+            XedStatsRead(reader, offset, total, calls);
+            return -1;
+        }
+#else
+        ssize_t count = pread(reader->fd, (char *)buffer + total, length - total, (off_t)(offset + total));
+        if (count < 0)
+        {
+            if (errno == EINTR) { continue; }
+            XedStatsRead(reader, offset, total, calls);
+            return -1;
+        }
+#endif
+        if (count == 0) { break; }
+        total += (size_t)count;
     }
+    XedStatsRead(reader, offset, total, calls);
+    return (int64_t)total;
+}
+
+// Direct I/O read: copied from the window, which is refilled by aligned reads -- a whole window when reading on in file order, otherwise just the blocks needed
+static int64_t XedDirectReadAt(xed_reader_t *reader, uint64_t offset, void *buffer, size_t length)
+{
+    uint64_t fileEnd = (reader->fileSize + XED_DIRECT_ALIGN - 1) & ~(uint64_t)(XED_DIRECT_ALIGN - 1);
+    size_t total = 0;
 
-    indexEntry->frameFileOffset = fget_uint64(reader->fp);  // @ 0 (e.g. 0x000000004c002bfc, can point to first frame)
-    indexEntry->frameTimestamp = fget_uint64(reader->fp);   // @ 8 (e.g. 0x000000038f84d534, or 0 if none)
-    indexEntry->dataSize= fget_uint32(reader->fp);          // @16 (e.g. 614400)
-    indexEntry->dataSize2 = fget_uint32(reader->fp);        // @20 (e.g. 614400)
+    XedMutexLock(&reader->directMutex);
+    while (total < length)
+    {
+        uint64_t position = offset + total;
+        uint64_t windowEnd = reader->directOffset + reader->directLength;
+        uint64_t start, end;
+        int64_t count;
+
+        // From the window
+        if (position >= reader->directOffset && position < windowEnd)
+        {
+            size_t chunk = (size_t)(windowEnd - position);
+            if (chunk > length - total) { chunk = length - total; }
+            memcpy((char *)buffer + total, reader->directBuffer + (size_t)(position - reader->directOffset), chunk);
+            total += chunk;
+            continue;
+        }
+
+        // Refill the window
+        if (position >= reader->fileSize && reader->fileSize > 0) { break; }
+        start = position & ~(uint64_t)(XED_DIRECT_ALIGN - 1);
+        end = (offset + length + XED_DIRECT_ALIGN - 1) & ~(uint64_t)(XED_DIRECT_ALIGN - 1);
+        if (end - start < XED_DIRECT_MIN_READ) { end = start + XED_DIRECT_MIN_READ; }
+        if (reader->directLength > 0 && position >= windowEnd && position - windowEnd < XED_DIRECT_MIN_READ && end - start < XED_DIRECT_WINDOW) { end = start + XED_DIRECT_WINDOW; }
+        if (end > fileEnd && fileEnd > start) { end = fileEnd; }
+        if (end - start > reader->directBufferSize)
+        {
+            XedAlignedFree(reader->directBuffer);
+            reader->directLength = 0;
+            reader->directBufferSize = 0;
+            reader->directBuffer = (unsigned char *)XedAlignedAlloc((size_t)(end - start));
+            if (reader->directBuffer == NULL) { XedMutexUnlock(&reader->directMutex); return -1; }
+            reader->directBufferSize = (size_t)(end - start);
+        }
+        count = XedFileRead(reader, start, reader->directBuffer, (size_t)(end - start));
+        reader->directOffset = start;
+        reader->directLength = (count > 0) ? (size_t)count : 0;
+        if (count < 0) { XedMutexUnlock(&reader->directMutex); return -1; }
+        if ((uint64_t)count <= position - start) { break; }      // (End of file)
+    }
+    XedMutexUnlock(&reader->directMutex);
+    return (int64_t)total;
+}
+
+// Read from the file (as XedFileRead), without filling the page cache with XED_READER_DIRECT
+static int64_t XedFileReadAt(xed_reader_t *reader, uint64_t offset, void *buffer, size_t length)
+{
+    int64_t count;
+    if (reader->direct == XED_DIRECT_IO) { return XedDirectReadAt(reader, offset, buffer, length); }
+    count = XedFileRead(reader, offset, buffer, length);
+    if (reader->direct == XED_DIRECT_DROP && count > 0) { XedDropCache(reader, offset, (uint64_t)count); }
+    return count;
+}
+
+#ifndef _WIN32
+// Vectored positional read of the whole of the buffers (safe to call concurrently), returns the number of bytes read (short at the end of the file), or -1 on error
+int64_t XedReadVectorAt(xed_reader_t *reader, uint64_t offset, struct iovec *iov, int iovcnt)
+{
+    int64_t total = 0;
+    int calls = 0;
+
+    // Direct I/O: a buffer at a time, through the window
+    if (reader->direct == XED_DIRECT_IO)
+    {
+        for (; iovcnt > 0; iov++, iovcnt--)
+        {
+            int64_t count = XedDirectReadAt(reader, offset + total, iov->iov_base, iov->iov_len);
+            if (count < 0) { return -1; }
+            total += count;
+            if ((size_t)count < iov->iov_len) { break; }
+        }
+        return total;
+    }
+
+    while (iovcnt > 0)
+    {
+        ssize_t count = preadv(reader->fd, iov, iovcnt, (off_t)(offset + total));
+        calls++;
+        if (count < 0)
+        {
+            if (errno == EINTR) { continue; }
+            XedStatsRead(reader, offset, (uint64_t)total, calls);
+            return -1;
+        }
+        if (count == 0) { break; }
+        total += count;
+
+        // Continue after a partial read
+        while (iovcnt > 0 && (size_t)count >= iov->iov_len) { count -= iov->iov_len; iov++; iovcnt--; }
+        if (iovcnt > 0) { iov->iov_base = (char *)iov->iov_base + count; iov->iov_len -= count; }
+    }
+    XedStatsRead(reader, offset, (uint64_t)total, calls);
+    if (reader->direct == XED_DIRECT_DROP && total > 0) { XedDropCache(reader, offset, (uint64_t)total); }
+    return total;
+}
+#endif
+
+// Copy bytes from the file at the given offset (safe to call concurrently)
+int XedReadAt(xed_reader_t *reader, uint64_t offset, void *buffer, size_t length)
+{
+    if (reader->map != NULL)
+    {
+        if (offset > reader->mapSize || length > reader->mapSize - offset) { return XED_E_INVALID_DATA; }
+        memcpy(buffer, reader->map + offset, length);
+        XedStatsRead(reader, offset, length, 0);
+        return XED_OK;
+    }
+    if (XedFileReadAt(reader, offset, buffer, length) != (int64_t)length) { return XED_E_INVALID_DATA; }
     return XED_OK;
 }
 
-// Read a frame information entry (xed_frame_info_t)
-static int XedReadFrameInfo(xed_reader_t *reader, xed_frame_info_t *indexEntry, size_t frameInfoSize)
+// Get a pointer to bytes in the file: directly into the mapping, or read into the scratch buffer (valid until the next fetch, so only used while opening)
+static const unsigned char *XedFetch(xed_reader_t *reader, uint64_t offset, size_t length)
+{
+    if (reader->map != NULL)
+    {
+        if (offset > reader->mapSize || length > reader->mapSize - offset) { return NULL; }
+        return reader->map + offset;
+    }
+    if (length > reader->scratchSize)
+    {
+        unsigned char *scratch = (unsigned char *)realloc(reader->scratch, length);
+        if (scratch == NULL) { return NULL; }
+        reader->scratch = scratch;
+        reader->scratchSize = length;
+    }
+    if (XedReadAt(reader, offset, reader->scratch, length) != XED_OK) { return NULL; }
+    return reader->scratch;
+}
+
+
+// Decode an index entry (xed_index_entry_t, 24 bytes)
+static void XedDecodeIndexEntry(const unsigned char *p, xed_index_entry_t *indexEntry)
+{
+    indexEntry->frameFileOffset = get_uint64(p + 0);    // @ 0 (e.g. 0x000000004c002bfc, can point to first frame)
+    indexEntry->frameTimestamp = get_uint64(p + 8);     // @ 8 (e.g. 0x000000038f84d534, or 0 if none)
+    indexEntry->dataSize = get_uint32(p + 16);          // @16 (e.g. 614400)
+    indexEntry->dataSize2 = get_uint32(p + 20);         // @20 (e.g. 614400)
+}
+
+// Unpack a block of on-disk index entries (count * 24 bytes) and their frame information (count * frameInfoSize bytes, raw copy, any excess ignored)
+static void XedUnpackIndexBlock(xed_index_t *dst, uint16_t streamId, const unsigned char *entries, const unsigned char *frameInfo, unsigned int count, size_t frameInfoSize)
+{
+    size_t frameInfoLen = sizeof(xed_frame_info_t);
+    unsigned int k;
+
+    if (frameInfoSize < frameInfoLen) { frameInfoLen = frameInfoSize; }
+
+#if XED_LITTLE_ENDIAN
+    if (sizeof(xed_index_entry_t) == 24)
+    {
+        // On-disk entries already have the in-memory layout: fixed-size copies that the compiler vectorizes
+        for (k = 0; k < count; k++)
+        {
+            dst[k].streamId = streamId;
+            memcpy(&dst[k].indexEntry, entries + (size_t)k * 24, 24);
+        }
+    }
+    else
+#endif
+    {
+        for (k = 0; k < count; k++)
+        {
+            dst[k].streamId = streamId;
+            XedDecodeIndexEntry(entries + (size_t)k * 24, &dst[k].indexEntry);
+        }
+    }
+
+    for (k = 0; k < count && frameInfoLen > 0; k++)
+    {
+        memset(&dst[k].frameInfo, 0, sizeof(xed_frame_info_t));
+        memcpy(&dst[k].frameInfo, frameInfo + (size_t)k * frameInfoSize, frameInfoLen);
+    }
+}
+
+// Decode an event header (xed_event_t, 24 bytes)
+void XedDecodeEvent(const unsigned char *p, xed_event_t *event)
+{
+    event->streamId = get_uint16(p + 0);
+    event->_flags = get_uint16(p + 2);
+    event->length = get_uint32(p + 4);
+    event->timestamp = get_uint64(p + 8);
+    event->_unknown1 = get_uint32(p + 16);
+    event->length2 = get_uint32(p + 20);
+}
+
+// Check that a header at the offset is consistent: an event (stream number in range, matching lengths, fits in the file), an index block (its first entry is before it), or the end of file information
+// (for finding where an index block ends: length is the bytes available at p, 32 or more to check an index block's first entry; fileSize 0 if not known)
+int XedCheckHeader(const unsigned char *p, size_t length, uint64_t offset, uint32_t numStreams, uint64_t fileSize)
+{
+    static const unsigned char zero[24] = {0};
+    xed_event_t event;
+
+    if (length < 24) { return 0; }
+    if (memcmp(p, zero, sizeof(zero)) == 0) { return 0; }   // What zero pixels, or the zeroed frame information of a stream's first entries, look like
+    XedDecodeEvent(p, &event);
+
+    if (event.streamId == 0xffff) { return event.length > 0 && (length < 32 || get_uint64(p + 24) < offset); }
+    if (event.streamId == numStreams) { return get_uint16(p + 2) == 0xffff && get_uint16(p + 4) == 0xffff; }   // Stream count, then the first stream's information
+    if (event.streamId > numStreams) { return 0; }
+    if (event.length != event.length2) { return 0; }
+    if (fileSize > 0 && offset + 24 + (event.timestamp != 0 ? 24 : 0) + (uint64_t)event.length > fileSize) { return 0; }
+    return 1;
+}
+
+// Decode the frame information preceding an event's payload (xed_frame_info_t, 24 bytes, big-endian)
+void XedDecodeEventFrameInfo(const unsigned char *p, xed_frame_info_t *frameInfo)
+{
+    frameInfo->_unknown1 = get_uint16_be(p + 0);
+    frameInfo->_unknown2 = get_uint16_be(p + 2);
+    frameInfo->_unknown3 = get_uint16_be(p + 4);
+    frameInfo->_unknown4 = get_uint16_be(p + 6);
+    frameInfo->width = get_uint16_be(p + 8);
+    frameInfo->height = get_uint16_be(p + 10);
+    frameInfo->sequenceNumber = get_uint32_be(p + 12);
+    frameInfo->_unknown5 = get_uint32_be(p + 16);
+    frameInfo->timestamp = get_uint32_be(p + 20);
+}
+
+// Is stream a's next entry before stream b's? (in file order, ties to the lower stream)
+#define XED_MERGE_BEFORE(key, a, b) ((key)[a] < (key)[b] || ((key)[a] == (key)[b] && (a) < (b)))
+
+// Restore the min-heap of streams (keyed by the offset of each stream's next entry) from the given position downwards
+static void XedMergeSiftDown(const uint64_t *key, int *heap, int count, int i)
 {
-    size_t len;
+    int item = heap[i];
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count) { break; }
+        if (child + 1 < count && XED_MERGE_BEFORE(key, heap[child + 1], heap[child])) { child++; }
+        if (!XED_MERGE_BEFORE(key, heap[child], item)) { break; }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = item;
+}
+
+// Merge the stream indexes in file offset order (k-way merge with a min-heap of the stream heads), copying the entries into one array
+static int XedMergeIndexes(xed_reader_t *reader)
+{
+    int next[XED_MAX_STREAMS] = {0};
+    uint64_t key[XED_MAX_STREAMS];
+    int heap[XED_MAX_STREAMS];
+    int count = 0;
+    int maxEvents = 0;
+    int numStreams = reader->header.numStreams;
+    int i;
+
+    if (numStreams > XED_MAX_STREAMS) { numStreams = XED_MAX_STREAMS; }
+
+    // Count the total number of index entries (of the selected streams)
+    for (i = 0; i < numStreams; i++)
+    {
+        if (!(reader->streamMask & (1u << i))) { continue; }
+        maxEvents += reader->streamInfo[i].totalIndexEntries;
+    }
 
-    // Clear current value
-    if (indexEntry != NULL)
+    // Allocate global index
+    reader->globalIndex = (xed_index_t *)malloc(sizeof(xed_index_t) * (maxEvents > 0 ? maxEvents : 1));
+    if (reader->globalIndex == NULL)
     {
-        memset(indexEntry, 0, sizeof(xed_frame_info_t));
+        XedLog(XED_LOG_ERROR, "Problem allocating global index entries (%d)", maxEvents);
+        return XED_E_OUT_OF_MEMORY;
     }
 
-    // Work out how much to read
-    len = 0;
-    if (indexEntry != NULL)
+    // Heap of the streams that still have entries
+    for (i = 0; i < numStreams; i++)
     {
-        len = sizeof(xed_frame_info_t);
-        if (frameInfoSize < len) { len = frameInfoSize; }
-        if (len > 0)
-        { 
-            fread(indexEntry, 1, len, reader->fp); 
+        if ((reader->streamMask & (1u << i)) && reader->streamInfo[i].totalIndexEntries > 0)
+        {
+            key[i] = reader->streamIndex[i][0].indexEntry.frameFileOffset;
+            heap[count++] = i;
         }
     }
+    for (i = count / 2 - 1; i >= 0; i--)
+    {
+        XedMergeSiftDown(key, heap, count, i);
+    }
 
-    // Skip any unread data
-    if (frameInfoSize > len) 
-    { 
-        fseeko64(reader->fp, frameInfoSize - len, SEEK_CUR); 
+    // Take the earliest head each time
+    reader->totalEvents = 0;
+    while (count > 0)
+    {
+        int streamId = heap[0];
+        reader->globalIndex[reader->totalEvents++] = reader->streamIndex[streamId][next[streamId]];
+        next[streamId]++;
+        if (next[streamId] < (int)reader->streamInfo[streamId].totalIndexEntries) { key[streamId] = reader->streamIndex[streamId][next[streamId]].indexEntry.frameFileOffset; }
+        else { heap[0] = heap[--count]; }
+        XedMergeSiftDown(key, heap, count, 0);
     }
 
     return XED_OK;
 }
 
-// Read the file header, end information and indexes
-static int XedReadFileMetadata(xed_reader_t *reader)
+
+// Read the file header
+static int XedReadFileHeader(xed_reader_t *reader)
 {
-    int i, numEndStreamInfo;
+    const unsigned char *p;
 
     if (reader == NULL) { return XED_E_POINTER; }
-    if (reader->fp == NULL) { return XED_E_NOT_VALID_STATE; }
+    if (reader->fileSize == 0) { return XED_E_NOT_VALID_STATE; }
     
     memset(&reader->header, 0, sizeof(xed_file_header_t));
 
     // Read header
-    if (fseeko64(reader->fp, 0, SEEK_SET) != 0) { return XED_E_ACCESS_DENIED; }
-    if (fread(reader->header.fileType, 1, sizeof(reader->header.fileType), reader->fp) != sizeof(reader->header.fileType)) { return XED_E_ACCESS_DENIED; }
-    reader->header._version = fget_uint32(reader->fp);
-    reader->header.numStreams = fget_uint32(reader->fp);
-    reader->header.indexFileOffset = fget_uint64(reader->fp);
+    p = XedFetch(reader, 0, 24);
+    if (p == NULL) { return XED_E_ACCESS_DENIED; }
+    memcpy(reader->header.fileType, p, sizeof(reader->header.fileType));
+    reader->header._version = get_uint32(p + 8);
+    reader->header.numStreams = get_uint32(p + 12);
+    reader->header.indexFileOffset = get_uint64(p + 16);
 
     // Check header
     if (reader->header.fileType[0] != 'E' || reader->header.fileType[1] != 'V' || reader->header.fileType[2] != 'E' || reader->header.fileType[3] != 'N' || reader->header.fileType[4] != 'T' || reader->header.fileType[5] != 'S' || reader->header.fileType[6] != '1' || reader->header.fileType[7] != '\0')
     {
-        fprintf(stderr, "ERROR: File header not the expected \"EVENTS1\", was: \"%08s\".\n", reader->header.fileType);
+        XedLog(XED_LOG_ERROR, "File header not the expected \"EVENTS1\", was: \"%.8s\".", reader->header.fileType);
         return XED_E_INVALID_DATA;
     }
 
+    return XED_OK;
+}
+
+// Read a stream's index blocks (at the locations from the end information) into the stream index
+static int XedLoadStreamIndex(xed_reader_t *reader, int stream)
+{
+    const xed_end_stream_info_t *endStreamInfo = &reader->streamInfo[stream];
+    const uint64_t *indexOffsets = reader->indexOffsets[stream];
+    xed_index_t *streamIndex;
+    const unsigned char *p;
+    unsigned int j;
+
+    if (reader->streamIndex[stream] != NULL)
+    {
+        XedLog(XED_LOG_ERROR, "Stream already indexed %d", stream);
+        return XED_E_INVALID_DATA;
+    }
+
+    // Allocate space for index buffers
+    streamIndex = (xed_index_t *)malloc(sizeof(xed_index_t) * (endStreamInfo->totalIndexEntries > 0 ? endStreamInfo->totalIndexEntries : 1));
+    if (streamIndex == NULL)
+    {
+        XedLog(XED_LOG_ERROR, "Problem allocating index entries for stream %d: %d", stream, endStreamInfo->totalIndexEntries);
+        return XED_E_OUT_OF_MEMORY;
+    }
+    reader->streamIndex[stream] = streamIndex;
+
+    // Clear entries
+    memset(streamIndex, 0, sizeof(xed_index_t) * endStreamInfo->totalIndexEntries);
+
+    for (j = 0; j < endStreamInfo->numIndexes; j++)
+    {
+        unsigned int indexBase, expectedEntries;
+        xed_stream_index_t index;
+        size_t blockSize, entriesSize;
+
+        // Read the whole index block in one go: all but the last index are expected to be full
+        indexBase = j * endStreamInfo->maxIndexEntries;
+        expectedEntries = 0;
+        if (indexBase < endStreamInfo->totalIndexEntries) { expectedEntries = endStreamInfo->totalIndexEntries - indexBase; }
+        if (expectedEntries > endStreamInfo->maxIndexEntries) { expectedEntries = endStreamInfo->maxIndexEntries; }
+        blockSize = 24 + (size_t)expectedEntries * (24 + endStreamInfo->extraPerIndexEntry);
+        p = XedFetch(reader, indexOffsets[j], blockSize);
+        if (p == NULL) { blockSize = 24; p = XedFetch(reader, indexOffsets[j], blockSize); }
+        if (p == NULL) { XedLog(XED_LOG_ERROR, "Index #%d for stream #%d is outside the file", j, stream); return XED_E_INVALID_DATA; }
+
+        index.packetType = get_uint16(p + 0);       // @0 = 0xffff
+        if (index.packetType != 0xffff) { XedLog(XED_LOG_ERROR, "Index #%d for stream #%d does not start with expected 0xffff", j, stream); return XED_E_INVALID_DATA; }
+        index._unknown1 = get_uint16(p + 2);        // @2 = 0
+        index.numEntries = get_uint32(p + 4);       // @4 (e.g. = 1024 | 1024 | ... | 30 / 2 / 2 / 2 / 2)
+        index._unknown2 = get_uint32(p + 8);        // @8 (e.g. = 0xf934b72c | 0xe418b73d | ... | 0x1ea8f030 / 0x6f970162 / 0xa75d020c / 0x37c900b8 / 0x6f8f0162)
+        index._unknown3 = get_uint32(p + 12);       // @12 = 0
+        index._unknown4 = get_uint32(p + 16);       // @16 = 0
+        index._unknown5 = get_uint32(p + 20);       // @20 = 0
+
+        // Read index entries
+        if (index.numEntries > endStreamInfo->totalIndexEntries || indexBase > endStreamInfo->totalIndexEntries - index.numEntries)
+        {
+            XedLog(XED_LOG_ERROR, "Index #%d for stream #%d exceeds total index entries (%d).", j, stream, endStreamInfo->totalIndexEntries); 
+            return XED_E_INVALID_DATA;
+        }
+
+        // Re-read if the block was not the expected size
+        if (blockSize != 24 + (size_t)index.numEntries * (24 + endStreamInfo->extraPerIndexEntry))
+        {
+            blockSize = 24 + (size_t)index.numEntries * (24 + endStreamInfo->extraPerIndexEntry);
+            p = XedFetch(reader, indexOffsets[j], blockSize);
+            if (p == NULL) { XedLog(XED_LOG_ERROR, "Index #%d for stream #%d is truncated", j, stream); return XED_E_INVALID_DATA; }
+        }
+
+        // xed_index_entry_t indexEntries[numEntries];
+        // xed_frame_info_t frameInfo[numEntries];  // <does this depend on _additionalLength or extraPerIndexEntry?>; {0} if none (e.g. first two frames)
+        entriesSize = (size_t)index.numEntries * 24;
+        XedUnpackIndexBlock(&streamIndex[indexBase], (uint16_t)stream, p + 24, p + 24 + entriesSize, index.numEntries, endStreamInfo->extraPerIndexEntry);
+    }
+
+    return XED_OK;
+}
+
+// Read the file header and end information (and, if not loading them on first use, the indexes)
+static int XedReadFileMetadata(xed_reader_t *reader, int lazy)
+{
+    int i, numEndStreamInfo;
+    const unsigned char *p;
+    uint64_t offset;
+    int ret;
+
+    // Read header
+    ret = XedReadFileHeader(reader);
+    if (ret != XED_OK) { return ret; }
+
     // Read end of file information
     if (reader->header.indexFileOffset == 0) { return XED_E_INVALID_DATA; }
-    if (fseeko64(reader->fp, reader->header.indexFileOffset, SEEK_SET) != 0) { return XED_E_ACCESS_DENIED; }
-    numEndStreamInfo = fget_uint16(reader->fp);
-    if (numEndStreamInfo != reader->header.numStreams) { fprintf(stderr, "WARNING: Number of end stream information blocks (%d) not the same as the number of blocks (%d)\n", numEndStreamInfo, reader->header.numStreams);  }
+    offset = reader->header.indexFileOffset;
+    p = XedFetch(reader, offset, 2);
+    if (p == NULL) { return XED_E_ACCESS_DENIED; }
+    numEndStreamInfo = get_uint16(p);
+    offset += 2;
+    if (numEndStreamInfo != reader->header.numStreams) { XedLog(XED_LOG_WARNING, "Number of end stream information blocks (%d) not the same as the number of blocks (%d)", numEndStreamInfo, reader->header.numStreams);  }
 
     // Read xed_end_stream_info_t
     for (i = 0; i < numEndStreamInfo; i++)
@@ -149,115 +654,62 @@ static int XedReadFileMetadata(xed_reader_t *reader)
         // Parse xed_end_stream_info_t
         xed_end_stream_info_t endStreamInfo = {0};
 
-        endStreamInfo._unknown1 = fget_uint16(reader->fp);          // @  0 = 0xffff
-        endStreamInfo._unknown2 = fget_uint16(reader->fp);          // @  2 = 0xffff
+        p = XedFetch(reader, offset, 120);
+        if (p == NULL) { XedLog(XED_LOG_ERROR, "End stream info #%d is truncated", i); return XED_E_INVALID_DATA; }
 
-        if (endStreamInfo._unknown1 != 0xffff || endStreamInfo._unknown2 != 0xffff) { fprintf(stderr, "ERROR: End stream info #%d does not start with expected 0xffff 0xffff\n", i); return XED_E_INVALID_DATA; }
+        endStreamInfo._unknown1 = get_uint16(p + 0);            // @  0 = 0xffff
+        endStreamInfo._unknown2 = get_uint16(p + 2);            // @  2 = 0xffff
 
-        endStreamInfo.streamNumber = fget_uint16(reader->fp);       // @  4 = 0/1/2/3/4
-        if (endStreamInfo.streamNumber != i) { fprintf(stderr, "WARNING: End stream info #%d is not for the expected stream. (=%d)\n", i, endStreamInfo.streamNumber);  }
+        if (endStreamInfo._unknown1 != 0xffff || endStreamInfo._unknown2 != 0xffff) { XedLog(XED_LOG_ERROR, "End stream info #%d does not start with expected 0xffff 0xffff", i); return XED_E_INVALID_DATA; }
 
-        endStreamInfo.extraPerIndexEntry = fget_uint16(reader->fp); // @  6 Length of xed_frame_info_t in index = 24 [have seen trimmed file with length 0, with no xed_frame_info_t entries in the index]
-        endStreamInfo.totalIndexEntries = fget_uint32(reader->fp);  // @  8 Total number of frames (index entries) in the file = 2078 / 2
-        endStreamInfo.frameSize = fget_uint32(reader->fp);          // @ 12 Size of frame (e.g. = 614400 / 0 / 0 / 0 / 0)
-        endStreamInfo.maxIndexEntries = fget_uint32(reader->fp);    // @ 16 max entries per index = 1024
-        endStreamInfo.numIndexes = fget_uint32(reader->fp);         // @ 20 number of indexes = 3 / 1 / 1 / 1 / 1
+        endStreamInfo.streamNumber = get_uint16(p + 4);         // @  4 = 0/1/2/3/4
+        if (endStreamInfo.streamNumber != i) { XedLog(XED_LOG_WARNING, "End stream info #%d is not for the expected stream. (=%d)", i, endStreamInfo.streamNumber);  }
 
-        XedReadIndexEntry(reader, &endStreamInfo.event0);           // @ 24 Index entry for event 0 (xed_initial_data_t) information
-        XedReadIndexEntry(reader, &endStreamInfo.event1);           // @ 48 Index entry for event 1 (xed_event_empty_t) information
+        endStreamInfo.extraPerIndexEntry = get_uint16(p + 6);   // @  6 Length of xed_frame_info_t in index = 24 [have seen trimmed file with length 0, with no xed_frame_info_t entries in the index]
+        endStreamInfo.totalIndexEntries = get_uint32(p + 8);    // @  8 Total number of frames (index entries) in the file = 2078 / 2
+        endStreamInfo.frameSize = get_uint32(p + 12);           // @ 12 Size of frame (e.g. = 614400 / 0 / 0 / 0 / 0)
+        endStreamInfo.maxIndexEntries = get_uint32(p + 16);     // @ 16 max entries per index = 1024
+        endStreamInfo.numIndexes = get_uint32(p + 20);          // @ 20 number of indexes = 3 / 1 / 1 / 1 / 1
 
-        fread(endStreamInfo._unknownEvent0, 1, sizeof(endStreamInfo._unknownEvent0), reader->fp);   // @72
-        fread(endStreamInfo._unknownEvent1, 1, sizeof(endStreamInfo._unknownEvent1), reader->fp);   // @96
+        XedDecodeIndexEntry(p + 24, &endStreamInfo.event0);     // @ 24 Index entry for event 0 (xed_initial_data_t) information
+        XedDecodeIndexEntry(p + 48, &endStreamInfo.event1);     // @ 48 Index entry for event 1 (xed_event_empty_t) information
 
-        XedReadFrameInfo(reader, NULL, endStreamInfo.extraPerIndexEntry);   // @120 <only if extraPerIndexEntry=24, missing if =0 >
-        XedReadFrameInfo(reader, NULL, endStreamInfo.extraPerIndexEntry);   // @148 <only if extraPerIndexEntry=24, missing if =0 >
+        memcpy(endStreamInfo._unknownEvent0, p + 72, sizeof(endStreamInfo._unknownEvent0));    // @72
+        memcpy(endStreamInfo._unknownEvent1, p + 96, sizeof(endStreamInfo._unknownEvent1));    // @96
 
-        // Only load the index entries for streams we will store
+        // @120 <only if extraPerIndexEntry=24, missing if =0 >
+        // @148 <only if extraPerIndexEntry=24, missing if =0 >
+        offset += 120 + 2 * (uint64_t)endStreamInfo.extraPerIndexEntry;
+
+        // @~168 <@120 in trimmed> (numIndexes *) File offset of xed_stream_index_t structures (e.g. = 0x4c098c2c / 0x4c0991e4 / 0x4c0925c / 0x4c0992d4 / 0x4c09934c)
+        // @~192/176 ? timestamp/flags ? (e.g. = 0x8ad51914 / 0x965f0748 / 0xefc8076c / 0x3a400691 / 0x93a906b5)
+        p = XedFetch(reader, offset, sizeof(uint64_t) * (size_t)endStreamInfo.numIndexes + 4);
+        if (p == NULL) { XedLog(XED_LOG_ERROR, "Index locations for stream #%d are truncated", i); return XED_E_INVALID_DATA; }
+        endStreamInfo._unknown11 = get_uint32(p + sizeof(uint64_t) * endStreamInfo.numIndexes);
+
+        // Only keep the index locations for streams we will store
         if (endStreamInfo.streamNumber < XED_MAX_STREAMS && endStreamInfo.streamNumber < reader->header.numStreams)
         {
-            unsigned long 
-            int j;
-            off64_t offset;
+            unsigned int j;
+            uint64_t *indexOffsets;
 
-            if (reader->streamIndex[endStreamInfo.streamNumber] != NULL)
+            if (reader->indexOffsets[endStreamInfo.streamNumber] != NULL)
             {
-                fprintf(stderr, "ERROR: Stream already indexed %d\n", endStreamInfo.streamNumber, endStreamInfo.totalIndexEntries);
+                XedLog(XED_LOG_ERROR, "Stream already indexed %d", endStreamInfo.streamNumber);
                 return XED_E_INVALID_DATA;
             }
 
-            // Allocate space for index buffers
-            reader->streamIndex[endStreamInfo.streamNumber] = (xed_index_t *)malloc(sizeof(xed_index_t) * endStreamInfo.totalIndexEntries);
-            if (reader->streamIndex[endStreamInfo.streamNumber] == NULL)
-            {
-                fprintf(stderr, "ERROR: Problem allocating index entries for stream %d: %d\n", endStreamInfo.streamNumber, endStreamInfo.totalIndexEntries);
-                return XED_E_OUT_OF_MEMORY;
-            }
-
-            // Clear entries
-            memset(reader->streamIndex[endStreamInfo.streamNumber], 0, sizeof(xed_index_t) * endStreamInfo.totalIndexEntries);
-
-            // @~168 <@120 in trimmed> (numIndexes *) File offset of xed_stream_index_t structures (e.g. = 0x4c098c2c / 0x4c0991e4 / 0x4c0925c / 0x4c0992d4 / 0x4c09934c)
-            offset = ftello64(reader->fp);
+            // Take a copy of the index locations (the fetched data is overwritten by later fetches)
+            indexOffsets = (uint64_t *)malloc(sizeof(uint64_t) * (endStreamInfo.numIndexes + 1));
+            if (indexOffsets == NULL) { return XED_E_OUT_OF_MEMORY; }
             for (j = 0; j < endStreamInfo.numIndexes; j++)
             {
-                uint64_t indexOffset;
-                int indexBase;
-                xed_stream_index_t index;
-                unsigned int k;
-
-                // Get address of index
-                fseeko64(reader->fp, offset + j * sizeof(uint64_t), SEEK_SET);
-                indexOffset = fget_uint64(reader->fp);
-                fseeko64(reader->fp, indexOffset, SEEK_SET);
-
-                index.packetType = fget_uint16(reader->fp);     // @0 = 0xffff
-                if (index.packetType != 0xffff) { fprintf(stderr, "ERROR: Index #%d for stream #%d does not start with expected 0xffff\n", j, i); return XED_E_INVALID_DATA; }
-                index._unknown1 = fget_uint16(reader->fp);      // @2 = 0
-                index.numEntries = fget_uint32(reader->fp);     // @4 (e.g. = 1024 | 1024 | ... | 30 / 2 / 2 / 2 / 2)
-                index._unknown2 = fget_uint32(reader->fp);      // @8 (e.g. = 0xf934b72c | 0xe418b73d | ... | 0x1ea8f030 / 0x6f970162 / 0xa75d020c / 0x37c900b8 / 0x6f8f0162)
-                index._unknown3 = fget_uint32(reader->fp);      // @12 = 0
-                index._unknown4 = fget_uint32(reader->fp);      // @16 = 0
-                index._unknown5 = fget_uint32(reader->fp);      // @20 = 0
-
-                // Read index entries
-                indexBase = j * endStreamInfo.maxIndexEntries;
-                if (indexBase + index.numEntries > endStreamInfo.totalIndexEntries)
-                {
-                    fprintf(stderr, "ERROR: Index #%d for stream #%d exceeds total index entries (%d).\n", j, i, endStreamInfo.totalIndexEntries); 
-                    return XED_E_INVALID_DATA;
-                }
-
-                // xed_index_entry_t indexEntries[numEntries];
-                for (k = 0; k < index.numEntries; k++)
-                {
-                    // Set stream id
-                    reader->streamIndex[endStreamInfo.streamNumber][indexBase + k].streamId = endStreamInfo.streamNumber;
-                    // Read index entry
-                    XedReadIndexEntry(reader, &reader->streamIndex[endStreamInfo.streamNumber][indexBase + k].indexEntry);
-                }
-
-                // xed_frame_info_t frameInfo[numEntries];  // <does this depend on _additionalLength or extraPerIndexEntry?>; {0} if none (e.g. first two frames)
-                if (endStreamInfo.extraPerIndexEntry > 0)
-                {
-                    // Read additional frame information
-                    for (k = 0; k < index.numEntries; k++)
-                    {
-                        XedReadFrameInfo(reader, &reader->streamIndex[endStreamInfo.streamNumber][indexBase + k].frameInfo, endStreamInfo.extraPerIndexEntry);
-                    }
-                }
-                
+                indexOffsets[j] = get_uint64(p + j * sizeof(uint64_t));
             }
-
-            // Seek to after last index
-            fseeko64(reader->fp, offset + endStreamInfo.numIndexes * sizeof(uint64_t), SEEK_SET);
-
-        }
-        else
-        {
-            fseeko64(reader->fp, sizeof(uint64_t) * endStreamInfo.numIndexes, SEEK_CUR);   // @~168 <@120 in trimmed> (numIndexes *) File offset of xed_stream_index_t structures (e.g. = 0x4c098c2c / 0x4c0991e4 / 0x4c0925c / 0x4c0992d4 / 0x4c09934c)
+            reader->indexOffsets[endStreamInfo.streamNumber] = indexOffsets;
         }
 
-        endStreamInfo._unknown11 = fget_uint32(reader->fp);     // @~192/176 ? timestamp/flags ? (e.g. = 0x8ad51914 / 0x965f0748 / 0xefc8076c / 0x3a400691 / 0x93a906b5)
+        offset += sizeof(uint64_t) * (uint64_t)endStreamInfo.numIndexes + 4;
 
         // Copy end stream info structure
         if (endStreamInfo.streamNumber < XED_MAX_STREAMS && endStreamInfo.streamNumber < reader->header.numStreams)
@@ -266,138 +718,525 @@ static int XedReadFileMetadata(xed_reader_t *reader)
         }
         else
         {
-            fprintf(stderr, "WARNING: Ignoring end stream information for stream number %d as file maximum was %d and compiled-in maximum was %d\n", endStreamInfo.streamNumber, reader->header.numStreams, XED_MAX_STREAMS);
+            XedLog(XED_LOG_WARNING, "Ignoring end stream information for stream number %d as file maximum was %d and compiled-in maximum was %d", endStreamInfo.streamNumber, reader->header.numStreams, XED_MAX_STREAMS);
         }
 
     }
 
-    // Seek back to first event
-    if (fseeko64(reader->fp, 24, SEEK_SET) != 0) { return XED_E_INVALID_DATA; }
+    if (lazy) { return XED_OK; }
+
+    // Load the selected streams' indexes now, and create a contiguous global index of all events
+    for (i = 0; i < XED_MAX_STREAMS && i < (int)reader->header.numStreams; i++)
+    {
+        if (!(reader->streamMask & (1u << i))) { continue; }
+        ret = XedLoadStreamIndex(reader, i);
+        if (ret != XED_OK) { return ret; }
+    }
+    return XedMergeIndexes(reader);
+}
+
+
+// Is there a consistent event (or index block, or the end information) at the offset? (used to find the size of index blocks when recovering)
+static int XedRecoverPlausible(xed_reader_t *reader, uint64_t offset)
+{
+    unsigned char p[32];
+    size_t length;
+    if (offset == reader->fileSize) { return 1; }
+    if (offset > reader->fileSize) { return 0; }
+    length = (reader->fileSize - offset < sizeof(p)) ? (size_t)(reader->fileSize - offset) : sizeof(p);
+    if (length < 24 || XedReadAt(reader, offset, p, length) != XED_OK) { return 0; }
+    return XedCheckHeader(p, length, offset, reader->header.numStreams, reader->fileSize);
+}
+
+// Rebuild the indexes by walking the chain of events from the start of the file (for files with a missing, truncated or damaged index)
+static int XedRecoverIndexes(xed_reader_t *reader)
+{
+    const size_t windowSize = 8 * 1024 * 1024;     // Large sequential reads: event headers are usually close enough to share a window
+    unsigned char *window = NULL;
+    uint64_t windowOffset = 0;
+    size_t windowLength = 0;
+    unsigned int capacity[XED_MAX_STREAMS] = {0};
+    uint16_t additionalLength[XED_MAX_STREAMS];     // Frame information size per index entry, from each stream's initial event (0xffff if not seen)
+    int numStreams = reader->header.numStreams;
+    uint64_t offset = 24;
+    int i;
+
+    if (numStreams > XED_MAX_STREAMS) { numStreams = XED_MAX_STREAMS; }
+    for (i = 0; i < XED_MAX_STREAMS; i++)
+    {
+        memset(&reader->streamInfo[i], 0, sizeof(xed_end_stream_info_t));
+        reader->streamInfo[i].streamNumber = (uint16_t)i;
+        reader->streamInfo[i].extraPerIndexEntry = sizeof(xed_frame_info_t);
+        additionalLength[i] = 0xffff;
+    }
+
+    if (reader->map == NULL)
+    {
+        window = (unsigned char *)malloc(windowSize);
+        if (window == NULL) { return XED_E_OUT_OF_MEMORY; }
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+        if (!reader->direct) { posix_fadvise(reader->fd, 0, 0, POSIX_FADV_SEQUENTIAL); }
+#endif
+    }
 
-    // Create a super index of all events
+    while (offset + 24 <= reader->fileSize)
     {
-        int maxEvents = 0;
-        int indexEntry[XED_MAX_STREAMS] = {0};
-        int numStreams = reader->header.numStreams;
-        if (numStreams > XED_MAX_STREAMS) { numStreams = XED_MAX_STREAMS; }
+        const unsigned char *p;
+        xed_event_t event;
+        uint64_t size;
+        size_t available = (reader->fileSize - offset < 48) ? (size_t)(reader->fileSize - offset) : 48;
 
-        // Count the total number of index entries
-        maxEvents = 0;
-        for (i = 0; i < numStreams; i++)
+        // Event header and frame information (from the map, or the current window, refilled from here if needed)
+        if (reader->map != NULL)
         {
-            maxEvents += reader->streamInfo[i].totalIndexEntries;
+            p = reader->map + offset;
         }
-
-        // Allocate global index
-        reader->globalIndex = (xed_index_t **)malloc(sizeof(xed_index_t *) * maxEvents);
-        if (reader->globalIndex == NULL)
+        else
         {
-            fprintf(stderr, "ERROR: Problem allocating global index entries (%d)\n", maxEvents);
-            return XED_E_OUT_OF_MEMORY;
+            if (offset < windowOffset || offset + available > windowOffset + windowLength)
+            {
+                int64_t length = XedFileReadAt(reader, offset, window, windowSize);
+                if (length < (int64_t)available) { break; }
+                windowOffset = offset;
+                windowLength = (size_t)length;
+            }
+            p = window + (size_t)(offset - windowOffset);
         }
+        XedDecodeEvent(p, &event);
 
-        // Create global index
-        reader->totalEvents = 0;
-        for (;;)
+        if (event.streamId == 0xffff)
         {
-            int j;
-            int streamId = -1;
-            uint64_t nextOffset = 0;
-
-            // Find the next event from any of the streams
-            for (j = 0; j < numStreams; j++)
+            // Index block: written after the last event it indexes, use that stream's frame information size per entry
+            uint64_t entries = event.length;
+            unsigned int frameInfoSize = 0xffff;
+            uint64_t next;
+            unsigned char last[8];
+            if (entries > 0 && offset + 24 + entries * 24 <= reader->fileSize && XedReadAt(reader, offset + 24 + (entries - 1) * 24, last, sizeof(last)) == XED_OK)
             {
-                // If we still have more events in the stream
-                if (indexEntry[j] < (int)reader->streamInfo[j].totalIndexEntries)
+                uint64_t lastEntryOffset = get_uint64(last);
+                for (i = 0; i < numStreams; i++)
                 {
-                    uint64_t offs = reader->streamIndex[j][indexEntry[j]].indexEntry.frameFileOffset;
-                    if (streamId < 0 || offs < nextOffset)
-                    {
-                        streamId = j;
-                        nextOffset = offs;
-                    }
+                    unsigned int count = reader->streamInfo[i].totalIndexEntries;
+                    if (count > 0 && reader->streamIndex[i][count - 1].indexEntry.frameFileOffset == lastEntryOffset) { frameInfoSize = additionalLength[i]; break; }
                 }
             }
+            if (frameInfoSize != 0xffff)
+            {
+                next = offset + 24 + entries * (24 + frameInfoSize);
+                if (next > reader->fileSize) { XedLog(XED_LOG_NOTE, "Recovery dropped a truncated index block @%llu", (unsigned long long)offset); break; }
+            }
+            else
+            {
+                // Otherwise, only accept a size that is followed by a consistent header
+                next = offset + 24 + entries * (24 + sizeof(xed_frame_info_t));
+                if (!XedRecoverPlausible(reader, next)) { next = offset + 24 + entries * 24; }
+                if (!XedRecoverPlausible(reader, next)) { XedLog(XED_LOG_WARNING, "Recovery stopped at an unrecognized index block @%llu", (unsigned long long)offset); break; }
+            }
+            offset = next;
+            continue;
+        }
+        if (event.streamId == reader->header.numStreams) { break; }    // End of file information: all events found
+        if (event.streamId >= numStreams) { XedLog(XED_LOG_WARNING, "Recovery stopped at an unexpected stream number %d @%llu", event.streamId, (unsigned long long)offset); break; }
 
-            // Exit when no more entries
-            if (streamId < 0) { break; }
+        // Event header, frame information (if timestamped), and payload -- must be complete
+        size = 24 + (event.timestamp != 0 ? 24 : 0) + (uint64_t)event.length;
+        if (offset + size > reader->fileSize) { XedLog(XED_LOG_NOTE, "Recovery dropped a truncated event @%llu", (unsigned long long)offset); break; }
 
-            // Check if we're trying to overflow the global index (shouldn't be possible)
-            if (reader->totalEvents >= maxEvents)
+        // Append to the stream index
+        {
+            xed_end_stream_info_t *streamInfo = &reader->streamInfo[event.streamId];
+            xed_index_t *entry;
+            if (streamInfo->totalIndexEntries >= capacity[event.streamId])
             {
-                fprintf(stderr, "WARNING: Tried to overflow global index (%d)\n", maxEvents);
-                break;
+                unsigned int newCapacity = capacity[event.streamId] ? 2 * capacity[event.streamId] : 1024;
+                xed_index_t *newIndex = (xed_index_t *)realloc(reader->streamIndex[event.streamId], newCapacity * sizeof(xed_index_t));
+                if (newIndex == NULL) { free(window); return XED_E_OUT_OF_MEMORY; }
+                reader->streamIndex[event.streamId] = newIndex;
+                capacity[event.streamId] = newCapacity;
             }
+            entry = &reader->streamIndex[event.streamId][streamInfo->totalIndexEntries++];
+            memset(entry, 0, sizeof(xed_index_t));
+            entry->streamId = event.streamId;
+            entry->indexEntry.frameFileOffset = offset;
+            entry->indexEntry.frameTimestamp = event.timestamp;
+            entry->indexEntry.dataSize = event.length;
+            entry->indexEntry.dataSize2 = event.length2;
+            if (event.timestamp != 0) { memcpy(&entry->frameInfo, p + 24, sizeof(xed_frame_info_t)); }   // As in the index blocks: raw (big-endian) bytes
+        }
 
-            // Assign next global index entry to this stream's index entry
-            reader->globalIndex[reader->totalEvents] = &reader->streamIndex[streamId][indexEntry[streamId]];
-            reader->totalEvents++;      // Increment global index
-            indexEntry[streamId]++;     // Increment stream index
+        // The stream's initial event gives the size of its index blocks' frame information
+        if (additionalLength[event.streamId] == 0xffff && event.timestamp == 0 && event.length >= 284)
+        {
+            unsigned char value[2];
+            if (XedReadAt(reader, offset + 24 + 282, value, sizeof(value)) == XED_OK)
+            {
+                additionalLength[event.streamId] = get_uint16(value);
+                reader->streamInfo[event.streamId].extraPerIndexEntry = additionalLength[event.streamId];
+            }
         }
 
-        // Check we filled the global index (should be impossible not to)
-        if (reader->totalEvents != maxEvents)
+        offset += size;
+    }
+    free(window);
+
+    // Stream information from the recovered indexes
+    for (i = 0; i < numStreams; i++)
+    {
+        xed_end_stream_info_t *streamInfo = &reader->streamInfo[i];
+        if (streamInfo->totalIndexEntries > 0) { streamInfo->event0 = reader->streamIndex[i][0].indexEntry; }
+        if (streamInfo->totalIndexEntries > 1) { streamInfo->event1 = reader->streamIndex[i][1].indexEntry; }
+        if (streamInfo->totalIndexEntries > 2) { streamInfo->frameSize = reader->streamIndex[i][2].indexEntry.dataSize; }
+    }
+
+    XedLog(XED_LOG_NOTE, "Recovered index by scanning %llu / %llu bytes", (unsigned long long)offset, (unsigned long long)reader->fileSize);
+
+    return XedMergeIndexes(reader);
+}
+
+// Free the indexes
+static void XedFreeIndexes(xed_reader_t *reader)
+{
+    int i;
+
+    // Indexes in the cache are not separately allocated
+    if (reader->indexCache != NULL)
+    {
+        XedIndexCacheClose(reader);
+    }
+
+    if (reader->globalIndex != NULL)
+    {
+        free(reader->globalIndex);
+        reader->globalIndex = NULL;
+        reader->totalEvents = 0;
+    }
+
+    for (i = 0; i < XED_MAX_STREAMS; i++)
+    {
+        if (reader->streamIndex[i] != NULL)
+        {
+            free(reader->streamIndex[i]);
+            reader->streamIndex[i] = NULL;
+        }
+        if (reader->indexOffsets[i] != NULL)
         {
-            fprintf(stderr, "WARNING: Global index only has %d / %d entries\n", reader->totalEvents, maxEvents);
+            free(reader->indexOffsets[i]);
+            reader->indexOffsets[i] = NULL;
         }
+        reader->streamLoaded[i] = 0;
     }
+    reader->globalLoaded = 0;
+}
+
+// Mark all of the (selected) indexes as loaded
+static void XedIndexesLoaded(xed_reader_t *reader)
+{
+    int i;
+    for (i = 0; i < XED_MAX_STREAMS; i++) { reader->streamLoaded[i] = 1; }
+    reader->globalLoaded = 1;
+}
 
+// Read the metadata, or if that fails and recovery is enabled, rebuild it from the events.
+// The indexes are loaded on first use, unless recovering (so a damaged index is found now) or caching (the cache holds all of them).
+static int XedBuildIndexes(xed_reader_t *reader, int flags)
+{
+    int lazy = !(flags & (XED_READER_RECOVER | XED_READER_INDEX_CACHE));
+    int ret = XedReadFileMetadata(reader, lazy);
+    if (ret != XED_OK && (flags & XED_READER_RECOVER) && XedReadFileHeader(reader) == XED_OK)
+    {
+        XedLog(XED_LOG_WARNING, "File index is missing or damaged, recovering from the events.");
+        XedFreeIndexes(reader);
+        ret = XedRecoverIndexes(reader);
+    }
+    if (ret == XED_OK && !lazy) { XedIndexesLoaded(reader); }
+    return ret;
+}
+
+// Load a stream index on first use (safe to call concurrently), returns XED_OK or the error from loading it
+static int XedEnsureStreamIndex(xed_reader_t *reader, int stream)
+{
+    int state = XedAtomicGet(&reader->streamLoaded[stream]);
+    if (state == 0)
+    {
+        XedMutexLock(&reader->loadMutex);
+        state = reader->streamLoaded[stream];
+        if (state == 0)
+        {
+            uint64_t start = XedStatsClock();
+            int ret = XedLoadStreamIndex(reader, stream);
+            XedStatsAdd(reader, metadataTime, XedStatsClock() - start);
+            if (ret != XED_OK) { free(reader->streamIndex[stream]); reader->streamIndex[stream] = NULL; }
+            free(reader->scratch);
+            reader->scratch = NULL;
+            reader->scratchSize = 0;
+            state = (ret == XED_OK) ? 1 : ret;
+            XedAtomicSet(&reader->streamLoaded[stream], state);
+        }
+        XedMutexUnlock(&reader->loadMutex);
+    }
+    return (state > 0) ? XED_OK : state;
+}
+
+// Build the global index on first use (loading the selected streams' indexes), returns XED_OK or the error from loading it
+static int XedEnsureGlobalIndex(xed_reader_t *reader)
+{
+    int state = XedAtomicGet(&reader->globalLoaded);
+    if (state == 0)
+    {
+        int i, ret = XED_OK;
+        for (i = 0; i < XED_MAX_STREAMS && i < (int)reader->header.numStreams && ret == XED_OK; i++)
+        {
+            if (reader->streamMask & (1u << i)) { ret = XedEnsureStreamIndex(reader, i); }
+        }
+        XedMutexLock(&reader->loadMutex);
+        state = reader->globalLoaded;
+        if (state == 0)
+        {
+            if (ret == XED_OK)
+            {
+                uint64_t start = XedStatsClock();
+                ret = XedMergeIndexes(reader);
+                XedStatsAdd(reader, metadataTime, XedStatsClock() - start);
+            }
+            state = (ret == XED_OK) ? 1 : ret;
+            XedAtomicSet(&reader->globalLoaded, state);
+        }
+        XedMutexUnlock(&reader->loadMutex);
+    }
+    return (state > 0) ? XED_OK : state;
+}
+
+
+// Close the file
+static void XedCloseFile(xed_reader_t *reader)
+{
+#ifdef _WIN32
+    if (reader->file != INVALID_HANDLE_VALUE) { CloseHandle(reader->file); }
+    reader->file = INVALID_HANDLE_VALUE;
+#else
+    if (reader->fd >= 0) { close(reader->fd); }
+    reader->fd = -1;
+#endif
+}
+
+// Open the file handle, for direct I/O (unbuffered reads, which must be aligned) if requested
+static int XedOpenHandle(xed_reader_t *reader, const char *filename, int direct)
+{
+#ifdef _WIN32
+    reader->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, direct ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL, NULL);
+    return (reader->file != INVALID_HANDLE_VALUE);
+#else
+#ifdef O_DIRECT
+    reader->fd = open(filename, direct ? (O_RDONLY | O_DIRECT) : O_RDONLY);
+#else
+    if (direct) { return 0; }
+    reader->fd = open(filename, O_RDONLY);
+#endif
+    return (reader->fd >= 0);
+#endif
+}
+
+// Open the file (with XED_READER_DIRECT, for direct I/O if the filesystem supports it)
+static int XedOpenFile(xed_reader_t *reader, const char *filename, int flags)
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    FILETIME time;
+#else
+    struct stat st;
+#endif
+
+    // Direct I/O: the first aligned read checks that it works (some filesystems refuse O_DIRECT when opening, others only when reading), and fills the window
+    if (flags & XED_READER_DIRECT)
+    {
+        int64_t count = -1;
+        reader->directBuffer = (unsigned char *)XedAlignedAlloc(XED_DIRECT_WINDOW);
+        if (reader->directBuffer == NULL) { return XED_E_OUT_OF_MEMORY; }
+        reader->directBufferSize = XED_DIRECT_WINDOW;
+        if (XedOpenHandle(reader, filename, 1)) { count = XedFileRead(reader, 0, reader->directBuffer, XED_DIRECT_MIN_READ); }
+        if (count >= 0)
+        {
+            reader->direct = XED_DIRECT_IO;
+            reader->directOffset = 0;
+            reader->directLength = (size_t)count;
+        }
+        else
+        {
+            XedCloseFile(reader);
+            XedAlignedFree(reader->directBuffer);
+            reader->directBuffer = NULL;
+            reader->directBufferSize = 0;
+            reader->direct = XED_DIRECT_DROP;
+            XedLog(XED_LOG_NOTE, "Direct I/O not supported, using buffered reads and dropping the pages from the cache: %s", filename);
+        }
+    }
+    if (reader->direct != XED_DIRECT_IO && !XedOpenHandle(reader, filename, 0)) { return XED_E_ACCESS_DENIED; }
+#if !defined(_WIN32) && defined(POSIX_FADV_RANDOM)
+    if (reader->direct == XED_DIRECT_DROP) { posix_fadvise(reader->fd, 0, 0, POSIX_FADV_RANDOM); }   // (No read-ahead, which would cache bytes beyond the ranges dropped)
+#elif !defined(_WIN32) && defined(F_NOCACHE)
+    if (reader->direct == XED_DIRECT_DROP) { fcntl(reader->fd, F_NOCACHE, 1); }
+#endif
+
+#ifdef _WIN32
+    if (!GetFileSizeEx(reader->file, &size)) { return XED_E_ACCESS_DENIED; }
+    reader->fileSize = (uint64_t)size.QuadPart;
+    if (GetFileTime(reader->file, NULL, NULL, &time)) { reader->fileTime = ((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime; }
+#else
+    if (fstat(reader->fd, &st) != 0) { return XED_E_ACCESS_DENIED; }
+    reader->fileSize = (uint64_t)st.st_size;
+    reader->fileTime = (uint64_t)st.st_mtime;
+#endif
     return XED_OK;
 }
 
 
-// Open an XED input file and create a new reader structure
-xed_reader_t *XedNewReader(const char *filename)
+// Map the whole (open) file read-only into the reader (returns XED_OK, or an error if the file could not be mapped)
+static int XedMapFile(xed_reader_t *reader)
 {
+    if (reader->fileSize == 0 || reader->fileSize != (uint64_t)(size_t)reader->fileSize) { return XED_E_INVALID_DATA; }
+#ifdef _WIN32
+    reader->mapHandle = CreateFileMappingA(reader->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (reader->mapHandle == NULL) { return XED_E_ACCESS_DENIED; }
+    reader->map = (const unsigned char *)MapViewOfFile(reader->mapHandle, FILE_MAP_READ, 0, 0, 0);
+    if (reader->map == NULL) { return XED_E_OUT_OF_MEMORY; }
+#else
+    {
+        void *map = mmap(NULL, (size_t)reader->fileSize, PROT_READ, MAP_SHARED, reader->fd, 0);
+        if (map == MAP_FAILED) { return XED_E_OUT_OF_MEMORY; }
+        reader->map = (const unsigned char *)map;
+    }
+#endif
+    reader->mapSize = reader->fileSize;
+    return XED_OK;
+}
+
+// Release the file mapping
+static void XedUnmapFile(xed_reader_t *reader)
+{
+#ifdef _WIN32
+    if (reader->map != NULL) { UnmapViewOfFile(reader->map); }
+    if (reader->mapHandle != NULL) { CloseHandle(reader->mapHandle); }
+    reader->mapHandle = NULL;
+#else
+    if (reader->map != NULL) { munmap((void *)reader->map, (size_t)reader->mapSize); }
+#endif
+    reader->map = NULL;
+    reader->mapSize = 0;
+}
+
+// Open the file, read the metadata (or load it from the index cache), and create a new reader structure
+static xed_reader_t *XedOpenReader(const char *filename, uint32_t streamMask, int flags)
+{
+    uint64_t start;
+    int ret;
+
     // Create new reader structure
     xed_reader_t *reader = (xed_reader_t *)malloc(sizeof(xed_reader_t));
     if (reader == NULL) { return NULL; }                    // XED_E_OUT_OF_MEMORY
     memset(reader, 0, sizeof(xed_reader_t));
+#ifdef _WIN32
+    reader->file = INVALID_HANDLE_VALUE;
+#else
+    reader->fd = -1;
+#endif
+    XedMutexInit(&reader->loadMutex);
+    XedMutexInit(&reader->directMutex);
+
+    // Streams to index (the cache holds all of them)
+    reader->streamMask = (streamMask == 0 || (flags & XED_READER_INDEX_CACHE)) ? XED_STREAM_MASK_ALL : streamMask;
 
     // Open input file
-    reader->fp = fopen64(filename, "rb");
-    if (reader->fp == NULL) { free(reader); return NULL; }  // XED_E_ACCESS_DENIED
+    if (XedOpenFile(reader, filename, flags) != XED_OK)
+    {
+        XedCloseReader(reader);
+        return NULL;                                        // XED_E_ACCESS_DENIED
+    }
 
-    // Read metadata
-    if (XedReadFileMetadata(reader) != XED_OK)
+    // Map the input file, falling back to positional reads if it cannot be mapped (e.g. larger than the address space), or not mapped for direct I/O
+    if ((flags & XED_READER_MAPPED) && !(flags & XED_READER_DIRECT) && XedMapFile(reader) != XED_OK)
     {
-        fprintf(stderr, "ERROR: Problem parsing file: %s\n", filename); 
+        XedUnmapFile(reader);
+        XedLog(XED_LOG_WARNING, "Could not map file, using positional reads: %s", filename);
+    }
+
+    // Read metadata (from the index cache if it is up-to-date, otherwise rebuilding the cache)
+    start = XedStatsClock();
+    if (flags & XED_READER_INDEX_CACHE)
+    {
+        char *cacheFilename = (char *)malloc(strlen(filename) + 5);
+        if (cacheFilename == NULL) { XedCloseReader(reader); return NULL; }   // XED_E_OUT_OF_MEMORY
+        sprintf(cacheFilename, "%s.idx", filename);
+
+        if (XedReadFileHeader(reader) == XED_OK && XedIndexCacheLoad(reader, cacheFilename) == XED_OK)
+        {
+            XedIndexesLoaded(reader);
+            XedStatsAdd(reader, cacheHits, 1);
+            ret = XED_OK;
+        }
+        else
+        {
+            ret = XedBuildIndexes(reader, flags);
+            if (ret == XED_OK && XedIndexCacheSave(reader, cacheFilename) != XED_OK) { XedLog(XED_LOG_WARNING, "Could not write index cache: %s", cacheFilename); }
+        }
+        free(cacheFilename);
+    }
+    else
+    {
+        ret = XedBuildIndexes(reader, flags);
+    }
+    XedStatsAdd(reader, metadataTime, XedStatsClock() - start);
+    if (ret != XED_OK)
+    {
+        XedLog(XED_LOG_ERROR, "Problem parsing file: %s", filename); 
         XedCloseReader(reader);
-        free(reader); 
         return NULL;
     }
 
+    // The scratch buffer is only used while opening
+    free(reader->scratch);
+    reader->scratch = NULL;
+    reader->scratchSize = 0;
+
     return reader;
 }
 
+// Open an XED input file and create a new reader structure
+xed_reader_t *XedNewReader(const char *filename)
+{
+    return XedOpenReader(filename, XED_STREAM_MASK_ALL, 0);
+}
+
+// Open an XED input file as a read-only memory mapping and create a new reader structure
+xed_reader_t *XedNewReaderMapped(const char *filename)
+{
+    return XedOpenReader(filename, XED_STREAM_MASK_ALL, XED_READER_MAPPED);
+}
+
+// Open an XED input file with XED_READER_* options, indexing only the streams in the mask, and create a new reader structure
+xed_reader_t *XedNewReaderEx(const char *filename, uint32_t streamMask, int flags)
+{
+    return XedOpenReader(filename, streamMask, flags);
+}
+
 // Close the file and free the reader structure
 int XedCloseReader(xed_reader_t *reader)
 {
-    int i;
-
     if (reader == NULL) { return XED_E_POINTER; }
 
-    if (reader->fp != NULL)
-    {
-        fclose(reader->fp);
-        reader->fp = NULL;
-    }
+    XedUnmapFile(reader);
+    XedCloseFile(reader);
 
-    if (reader->globalIndex != NULL)
+    if (reader->scratch != NULL)
     {
-        free(reader->globalIndex);
-        reader->globalIndex = NULL;
-        reader->totalEvents = 0;
+        free(reader->scratch);
+        reader->scratch = NULL;
+        reader->scratchSize = 0;
     }
 
-    for (i = 0; i < XED_MAX_STREAMS; i++)
-    {
-        if (reader->streamIndex[i] != NULL)
-        {
-            free(reader->streamIndex[i]);
-            reader->streamIndex[i] = NULL;
-        }
-    }
+    XedFreeIndexes(reader);
+    XedAlignedFree(reader->directBuffer);
+    XedMutexDestroy(&reader->loadMutex);
+    XedMutexDestroy(&reader->directMutex);
 
     free(reader);
     return XED_OK;
@@ -410,11 +1249,13 @@ int XedGetNumEvents(xed_reader_t *reader, int stream)
     if (reader == NULL) { return XED_E_POINTER; }
     if (stream == XED_STREAM_ALL)
     {
+        int ret = XedEnsureGlobalIndex(reader);
+        if (ret != XED_OK) { return ret; }
         return reader->totalEvents;
     }
-    else if (stream >= 0 && stream < (int)reader->header.numStreams && stream < XED_MAX_STREAMS)
+    else if (stream >= 0 && stream < (int)reader->header.numStreams && stream < XED_MAX_STREAMS && (reader->streamMask & (1u << stream)))
     {
-        return reader->streamInfo[stream].totalIndexEntries;
+        return reader->streamInfo[stream].totalIndexEntries;    // (Known from the end information, without loading the index)
     }
     else
     {
@@ -422,25 +1263,41 @@ int XedGetNumEvents(xed_reader_t *reader, int stream)
     }
 }
 
+// Get the I/O and timing counters
+int XedGetStats(xed_reader_t *reader, xed_reader_stats_t *stats)
+{
+    if (reader == NULL || stats == NULL) { return XED_E_POINTER; }
+    stats->bytesRead = XedAtomicGet64(&reader->stats.bytesRead);
+    stats->reads = XedAtomicGet64(&reader->stats.reads);
+    stats->seeks = XedAtomicGet64(&reader->stats.seeks);
+    stats->eventsDecoded = XedAtomicGet64(&reader->stats.eventsDecoded);
+    stats->cacheHits = XedAtomicGet64(&reader->stats.cacheHits);
+    stats->metadataTime = XedAtomicGet64(&reader->stats.metadataTime);
+    stats->payloadTime = XedAtomicGet64(&reader->stats.payloadTime);
+    return XED_OK;
+}
+
 // Get an event index
 const xed_index_t *XedGetIndexEntry(xed_reader_t *reader, int stream, int index)
 {
     if (reader == NULL) { return NULL; } // XED_E_POINTER
     if (stream == XED_STREAM_ALL)
     {
+        if (XedEnsureGlobalIndex(reader) != XED_OK) { return NULL; }
         if (index >= 0 && index < reader->totalEvents)
         {
-            return reader->globalIndex[index];
+            return &reader->globalIndex[index];
         }
         else
         {
             return NULL; // XED_E_INVALID_ARG
         }
     }
-    else if (stream >= 0 && stream < (int)reader->header.numStreams && stream < XED_MAX_STREAMS)
+    else if (stream >= 0 && stream < (int)reader->header.numStreams && stream < XED_MAX_STREAMS && (reader->streamMask & (1u << stream)))
     {
         if (index >= 0 && index < (int)reader->streamInfo[stream].totalIndexEntries)
         {
+            if (XedEnsureStreamIndex(reader, stream) != XED_OK) { return NULL; }
             return &reader->streamIndex[stream][index];
         }
         else
@@ -454,29 +1311,135 @@ const xed_index_t *XedGetIndexEntry(xed_reader_t *reader, int stream, int index)
     }
 }
 
-// Read an event
-int XedReadEvent(xed_reader_t *reader, int stream, int index, xed_event_t *event, xed_frame_info_t *frameInfo, void *buffer, size_t bufferSize)
+// First index in [lo, hi) with a timestamp after (or, if inclusive, at or after) the given timestamp
+static int XedSearchTimestamp(const xed_index_t *index, int lo, int hi, uint64_t timestamp, int inclusive)
 {
-    size_t size;
-    const xed_index_t *indexEntry; 
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        uint64_t t = index[mid].indexEntry.frameTimestamp;
+        if (t < timestamp || (!inclusive && t == timestamp)) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo;
+}
+
+// The events either side of a timestamp in an index in timestamp order: the last at or before it, and the first at or after it (-1 if none)
+static void XedSearchEvents(const xed_index_t *index, int count, uint64_t timestamp, int *floorIndex, int *ceilIndex)
+{
+    int first;
+
+    // Skip the initial and empty events at the start of the index (they have no timestamp)
+    for (first = 0; first < count && index[first].indexEntry.frameTimestamp == 0; first++) { ; }
+
+    // Binary search for the events either side of the timestamp
+    *ceilIndex = XedSearchTimestamp(index, first, count, timestamp, 1);
+    *floorIndex = XedSearchTimestamp(index, *ceilIndex, count, timestamp, 0) - 1;
+    if (*floorIndex < first) { *floorIndex = -1; }
+    if (*ceilIndex >= count) { *ceilIndex = -1; }
+}
+
+// Position of a stream's event in the global index (which is in file offset order)
+static int XedGlobalPosition(const xed_reader_t *reader, const xed_index_t *entry)
+{
+    int lo = 0, hi = reader->totalEvents;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (reader->globalIndex[mid].indexEntry.frameFileOffset < entry->indexEntry.frameFileOffset) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo;
+}
+
+// Find an event by index timestamp
+int XedFindEventByTime(xed_reader_t *reader, int stream, uint64_t timestamp, int mode)
+{
+    uint64_t floorTime = 0, ceilTime = 0;
+    int floorIndex = -1, ceilIndex = -1;
 
     if (reader == NULL) { return XED_E_POINTER; }
-    if (reader->fp == NULL) { return XED_E_NOT_VALID_STATE; }
-    if (bufferSize > 0 && buffer == NULL) { return XED_E_POINTER; }
-    
-    indexEntry = XedGetIndexEntry(reader, stream, index);
-    if (indexEntry == NULL) { return XED_E_INVALID_ARG; }
+    if (mode != XED_FIND_NEAREST && mode != XED_FIND_FLOOR && mode != XED_FIND_CEIL) { return XED_E_INVALID_ARG; }
+
+    if (stream == XED_STREAM_ALL)
+    {
+        // The global index is in file order, where the streams' timestamps interleave: search each stream, and take the closest events either side (ties to the earlier event in the file for the first at or after, the later for the last at or before)
+        int ret = XedEnsureGlobalIndex(reader);
+        int i;
+        if (ret != XED_OK) { return ret; }
+        for (i = 0; i < (int)reader->header.numStreams && i < XED_MAX_STREAMS; i++)
+        {
+            const xed_index_t *index = reader->streamIndex[i];
+            int streamFloor, streamCeil;
+            if (!(reader->streamMask & (1u << i)) || index == NULL) { continue; }
+            XedSearchEvents(index, (int)reader->streamInfo[i].totalIndexEntries, timestamp, &streamFloor, &streamCeil);
+            if (streamFloor >= 0)
+            {
+                uint64_t t = index[streamFloor].indexEntry.frameTimestamp;
+                int position = XedGlobalPosition(reader, &index[streamFloor]);
+                if (floorIndex < 0 || t > floorTime || (t == floorTime && position > floorIndex)) { floorIndex = position; floorTime = t; }
+            }
+            if (streamCeil >= 0)
+            {
+                uint64_t t = index[streamCeil].indexEntry.frameTimestamp;
+                int position = XedGlobalPosition(reader, &index[streamCeil]);
+                if (ceilIndex < 0 || t < ceilTime || (t == ceilTime && position < ceilIndex)) { ceilIndex = position; ceilTime = t; }
+            }
+        }
+    }
+    else
+    {
+        const xed_index_t *index;
+        int ret, count = XedGetNumEvents(reader, stream);
+        if (count < 0) { return count; }
+        if (count == 0) { return XED_E_NOT_FOUND; }
+        ret = XedEnsureStreamIndex(reader, stream);         // (The count is known from the end information, without loading the index)
+        if (ret != XED_OK) { return ret; }
+        index = reader->streamIndex[stream];
+        XedSearchEvents(index, count, timestamp, &floorIndex, &ceilIndex);
+        if (floorIndex >= 0) { floorTime = index[floorIndex].indexEntry.frameTimestamp; }
+        if (ceilIndex >= 0) { ceilTime = index[ceilIndex].indexEntry.frameTimestamp; }
+    }
 
-    fseeko64(reader->fp, indexEntry->indexEntry.frameFileOffset, SEEK_SET);
+    if (mode == XED_FIND_NEAREST && floorIndex >= 0 && ceilIndex >= 0)
+    {
+        uint64_t after = ceilTime - timestamp;
+        uint64_t before = timestamp - floorTime;
+        return (after == 0 || after < before) ? ceilIndex : floorIndex;
+    }
+    if (mode == XED_FIND_FLOOR || (mode == XED_FIND_NEAREST && floorIndex >= 0)) { return (floorIndex >= 0) ? floorIndex : XED_E_NOT_FOUND; }
+    return (ceilIndex >= 0) ? ceilIndex : XED_E_NOT_FOUND;
+}
 
-fprintf(stderr, "<@%ld>", ftell(reader->fp));
+// Get the earliest event timestamp of the indexed streams
+int XedGetStartTime(xed_reader_t *reader, uint64_t *timestamp)
+{
+    int stream;
 
-    event->streamId = fget_uint16(reader->fp);
-    event->_flags = fget_uint16(reader->fp);
-    event->length = fget_uint32(reader->fp);
-    event->timestamp = fget_uint64(reader->fp);
-    event->_unknown1 = fget_uint32(reader->fp);
-    event->length2 = fget_uint32(reader->fp);
+    if (reader == NULL || timestamp == NULL) { return XED_E_POINTER; }
+    *timestamp = 0;
+    for (stream = 0; stream < (int)reader->header.numStreams && stream < XED_MAX_STREAMS; stream++)
+    {
+        const xed_index_t *entry;
+        int first;
+        if (!(reader->streamMask & (1u << stream))) { continue; }
+        first = XedFindEventByTime(reader, stream, 0, XED_FIND_CEIL);
+        if (first == XED_E_NOT_FOUND) { continue; }
+        if (first < 0) { return first; }
+        entry = XedGetIndexEntry(reader, stream, first);
+        if (entry == NULL) { return XED_E_INVALID_DATA; }
+        if (*timestamp == 0 || entry->indexEntry.frameTimestamp < *timestamp) { *timestamp = entry->indexEntry.frameTimestamp; }
+    }
+    return (*timestamp != 0) ? XED_OK : XED_E_NOT_FOUND;
+}
+
+// Decode an event header and (if timestamped) frame information, and find where the payload starts and its size
+int XedParseEventHeader(xed_reader_t *reader, const unsigned char *header, size_t headerLength, xed_event_t *event, xed_frame_info_t *frameInfo, size_t *headerSize, size_t *payloadSize)
+{
+    size_t size;
+
+    if (headerLength < 24) { return XED_E_ACCESS_DENIED; }
+    XedDecodeEvent(header, event);
+    XedStatsAdd(reader, eventsDecoded, 1);
+    *headerSize = 24;
 
     // Assume the payload size is the length specified
     size = event->length;
@@ -487,49 +1450,141 @@ fprintf(stderr, "<@%ld>", ftell(reader->fp));
     {
         int additional = 0;
         additional = 24;
-fprintf(stderr, "NOTE: Unexpected index (0x%04x.%d) -- skipping assuming has 24-bytes additional data %d/%d entries\n", event->streamId, event->_flags, event->length, event->length2);
+        XedLog(XED_LOG_NOTE, "Unexpected index (0x%04x.%d) -- skipping assuming has 24-bytes additional data %d/%d entries", event->streamId, event->_flags, event->length, event->length2);
         size *= (24 + additional);
     }
     else if (event->streamId == reader->header.numStreams)
     {
         // Probably the index location packet, stop parsing
-fprintf(stderr, "ERROR: Unexpected stream number (probably the index location packet) %d.\n", event->streamId);
-return XED_E_ABORT;
+        XedLog(XED_LOG_ERROR, "Unexpected stream number (probably the index location packet) %d.", event->streamId);
+        return XED_E_ABORT;
     }
     else if (event->streamId > reader->header.numStreams)
     {
         // Unexpected stream number
-fprintf(stderr, "ERROR: Unexpected stream number %d.", event->streamId);
+        XedLog(XED_LOG_ERROR, "Unexpected stream number %d.", event->streamId);
         return XED_E_INVALID_DATA;
     }
     else if (event->timestamp != 0)
     {
         // If we have a timestamp, read the event info first
-        frameInfo->_unknown1 = fget_uint16_be(reader->fp);
-        frameInfo->_unknown2 = fget_uint16_be(reader->fp);
-        frameInfo->_unknown3 = fget_uint16_be(reader->fp);
-        frameInfo->_unknown4 = fget_uint16_be(reader->fp);
-        frameInfo->width = fget_uint16_be(reader->fp);
-        frameInfo->height = fget_uint16_be(reader->fp);
-        frameInfo->sequenceNumber = fget_uint32_be(reader->fp);
-        frameInfo->_unknown5 = fget_uint32_be(reader->fp);
-        frameInfo->timestamp = fget_uint32_be(reader->fp);
+        if (headerLength < 48) { return XED_E_ACCESS_DENIED; }
+        XedDecodeEventFrameInfo(header + 24, frameInfo);
+        *headerSize = 48;
     } else { memset(frameInfo, 0, sizeof(xed_frame_info_t)); }
 
-fprintf(stderr, "<%d|%d=%d>", event->length, event->length2, size);
-fprintf(stderr, "=%d.%d;", event->streamId, event->_flags);
+    *payloadSize = size;
+    return XED_OK;
+}
+
+// Locate an event: decode its header and frame information, and find the offset and size of its payload
+int XedLocateEvent(xed_reader_t *reader, int stream, int index, xed_event_t *event, xed_frame_info_t *frameInfo, uint64_t *payloadOffset, size_t *payloadSize)
+{
+    size_t size, headerSize;
+    const xed_index_t *indexEntry; 
+    unsigned char header[48];       // Event header and (if present) frame information, read together
+    int64_t headerLength;
+    uint64_t offset, start;
+    int ret;
+
+    if (reader == NULL) { return XED_E_POINTER; }
+    if (reader->fileSize == 0) { return XED_E_NOT_VALID_STATE; }
+    
+    indexEntry = XedGetIndexEntry(reader, stream, index);
+    if (indexEntry == NULL) { return XED_E_INVALID_ARG; }
+    start = XedStatsClock();
+
+    offset = indexEntry->indexEntry.frameFileOffset;
+
+    if (reader->map != NULL)
+    {
+        headerLength = (offset < reader->mapSize) ? (int64_t)(reader->mapSize - offset) : 0;
+        if (headerLength > (int64_t)sizeof(header)) { headerLength = sizeof(header); }
+        if (headerLength > 0) { memcpy(header, reader->map + offset, (size_t)headerLength); XedStatsRead(reader, offset, (uint64_t)headerLength, 0); }
+    }
+    else
+    {
+        headerLength = XedFileReadAt(reader, offset, header, sizeof(header));
+    }
+    ret = XedParseEventHeader(reader, header, (headerLength > 0) ? (size_t)headerLength : 0, event, frameInfo, &headerSize, &size);
+    XedStatsAdd(reader, metadataTime, XedStatsClock() - start);
+    if (ret != XED_OK) { return ret; }
+
+    *payloadOffset = offset + headerSize;
+    *payloadSize = size;
+    XED_TRACE(("<@%llu> <%d|%d=%d> =%d.%d", (unsigned long long)offset, event->length, event->length2, (int)size, event->streamId, event->_flags));
+    return XED_OK;
+}
+
+// Read an event
+int XedReadEvent(xed_reader_t *reader, int stream, int index, xed_event_t *event, xed_frame_info_t *frameInfo, void *buffer, size_t bufferSize)
+{
+    uint64_t offset;
+    size_t size;
+    int ret;
 
-    // Read buffer
+    if (bufferSize > 0 && buffer == NULL) { return XED_E_POINTER; }
+
+    ret = XedLocateEvent(reader, stream, index, event, frameInfo, &offset, &size);
+    if (ret != XED_OK) { return ret; }
+
+    // Read buffer (any bytes beyond the buffer size are not read)
     {
         size_t readSize = size;
-        if (size > bufferSize) { size = bufferSize; }
-        if (fread(buffer, 1, readSize, reader->fp) != readSize) { return XED_E_ACCESS_DENIED; }
-        // Skip any remaining bytes
-        if (readSize < size)
+        if (readSize > bufferSize) { readSize = bufferSize; }
+        if (readSize > 0)
         {
-            fseeko64(reader->fp, size - readSize, SEEK_CUR);
+            uint64_t start = XedStatsClock();
+            ret = XedReadAt(reader, offset, buffer, readSize);
+            XedStatsAdd(reader, payloadTime, XedStatsClock() - start);
+            if (ret != XED_OK) { return XED_E_ACCESS_DENIED; }
         }
     }
 
     return XED_OK;
 }
+
+// Map an event: for a mapped reader the view points directly into the file mapping, otherwise the payload is read into an allocated buffer
+int XedMapEvent(xed_reader_t *reader, int stream, int index, xed_event_view_t *view)
+{
+    uint64_t offset;
+    size_t size;
+    int ret;
+
+    if (view == NULL) { return XED_E_POINTER; }
+    memset(view, 0, sizeof(xed_event_view_t));
+
+    ret = XedLocateEvent(reader, stream, index, &view->event, &view->frameInfo, &offset, &size);
+    if (ret != XED_OK) { return ret; }
+
+    if (reader->map != NULL)
+    {
+        if (offset > reader->mapSize || size > reader->mapSize - offset) { return XED_E_INVALID_DATA; }
+        view->data = reader->map + offset;
+    }
+    else
+    {
+        uint64_t start;
+        view->_buffer = malloc(size > 0 ? size : 1);
+        if (view->_buffer == NULL) { return XED_E_OUT_OF_MEMORY; }
+        start = XedStatsClock();
+        ret = (size > 0) ? XedReadAt(reader, offset, view->_buffer, size) : XED_OK;
+        XedStatsAdd(reader, payloadTime, XedStatsClock() - start);
+        if (ret != XED_OK) { free(view->_buffer); view->_buffer = NULL; return XED_E_ACCESS_DENIED; }
+        view->data = view->_buffer;
+    }
+    view->length = size;
+
+    return XED_OK;
+}
+
+// Release an event view
+int XedUnmapEvent(xed_reader_t *reader, xed_event_view_t *view)
+{
+    if (reader == NULL || view == NULL) { return XED_E_POINTER; }
+    if (view->_buffer != NULL) { free(view->_buffer); }
+    view->_buffer = NULL;
+    view->data = NULL;
+    view->length = 0;
+    return XED_OK;
+}
@@ -0,0 +1,223 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Depth Archive -- creates a losslessly compressed archive of the depth frames of a .xed file, and measures decoding it
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "xed/xed.h"
+#include "xed/archive.h"
+
+
+// Monotonic time in seconds
+static double ArchiveTime(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+#endif
+}
+
+// Size of a file in bytes (0 if it cannot be opened)
+static double ArchiveFileSize(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    double size = 0;
+    if (fp == NULL) { return 0; }
+#ifdef _WIN32
+    if (_fseeki64(fp, 0, SEEK_END) == 0) { size = (double)_ftelli64(fp); }
+#else
+    if (fseeko(fp, 0, SEEK_END) == 0) { size = (double)ftello(fp); }
+#endif
+    fclose(fp);
+    return size;
+}
+
+
+// Decode every frame in order, optionally comparing each with the original event, and report the decoding rate
+static int ArchiveDecode(const char *archiveFilename, struct xed_reader *reader, int stream)
+{
+    struct xed_archive *archive;
+    unsigned char *buffer = NULL;
+    size_t bufferSize = 0;
+    uint64_t firstTime = 0, lastTime = 0;
+    int numFrames, numEvents = 0, event = 0;
+    int i, mismatches = 0;
+    double start, elapsed;
+
+    archive = XedOpenArchive(archiveFilename);
+    if (archive == NULL) { return 1; }
+    numFrames = XedArchiveGetNumFrames(archive);
+    if (reader != NULL) { numEvents = XedGetNumEvents(reader, stream); }
+
+    start = ArchiveTime();
+    for (i = 0; i < numFrames; i++)
+    {
+        xed_event_t header;
+        xed_frame_info_t frameInfo;
+        int ret;
+
+        // Decode into the buffer, growing it only when a frame is larger (the archive keeps the decoded frame, so the second read just copies it out)
+        ret = XedArchiveReadFrame(archive, i, &header, &frameInfo, buffer, bufferSize);
+        if (ret == XED_OK && header.length > bufferSize)
+        {
+            free(buffer);
+            bufferSize = header.length;
+            buffer = (unsigned char *)malloc(bufferSize);
+            if (buffer == NULL) { bufferSize = 0; ret = XED_E_OUT_OF_MEMORY; }
+            else { ret = XedArchiveReadFrame(archive, i, &header, &frameInfo, buffer, bufferSize); }
+        }
+        if (ret != XED_OK) { fprintf(stderr, "ERROR: Problem decoding archive frame %d (%d).\n", i, ret); mismatches++; break; }
+        if (i == 0) { firstTime = header.timestamp; }
+        lastTime = header.timestamp;
+
+        // Compare with the original (the archive has the stream's depth frames, in order)
+        if (reader != NULL)
+        {
+            xed_event_view_t view;
+            for (; event < numEvents; event++)
+            {
+                const xed_index_t *entry = XedGetIndexEntry(reader, stream, event);
+                if (entry != NULL && entry->indexEntry.frameTimestamp == header.timestamp) { break; }
+            }
+            if (event >= numEvents || XedMapEvent(reader, stream, event, &view) != XED_OK) { fprintf(stderr, "ERROR: Archive frame %d not found in the original.\n", i); mismatches++; continue; }
+            if (view.length != header.length || memcmp(view.data, buffer, view.length) != 0 || memcmp(&view.event, &header, sizeof(header)) != 0 || memcmp(&view.frameInfo, &frameInfo, sizeof(frameInfo)) != 0)
+            {
+                if (mismatches < 10) { fprintf(stderr, "ERROR: Archive frame %d differs from the original event %d.\n", i, event); }
+                mismatches++;
+            }
+            XedUnmapEvent(reader, &view);
+            event++;
+        }
+    }
+    elapsed = ArchiveTime() - start;
+
+    if (reader == NULL && numFrames > 0)
+    {
+        double duration = (lastTime - firstTime) / (double)XED_EVENT_TICKS_PER_SECOND;
+        fprintf(stderr, "NOTE: Decoded %d frames in %.3f s (%.1f frames/s", numFrames, elapsed, numFrames / (elapsed > 0 ? elapsed : 1e-9));
+        if (duration > 0) { fprintf(stderr, ", %.1fx real-time", duration / (elapsed > 0 ? elapsed : 1e-9)); }
+        fprintf(stderr, ").\n");
+    }
+    else if (reader != NULL)
+    {
+        fprintf(stderr, "NOTE: Verified %d frames: %d differ.\n", numFrames, mismatches);
+    }
+
+    free(buffer);
+    XedCloseArchive(archive);
+    return (mismatches > 0) ? 1 : 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *inputFilename = NULL;
+    const char *outputFilename = NULL;
+    int stream = 0;
+    int flags = XED_ARCHIVE_TEMPORAL;
+    int keyInterval = XED_ARCHIVE_DEFAULT_KEY_INTERVAL;
+    int decodeOnly = 0;
+    int verify = 0;
+    int help = 0;
+    int ret;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcasecmp(argv[i], "--help")) { help = 1; break; }
+        else if (!strcasecmp(argv[i], "--stream") && i + 1 < argc) { stream = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--key-interval") && i + 1 < argc) { keyInterval = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--no-temporal")) { flags &= ~XED_ARCHIVE_TEMPORAL; }
+        else if (!strcasecmp(argv[i], "--verify")) { verify = 1; }
+        else if (!strcasecmp(argv[i], "--decode")) { decodeOnly = 1; }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0') { fprintf(stderr, "ERROR: Unknown option: %s\n", argv[i]); help = 1; break; }
+        else if (inputFilename == NULL) { inputFilename = argv[i]; }
+        else if (outputFilename == NULL) { outputFilename = argv[i]; }
+        else { fprintf(stderr, "ERROR: Unexpected parameter: %s\n", argv[i]); help = 1; break; }
+    }
+
+    if (!help && (inputFilename == NULL || (outputFilename == NULL && !decodeOnly))) { fprintf(stderr, "ERROR: Files not specified.\n"); help = 1; }
+    if (!help && (stream < 0 || stream >= XED_MAX_STREAMS || keyInterval < 1)) { fprintf(stderr, "ERROR: Invalid option value.\n"); help = 1; }
+
+    if (help)
+    {
+        fprintf(stderr, "Usage: xed_archive [--stream <n>] [--no-temporal] [--key-interval <frames>] [--verify] <input.xed> <output.xdz>\n");
+        fprintf(stderr, "       xed_archive --decode <archive.xdz>\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Losslessly compresses the depth frames of a stream (default 0) into an archive, then measures decoding it.\n");
+        fprintf(stderr, "  --no-temporal      Only key frames (no differences from the previous frame)\n");
+        fprintf(stderr, "  --key-interval     At least one key frame in this many frames (default %d)\n", XED_ARCHIVE_DEFAULT_KEY_INTERVAL);
+        fprintf(stderr, "  --verify           Compare every decoded frame with the original event\n");
+        fprintf(stderr, "  --decode           Only measure decoding an existing archive\n");
+        return -1;
+    }
+
+    if (decodeOnly) { return ArchiveDecode(inputFilename, NULL, stream); }
+
+    {
+        struct xed_reader *reader;
+        double start, elapsed, inputSize, outputSize;
+
+        reader = XedNewReaderEx(inputFilename, 1u << stream, XED_READER_MAPPED);
+        if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening input file: %s\n", inputFilename); return 1; }
+
+        start = ArchiveTime();
+        ret = XedArchiveCreate(reader, stream, outputFilename, flags, keyInterval);
+        elapsed = ArchiveTime() - start;
+        if (ret != XED_OK) { fprintf(stderr, "ERROR: Problem creating archive (%d).\n", ret); XedCloseReader(reader); return 1; }
+
+        inputSize = ArchiveFileSize(inputFilename);
+        outputSize = ArchiveFileSize(outputFilename);
+        fprintf(stderr, "NOTE: Archived stream %d in %.3f s: %.1f MB to %.1f MB (%.1f%% of the input file).\n", stream, elapsed, inputSize / 1048576.0, outputSize / 1048576.0, inputSize > 0 ? 100.0 * outputSize / inputSize : 0.0);
+
+        ret = verify ? ArchiveDecode(outputFilename, reader, stream) : 0;
+        XedCloseReader(reader);
+        if (ret == 0) { ret = ArchiveDecode(outputFilename, NULL, stream); }
+    }
+
+    return ret;
+}
@@ -0,0 +1,495 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Asynchronous Reads -- many event reads outstanding from one thread, through io_uring (Linux) or a pool of threads making blocking reads
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+// io_uring through the system calls (no library needed), compile with XED_NO_IO_URING for kernel headers without it
+#if defined(__linux__) && !defined(XED_NO_IO_URING)
+#define XED_HAVE_IO_URING
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+#include "xed_thread.h"
+
+
+#define XED_ASYNC_DEFAULT_DEPTH 32
+#define XED_ASYNC_MAX_THREADS   8           // Thread pool size (at most one per outstanding read)
+
+typedef struct xed_async
+{
+    xed_reader_t *reader;
+    int queueDepth;
+    int outstanding;                // Submitted, and not yet returned by XedPollCompletions
+    int uring;                      // Reads are through io_uring (otherwise the thread pool)
+
+    // Thread pool
+    xed_async_request_t *pending;   // Submitted, not yet started (in submission order)
+    xed_async_request_t *pendingTail;
+    xed_async_request_t *completed; // Read, not yet returned (any order)
+    int numThreads;
+    xed_thread_t *threads;
+    int stop;                       // Closing: the threads should exit
+    xed_mutex_t mutex;
+    xed_cond_t submitted;
+    xed_cond_t done;
+
+#ifdef XED_HAVE_IO_URING
+    int ringFd;
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;                   // (The same mapping as sqRing, if the kernel supports it)
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned toSubmit;              // Queued entries not yet passed to the kernel
+    struct iovec *iov;              // Two for each submission queue entry (header, payload)
+#endif
+} xed_async_t;
+
+
+// Bytes of the event to read: its header, and its payload up to the buffer size
+static size_t XedAsyncPayloadRead(const xed_async_request_t *request)
+{
+    return (request->_payloadSize < request->bufferSize) ? request->_payloadSize : request->bufferSize;
+}
+
+// A read has completed: decode the header, checking it agrees with the index, and call the callback
+static void XedAsyncFinish(xed_async_t *async, xed_async_request_t *request)
+{
+    size_t payloadRead = XedAsyncPayloadRead(request);
+    size_t headerSize = 0, payloadSize = 0;
+    int ret = XED_E_ACCESS_DENIED;
+
+    async->outstanding--;
+    if (request->_bytesRead == (int64_t)(request->_headerSize + payloadRead))
+    {
+        ret = XedParseEventHeader(async->reader, request->_header, request->_headerSize, &request->event, &request->frameInfo, &headerSize, &payloadSize);
+        if (ret == XED_OK && (headerSize != request->_headerSize || payloadSize != request->_payloadSize)) { ret = XED_E_INVALID_DATA; }
+    }
+    if (ret == XED_OK)
+    {
+        request->length = payloadRead;
+    }
+    else
+    {
+        // A failed or short read, or an event that does not match its index entry: read it again (blocking) to report the error
+        request->length = 0;
+        ret = XedReadEvent(async->reader, request->stream, request->index, &request->event, &request->frameInfo, request->buffer, request->bufferSize);
+        if (ret == XED_OK) { request->length = (request->event.length < request->bufferSize) ? request->event.length : request->bufferSize; }
+    }
+    request->result = ret;
+    if (request->callback != NULL) { request->callback(request); }
+}
+
+
+// Blocking read of an event's bytes (thread pool), returns the number of bytes read, or -1 on error
+static int64_t XedAsyncRead(xed_reader_t *reader, xed_async_request_t *request)
+{
+    size_t payloadRead = XedAsyncPayloadRead(request);
+#ifdef _WIN32
+    if (XedReadAt(reader, request->_offset, request->_header, request->_headerSize) != XED_OK) { return -1; }
+    if (payloadRead > 0 && XedReadAt(reader, request->_offset + request->_headerSize, request->buffer, payloadRead) != XED_OK) { return -1; }
+    return (int64_t)(request->_headerSize + payloadRead);
+#else
+    struct iovec iov[2];
+    iov[0].iov_base = request->_header;
+    iov[0].iov_len = request->_headerSize;
+    iov[1].iov_base = request->buffer;
+    iov[1].iov_len = payloadRead;
+    return XedReadVectorAt(reader, request->_offset, iov, (payloadRead > 0) ? 2 : 1);
+#endif
+}
+
+static XED_THREAD_FUNC XedAsyncThread(void *arg)
+{
+    xed_async_t *async = (xed_async_t *)arg;
+
+    for (;;)
+    {
+        xed_async_request_t *request;
+
+        XedMutexLock(&async->mutex);
+        while (!async->stop && async->pending == NULL) { XedCondWait(&async->submitted, &async->mutex); }
+        request = async->pending;
+        if (request == NULL) { XedMutexUnlock(&async->mutex); break; }
+        async->pending = request->_next;
+        if (async->pending == NULL) { async->pendingTail = NULL; }
+        XedMutexUnlock(&async->mutex);
+
+        request->_bytesRead = XedAsyncRead(async->reader, request);
+
+        XedMutexLock(&async->mutex);
+        request->_next = async->completed;
+        async->completed = request;
+        XedCondSignal(&async->done);
+        XedMutexUnlock(&async->mutex);
+    }
+
+    return 0;
+}
+
+
+#ifdef XED_HAVE_IO_URING
+static void XedAsyncUringClose(xed_async_t *async)
+{
+    if (async->sqes != NULL) { munmap(async->sqes, async->sqesSize); }
+    if (async->cqRing != NULL && async->cqRing != async->sqRing) { munmap(async->cqRing, async->cqRingSize); }
+    if (async->sqRing != NULL) { munmap(async->sqRing, async->sqRingSize); }
+    if (async->ringFd >= 0) { close(async->ringFd); }
+    free(async->iov);
+    async->sqes = NULL;
+    async->cqRing = async->sqRing = NULL;
+    async->ringFd = -1;
+    async->iov = NULL;
+}
+
+// Set up the rings, returns XED_OK, or an error if io_uring is not available (e.g. an older kernel, or disabled)
+static int XedAsyncUringOpen(xed_async_t *async)
+{
+    struct io_uring_params params;
+    unsigned char *sq, *cq;
+
+    memset(&params, 0, sizeof(params));
+    async->ringFd = (int)syscall(__NR_io_uring_setup, (unsigned)async->queueDepth, &params);
+    if (async->ringFd < 0) { return XED_E_NOT_IMPLEMENTED; }
+    if (!(params.features & IORING_FEAT_SUBMIT_STABLE)) { XedAsyncUringClose(async); return XED_E_NOT_IMPLEMENTED; }   // (The iovecs only need to last until submitted)
+
+    async->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    async->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (async->cqRingSize > async->sqRingSize) { async->sqRingSize = async->cqRingSize; }
+        async->cqRingSize = async->sqRingSize;
+    }
+    async->sqRing = mmap(NULL, async->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, async->ringFd, IORING_OFF_SQ_RING);
+    if (async->sqRing == MAP_FAILED) { async->sqRing = NULL; XedAsyncUringClose(async); return XED_E_NOT_IMPLEMENTED; }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) { async->cqRing = async->sqRing; }
+    else
+    {
+        async->cqRing = mmap(NULL, async->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, async->ringFd, IORING_OFF_CQ_RING);
+        if (async->cqRing == MAP_FAILED) { async->cqRing = NULL; XedAsyncUringClose(async); return XED_E_NOT_IMPLEMENTED; }
+    }
+    async->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    async->sqes = (struct io_uring_sqe *)mmap(NULL, async->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, async->ringFd, IORING_OFF_SQES);
+    if (async->sqes == MAP_FAILED) { async->sqes = NULL; XedAsyncUringClose(async); return XED_E_NOT_IMPLEMENTED; }
+    async->iov = (struct iovec *)malloc(sizeof(struct iovec) * 2 * params.sq_entries);
+    if (async->iov == NULL) { XedAsyncUringClose(async); return XED_E_OUT_OF_MEMORY; }
+
+    sq = (unsigned char *)async->sqRing;
+    cq = (unsigned char *)async->cqRing;
+    async->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    async->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    async->sqArray = (unsigned *)(sq + params.sq_off.array);
+    async->cqHead = (unsigned *)(cq + params.cq_off.head);
+    async->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    async->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    async->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    if ((int)params.sq_entries < async->queueDepth) { async->queueDepth = (int)params.sq_entries; }
+    return XED_OK;
+}
+
+// Pass the queued entries to the kernel, optionally waiting for completions
+static int XedAsyncUringEnter(xed_async_t *async, unsigned minComplete)
+{
+    for (;;)
+    {
+        int ret = (int)syscall(__NR_io_uring_enter, async->ringFd, async->toSubmit, minComplete, (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0) { async->toSubmit -= ((unsigned)ret < async->toSubmit) ? (unsigned)ret : async->toSubmit; return XED_OK; }
+        if (errno != EINTR) { return XED_E_FAIL; }
+    }
+}
+
+// Return the completed reads, returns the number completed
+static int XedAsyncUringReap(xed_async_t *async)
+{
+    unsigned head = *async->cqHead;
+    unsigned tail = __atomic_load_n(async->cqTail, __ATOMIC_ACQUIRE);
+    int count = 0;
+
+    while (head != tail)
+    {
+        const struct io_uring_cqe *cqe = &async->cqes[head & *async->cqMask];
+        xed_async_request_t *request = (xed_async_request_t *)(uintptr_t)cqe->user_data;
+        request->_bytesRead = cqe->res;
+        head++;
+        __atomic_store_n(async->cqHead, head, __ATOMIC_RELEASE);     // (Frees the entry before the callback, which may submit another read)
+        XedStatsRead(async->reader, request->_offset, (request->_bytesRead > 0) ? (uint64_t)request->_bytesRead : 0, 1);
+        XedAsyncFinish(async, request);
+        count++;
+        tail = __atomic_load_n(async->cqTail, __ATOMIC_ACQUIRE);
+    }
+    return count;
+}
+
+// Complete every outstanding read before the ring is closed (after XedPollCompletions failed): wait for the reads the kernel has,
+// so that none completes into a buffer after closing, and complete the reads that were not passed to the kernel with blocking reads
+static void XedAsyncUringDrain(xed_async_t *async)
+{
+    int warned = 0;
+
+    while (async->outstanding > 0)
+    {
+        if (async->outstanding > (int)async->toSubmit)
+        {
+            int ret = (int)syscall(__NR_io_uring_enter, async->ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            if (ret < 0 && errno != EINTR && !warned) { XedLog(XED_LOG_WARNING, "Problem waiting for %d asynchronous reads to complete (errno %d), retrying.", async->outstanding - (int)async->toSubmit, errno); warned = 1; }
+            XedAsyncUringReap(async);
+        }
+        else
+        {
+            // The oldest entry not passed to the kernel
+            const struct io_uring_sqe *sqe = &async->sqes[(*async->sqTail - async->toSubmit) & *async->sqMask];
+            xed_async_request_t *request = (xed_async_request_t *)(uintptr_t)sqe->user_data;
+            async->toSubmit--;
+            request->_bytesRead = -1;                       // (Read again, blocking)
+            XedAsyncFinish(async, request);
+        }
+    }
+}
+
+// Queue a read of the event's header and payload (a single readv)
+static void XedAsyncUringQueue(xed_async_t *async, xed_async_request_t *request)
+{
+    unsigned tail = *async->sqTail;
+    unsigned slot = tail & *async->sqMask;
+    struct io_uring_sqe *sqe = &async->sqes[slot];
+    struct iovec *iov = &async->iov[2 * slot];
+    size_t payloadRead = XedAsyncPayloadRead(request);
+
+    iov[0].iov_base = request->_header;
+    iov[0].iov_len = request->_headerSize;
+    iov[1].iov_base = request->buffer;
+    iov[1].iov_len = payloadRead;
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = async->reader->fd;
+    sqe->off = request->_offset;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = (payloadRead > 0) ? 2 : 1;
+    sqe->user_data = (uint64_t)(uintptr_t)request;
+    async->sqArray[slot] = slot;
+    __atomic_store_n(async->sqTail, tail + 1, __ATOMIC_RELEASE);
+    async->toSubmit++;
+}
+#endif
+
+
+xed_async_t *XedNewAsync(xed_reader_t *reader, int queueDepth, int flags)
+{
+    xed_async_t *async;
+    int i;
+
+    if (reader == NULL) { return NULL; }                    // XED_E_POINTER
+#ifdef _WIN32
+    if (reader->file == INVALID_HANDLE_VALUE) { return NULL; }  // XED_E_NOT_VALID_STATE
+#else
+    if (reader->fd < 0) { return NULL; }                    // XED_E_NOT_VALID_STATE
+#endif
+    if (queueDepth <= 0) { queueDepth = XED_ASYNC_DEFAULT_DEPTH; }
+
+    async = (xed_async_t *)malloc(sizeof(xed_async_t));
+    if (async == NULL) { return NULL; }                     // XED_E_OUT_OF_MEMORY
+    memset(async, 0, sizeof(xed_async_t));
+    async->reader = reader;
+    async->queueDepth = queueDepth;
+
+#ifdef XED_HAVE_IO_URING
+    async->ringFd = -1;
+    if (!(flags & XED_ASYNC_THREADS) && !reader->direct && XedAsyncUringOpen(async) == XED_OK)     // (XED_READER_DIRECT reads go through the reader's aligned window)
+    {
+        async->uring = 1;
+        return async;
+    }
+    XED_TRACE(("io_uring not available, using a thread pool"));
+#else
+    (void)flags;
+#endif
+
+    // Thread pool fallback
+    async->numThreads = (queueDepth < XED_ASYNC_MAX_THREADS) ? queueDepth : XED_ASYNC_MAX_THREADS;
+    async->threads = (xed_thread_t *)malloc(sizeof(xed_thread_t) * async->numThreads);
+    if (async->threads == NULL) { free(async); return NULL; }   // XED_E_OUT_OF_MEMORY
+    XedMutexInit(&async->mutex);
+    XedCondInit(&async->submitted);
+    XedCondInit(&async->done);
+    for (i = 0; i < async->numThreads; i++)
+    {
+        if (XedThreadCreate(&async->threads[i], XedAsyncThread, async) != 0)
+        {
+            async->numThreads = i;
+            XedCloseAsync(async);
+            return NULL;                                    // XED_E_FAIL
+        }
+    }
+
+    return async;
+}
+
+
+int XedSubmitRead(xed_async_t *async, xed_async_request_t *request)
+{
+    const xed_index_t *entry;
+
+    if (async == NULL || request == NULL) { return XED_E_POINTER; }
+    if (request->bufferSize > 0 && request->buffer == NULL) { return XED_E_POINTER; }
+    if (async->outstanding >= async->queueDepth) { return XED_E_NOT_VALID_STATE; }
+
+    // Resolve the event's bytes from the index
+    entry = XedGetIndexEntry(async->reader, request->stream, request->index);
+    if (entry == NULL) { return XED_E_INVALID_ARG; }
+    request->_offset = entry->indexEntry.frameFileOffset;
+    request->_headerSize = (entry->indexEntry.frameTimestamp != 0) ? 48 : 24;
+    request->_payloadSize = entry->indexEntry.dataSize;
+    request->_bytesRead = -1;
+    request->_next = NULL;
+    request->result = XED_E_NOT_VALID_STATE;                // (Outstanding)
+    request->length = 0;
+    async->outstanding++;
+
+#ifdef XED_HAVE_IO_URING
+    if (async->uring)
+    {
+        XedAsyncUringQueue(async, request);                 // (Passed to the kernel when polled)
+        return XED_OK;
+    }
+#endif
+
+    XedMutexLock(&async->mutex);
+    if (async->pendingTail != NULL) { async->pendingTail->_next = request; } else { async->pending = request; }
+    async->pendingTail = request;
+    XedCondSignal(&async->submitted);
+    XedMutexUnlock(&async->mutex);
+    return XED_OK;
+}
+
+
+int XedPollCompletions(xed_async_t *async, int minCompletions)
+{
+    int count = 0;
+
+    if (async == NULL) { return XED_E_POINTER; }
+    if (minCompletions > async->outstanding) { minCompletions = async->outstanding; }
+
+#ifdef XED_HAVE_IO_URING
+    if (async->uring)
+    {
+        if (async->toSubmit > 0 && XedAsyncUringEnter(async, 0) != XED_OK) { return XED_E_FAIL; }
+        count += XedAsyncUringReap(async);
+        while (count < minCompletions)
+        {
+            if (XedAsyncUringEnter(async, 1) != XED_OK) { return XED_E_FAIL; }
+            count += XedAsyncUringReap(async);
+        }
+        return count;
+    }
+#endif
+
+    do
+    {
+        xed_async_request_t *list;
+
+        XedMutexLock(&async->mutex);
+        while (async->completed == NULL && count < minCompletions) { XedCondWait(&async->done, &async->mutex); }
+        list = async->completed;
+        async->completed = NULL;
+        XedMutexUnlock(&async->mutex);
+
+        while (list != NULL)
+        {
+            xed_async_request_t *request = list;
+            list = list->_next;
+            request->_next = NULL;
+            XedAsyncFinish(async, request);
+            count++;
+        }
+    } while (count < minCompletions);
+
+    return count;
+}
+
+
+int XedAsyncIsUring(xed_async_t *async)
+{
+    if (async == NULL) { return XED_E_POINTER; }
+    return async->uring;
+}
+
+
+int XedCloseAsync(xed_async_t *async)
+{
+    int i;
+
+    if (async == NULL) { return XED_E_POINTER; }
+
+    // Complete the outstanding reads
+    while (async->outstanding > 0 && XedPollCompletions(async, async->outstanding) >= 0) { ; }
+
+#ifdef XED_HAVE_IO_URING
+    if (async->uring)
+    {
+        XedAsyncUringDrain(async);
+        XedAsyncUringClose(async);
+        free(async);
+        return XED_OK;
+    }
+#endif
+
+    XedMutexLock(&async->mutex);
+    async->stop = 1;
+    XedCondBroadcast(&async->submitted);
+    XedMutexUnlock(&async->mutex);
+    for (i = 0; i < async->numThreads; i++) { XedThreadJoin(async->threads[i]); }
+
+    XedCondDestroy(&async->done);
+    XedCondDestroy(&async->submitted);
+    XedMutexDestroy(&async->mutex);
+    free(async->threads);
+    free(async);
+    return XED_OK;
+}
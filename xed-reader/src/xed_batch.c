@@ -0,0 +1,175 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Batched Reads -- a set of events read in file order, with nearby events merged into single vectored reads
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+
+
+#define XED_BATCH_MAX_GAP   (64 * 1024)             // Events this close are read together (the bytes between them are read and discarded)
+#define XED_BATCH_MAX_SPAN  (64 * 1024 * 1024)      // Largest single read
+#define XED_BATCH_MAX_IOV   1024                    // Buffers in a single read (each event needs up to three)
+#if defined(IOV_MAX) && IOV_MAX < XED_BATCH_MAX_IOV
+#undef XED_BATCH_MAX_IOV
+#define XED_BATCH_MAX_IOV   IOV_MAX
+#endif
+
+// A requested event
+typedef struct
+{
+    uint64_t offset;                // File offset of the event (the reading order)
+    uint64_t end;                   // File offset after the bytes needed (header, and the payload up to the buffer size)
+    size_t headerSize;              // 24, or 48 with frame information (from the index)
+    size_t payloadSize;             // From the index
+    int position;                   // Position in the request
+} xed_batch_item_t;
+
+
+static int XedBatchCompare(const void *a, const void *b)
+{
+    const xed_batch_item_t *itemA = (const xed_batch_item_t *)a;
+    const xed_batch_item_t *itemB = (const xed_batch_item_t *)b;
+    if (itemA->offset < itemB->offset) { return -1; }
+    if (itemA->offset > itemB->offset) { return 1; }
+    return itemA->position - itemB->position;
+}
+
+
+
+// Read several events of a stream, in file order, merging nearby events into single reads
+int XedReadEvents(xed_reader_t *reader, int stream, const int *indices, int count, xed_event_t *events, xed_frame_info_t *frameInfos, void **buffers, size_t bufferSize)
+{
+    xed_batch_item_t *items;
+    int *results;
+    int i, ret;
+
+    if (reader == NULL || (count > 0 && (indices == NULL || events == NULL || frameInfos == NULL))) { return XED_E_POINTER; }
+    if (count < 0) { return XED_E_INVALID_ARG; }
+    if (bufferSize > 0)
+    {
+        if (buffers == NULL) { return XED_E_POINTER; }
+        for (i = 0; i < count; i++) { if (buffers[i] == NULL) { return XED_E_POINTER; } }
+    }
+    if (count == 0) { return XED_OK; }
+
+    items = (xed_batch_item_t *)malloc(sizeof(xed_batch_item_t) * count);
+    results = (int *)malloc(sizeof(int) * count);
+    if (items == NULL || results == NULL) { free(items); free(results); return XED_E_OUT_OF_MEMORY; }
+
+    // Plan the reads from the index
+    for (i = 0; i < count; i++)
+    {
+        const xed_index_t *entry = XedGetIndexEntry(reader, stream, indices[i]);
+        if (entry == NULL) { free(items); free(results); return XED_E_INVALID_ARG; }
+        items[i].offset = entry->indexEntry.frameFileOffset;
+        items[i].headerSize = (entry->indexEntry.frameTimestamp != 0) ? 48 : 24;
+        items[i].payloadSize = entry->indexEntry.dataSize;
+        items[i].end = items[i].offset + items[i].headerSize + ((items[i].payloadSize < bufferSize) ? items[i].payloadSize : bufferSize);
+        items[i].position = i;
+        results[i] = XED_E_NOT_VALID_STATE;                 // (Not yet read)
+    }
+    qsort(items, count, sizeof(xed_batch_item_t), XedBatchCompare);
+
+#ifndef _WIN32
+    // Positional reads: each run of nearby events is one preadv() straight into the caller's buffers
+    if (reader->map == NULL)
+    {
+        unsigned char (*headers)[48] = (unsigned char (*)[48])malloc(48 * (size_t)count);
+        unsigned char *discard = (unsigned char *)malloc(XED_BATCH_MAX_GAP);
+        struct iovec *iov = (struct iovec *)malloc(sizeof(struct iovec) * XED_BATCH_MAX_IOV);
+        int first, last;
+
+        for (first = 0; headers != NULL && discard != NULL && iov != NULL && first < count; first = last)
+        {
+            uint64_t start = items[first].offset, end = start, readStart;
+            int64_t length;
+            int iovcnt = 0;
+
+            // Extend the run while the next event is close, does not overlap, and fits
+            for (last = first; last < count; last++)
+            {
+                const xed_batch_item_t *item = &items[last];
+                size_t payloadRead = (size_t)(item->end - item->offset - item->headerSize);
+                if (last > first && (item->offset < end || item->offset - end > XED_BATCH_MAX_GAP || item->end - start > XED_BATCH_MAX_SPAN || iovcnt + 3 > XED_BATCH_MAX_IOV)) { break; }
+                if (item->offset > end) { iov[iovcnt].iov_base = discard; iov[iovcnt].iov_len = (size_t)(item->offset - end); iovcnt++; }
+                iov[iovcnt].iov_base = headers[item->position]; iov[iovcnt].iov_len = item->headerSize; iovcnt++;
+                if (payloadRead > 0) { iov[iovcnt].iov_base = buffers[item->position]; iov[iovcnt].iov_len = payloadRead; iovcnt++; }
+                end = item->end;
+            }
+
+            readStart = XedStatsClock();
+            length = XedReadVectorAt(reader, start, iov, iovcnt);
+            XedStatsAdd(reader, payloadTime, XedStatsClock() - readStart);
+            if (length != (int64_t)(end - start)) { continue; }     // (Read individually below, to find the error)
+
+            // Decode the headers, checking they agree with the index
+            readStart = XedStatsClock();
+            for (i = first; i < last; i++)
+            {
+                const xed_batch_item_t *item = &items[i];
+                size_t headerSize, payloadSize;
+                ret = XedParseEventHeader(reader, headers[item->position], item->headerSize, &events[item->position], &frameInfos[item->position], &headerSize, &payloadSize);
+                if (ret == XED_OK && headerSize == item->headerSize && payloadSize == item->payloadSize) { results[item->position] = XED_OK; }
+            }
+            XedStatsAdd(reader, metadataTime, XedStatsClock() - readStart);
+        }
+
+        free(headers);
+        free(discard);
+        free(iov);
+    }
+#endif
+
+    // Anything not read above (a mapped reader, an event that does not match its index entry, or an error) is read individually, in file order
+    for (i = 0; i < count; i++)
+    {
+        int position = items[i].position;
+        if (results[position] == XED_OK) { continue; }
+        results[position] = XedReadEvent(reader, stream, indices[position], &events[position], &frameInfos[position], (bufferSize > 0) ? buffers[position] : NULL, bufferSize);
+    }
+
+    // The first error, in request order
+    ret = XED_OK;
+    for (i = 0; i < count && ret == XED_OK; i++) { ret = results[i]; }
+
+    free(items);
+    free(results);
+    return ret;
+}
@@ -0,0 +1,981 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED File Format Parser Benchmarks -- open, index, read throughput, batched reads, random-access latency, asynchronous reads and depth kernels
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "xed/xed.h"
+#include "xed/depth.h"
+#include "xed/archive.h"
+
+
+// Synthetic file configuration
+typedef struct
+{
+    const char *filename;
+    int numStreams;                 // Number of streams
+    int numEvents;                  // Frame events per stream (excluding the initial/empty events)
+    int frameSize;                  // Payload bytes per frame
+    int frameWidth;                 // Frame information dimensions (with frameSize = width * height * 2, stream 0 has depth frames of a changing scene)
+    int frameHeight;
+    int maxIndexEntries;            // Entries per xed_stream_index_t block
+    int frameInfoSize;              // Frame information per index entry (24, or 0 as in trimmed files)
+} bench_config_t;
+
+
+// Monotonic time in seconds
+static double BenchTime(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+#endif
+}
+
+// Result output (CSV: benchmark,variant,metric,value,unit)
+static void BenchResult(const char *benchmark, const char *variant, const char *metric, double value, const char *unit)
+{
+    printf("%s,%s,%s,%.6g,%s\n", benchmark, variant, metric, value, unit);
+    fflush(stdout);
+}
+
+
+// Little-endian writers that keep track of the file offset
+static uint64_t genOffset;
+static void put_bytes(FILE *fp, const void *data, size_t length) { fwrite(data, 1, length, fp); genOffset += length; }
+static void put_uint16(FILE *fp, uint16_t v) { unsigned char b[2]; b[0] = (unsigned char)v; b[1] = (unsigned char)(v >> 8); put_bytes(fp, b, 2); }
+static void put_uint32(FILE *fp, uint32_t v) { unsigned char b[4]; b[0] = (unsigned char)v; b[1] = (unsigned char)(v >> 8); b[2] = (unsigned char)(v >> 16); b[3] = (unsigned char)(v >> 24); put_bytes(fp, b, 4); }
+static void put_uint64(FILE *fp, uint64_t v) { put_uint32(fp, (uint32_t)v); put_uint32(fp, (uint32_t)(v >> 32)); }
+static void put_uint16_be(unsigned char *p, uint16_t v) { p[0] = (unsigned char)(v >> 8); p[1] = (unsigned char)v; }
+static void put_uint32_be(unsigned char *p, uint32_t v) { p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16); p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v; }
+
+static void put_event(FILE *fp, int stream, uint32_t length, uint64_t timestamp)
+{
+    put_uint16(fp, (uint16_t)stream); put_uint16(fp, 0); put_uint32(fp, length); put_uint64(fp, timestamp); put_uint32(fp, 0); put_uint32(fp, length);
+}
+
+// Generator state for a single stream
+typedef struct
+{
+    xed_index_entry_t *entries;     // Entries not yet written to an index block
+    unsigned char (*frameInfo)[24];
+    int pending;
+    int total;
+    uint64_t *indexOffsets;
+    int numIndexes;
+    xed_index_entry_t event0, event1;
+} bench_stream_t;
+
+// Emit an index block for the pending entries
+static void GenFlushIndex(FILE *fp, const bench_config_t *config, bench_stream_t *s)
+{
+    int k;
+    s->indexOffsets[s->numIndexes++] = genOffset;
+    put_uint16(fp, 0xffff); put_uint16(fp, 0); put_uint32(fp, s->pending); put_uint32(fp, 0); put_uint32(fp, 0); put_uint32(fp, 0); put_uint32(fp, 0);
+    for (k = 0; k < s->pending; k++)
+    {
+        put_uint64(fp, s->entries[k].frameFileOffset); put_uint64(fp, s->entries[k].frameTimestamp); put_uint32(fp, s->entries[k].dataSize); put_uint32(fp, s->entries[k].dataSize2);
+    }
+    if (config->frameInfoSize > 0) { put_bytes(fp, s->frameInfo, (size_t)s->pending * 24); }
+    s->pending = 0;
+}
+
+static void GenAddEntry(FILE *fp, const bench_config_t *config, bench_stream_t *s, uint64_t offset, uint64_t timestamp, uint32_t size, const unsigned char *frameInfo)
+{
+    s->entries[s->pending].frameFileOffset = offset;
+    s->entries[s->pending].frameTimestamp = timestamp;
+    s->entries[s->pending].dataSize = size;
+    s->entries[s->pending].dataSize2 = size;
+    if (frameInfo != NULL) { memcpy(s->frameInfo[s->pending], frameInfo, 24); } else { memset(s->frameInfo[s->pending], 0, 24); }
+    if (s->total == 0) { s->event0 = s->entries[s->pending]; }
+    if (s->total == 1) { s->event1 = s->entries[s->pending]; }
+    s->pending++;
+    s->total++;
+
+    // Emit an index block when full
+    if (s->pending >= config->maxIndexEntries) { GenFlushIndex(fp, config, s); }
+}
+
+// Depth-like frame (big-endian 12-bit values): a sloping background, and a block that moves across it from frame to frame
+static void GenDepthFrame(unsigned char *payload, int width, int height, int frame)
+{
+    int left = (frame * 8) % width, top = height / 3;
+    int x, y;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            int inside = (x >= left && x < left + width / 4 && y >= top && y < top + height / 3);
+            uint16_t v = (uint16_t)(inside ? 1500 + (x & 3) : 800 + y * 2000 / height + ((x * 7 + y) & 3));
+            unsigned char *p = payload + 2 * ((size_t)y * width + x);
+            p[0] = (unsigned char)(v >> 8); p[1] = (unsigned char)v;
+        }
+    }
+}
+
+// Write a synthetic EVENTS1 file: initial/empty events, interleaved frames, periodic and closing indexes, end of file information
+static int BenchGenerate(const bench_config_t *config)
+{
+    FILE *fp;
+    bench_stream_t *streams;
+    unsigned char *payload;
+    unsigned char initialData[292] = {0};
+    uint64_t timestamp = 11842000000ULL, indexFileOffset;
+    int depthFrames = (config->frameHeight > 1 && (size_t)config->frameWidth * config->frameHeight * 2 == (size_t)config->frameSize);
+    int i, s;
+
+    fp = fopen(config->filename, "wb");
+    if (fp == NULL) { fprintf(stderr, "ERROR: Cannot create synthetic file: %s\n", config->filename); return -1; }
+    setvbuf(fp, NULL, _IOFBF, 4 * 1024 * 1024);
+
+    streams = (bench_stream_t *)calloc(config->numStreams, sizeof(bench_stream_t));
+    payload = (unsigned char *)malloc(config->frameSize + 1);
+    if (streams == NULL || payload == NULL) { fclose(fp); return -1; }
+    for (s = 0; s < config->numStreams; s++)
+    {
+        int maxIndexes = (config->numEvents + 2) / config->maxIndexEntries + 2;
+        streams[s].entries = (xed_index_entry_t *)malloc(sizeof(xed_index_entry_t) * config->maxIndexEntries);
+        streams[s].frameInfo = (unsigned char (*)[24])malloc(24 * (size_t)config->maxIndexEntries);
+        streams[s].indexOffsets = (uint64_t *)malloc(sizeof(uint64_t) * maxIndexes);
+        if (streams[s].entries == NULL || streams[s].frameInfo == NULL || streams[s].indexOffsets == NULL) { fclose(fp); return -1; }
+    }
+
+    // Depth-like payload: big-endian 12-bit gradient
+    for (i = 0; i + 1 < config->frameSize; i += 2)
+    {
+        uint16_t v = (uint16_t)(800 + (i / 2) % 3300);
+        payload[i] = (unsigned char)(v >> 8); payload[i + 1] = (unsigned char)v;
+    }
+
+    // File header (index offset written at the end)
+    genOffset = 0;
+    put_bytes(fp, "EVENTS1", 8); put_uint32(fp, 3); put_uint32(fp, config->numStreams); put_uint64(fp, 0);
+
+    // Initial and empty events for each stream
+    initialData[282] = (unsigned char)config->frameInfoSize;
+    initialData[284] = (unsigned char)config->maxIndexEntries; initialData[285] = (unsigned char)(config->maxIndexEntries >> 8); initialData[286] = (unsigned char)(config->maxIndexEntries >> 16);
+    for (s = 0; s < config->numStreams; s++)
+    {
+        uint64_t offset = genOffset;
+        initialData[0] = (unsigned char)s;
+        put_event(fp, s, sizeof(initialData), 0); put_bytes(fp, initialData, sizeof(initialData));
+        GenAddEntry(fp, config, &streams[s], offset, 0, sizeof(initialData), NULL);
+        offset = genOffset;
+        put_event(fp, s, 0, 0);
+        GenAddEntry(fp, config, &streams[s], offset, 0, 0, NULL);
+    }
+
+    // Frames, interleaved between streams
+    for (i = 0; i < config->numEvents; i++)
+    {
+        for (s = 0; s < config->numStreams; s++)
+        {
+            unsigned char frameInfo[24] = {0};
+            uint64_t offset = genOffset;
+            uint64_t eventTime;
+            timestamp += 33333 / config->numStreams;
+            eventTime = timestamp - (uint64_t)s * 100000;   // Each stream's clock 100 ms behind the previous one, so the timestamps are not in file order across streams
+            put_uint16_be(frameInfo + 0, 1); put_uint16_be(frameInfo + 4, 1); put_uint16_be(frameInfo + 6, 1);
+            put_uint16_be(frameInfo + 8, (uint16_t)config->frameWidth); put_uint16_be(frameInfo + 10, (uint16_t)config->frameHeight);
+            if (depthFrames && s == 0) { GenDepthFrame(payload, config->frameWidth, config->frameHeight, i); }
+            put_uint32_be(frameInfo + 12, (uint32_t)i); put_uint32_be(frameInfo + 20, (uint32_t)eventTime);
+            put_event(fp, s, config->frameSize, eventTime); put_bytes(fp, frameInfo, 24); put_bytes(fp, payload, config->frameSize);
+            GenAddEntry(fp, config, &streams[s], offset, eventTime, config->frameSize, frameInfo);
+        }
+    }
+
+    // Closing indexes
+    for (s = 0; s < config->numStreams; s++)
+    {
+        if (streams[s].pending > 0) { GenFlushIndex(fp, config, &streams[s]); }
+    }
+
+    // End of file information
+    indexFileOffset = genOffset;
+    put_uint16(fp, (uint16_t)config->numStreams);
+    for (s = 0; s < config->numStreams; s++)
+    {
+        static const unsigned char zero[48] = {0};
+        bench_stream_t *st = &streams[s];
+        put_uint16(fp, 0xffff); put_uint16(fp, 0xffff); put_uint16(fp, (uint16_t)s); put_uint16(fp, (uint16_t)config->frameInfoSize);
+        put_uint32(fp, st->total); put_uint32(fp, config->frameSize); put_uint32(fp, config->maxIndexEntries); put_uint32(fp, st->numIndexes);
+        put_uint64(fp, st->event0.frameFileOffset); put_uint64(fp, 0); put_uint32(fp, st->event0.dataSize); put_uint32(fp, st->event0.dataSize2);
+        put_uint64(fp, st->event1.frameFileOffset); put_uint64(fp, 0); put_uint32(fp, 0); put_uint32(fp, 0);
+        put_bytes(fp, zero, 48);    // _unknownEvent0/1
+        if (config->frameInfoSize > 0) { put_bytes(fp, zero, 48); }    // frame information for event 0/1
+        for (i = 0; i < st->numIndexes; i++) { put_uint64(fp, st->indexOffsets[i]); }
+        put_uint32(fp, 0);
+        free(st->entries); free(st->frameInfo); free(st->indexOffsets);
+    }
+    fseek(fp, 16, SEEK_SET);
+    put_uint64(fp, indexFileOffset);
+
+    free(streams);
+    free(payload);
+    if (fclose(fp) != 0) { return -1; }
+    return 0;
+}
+
+
+// Benchmark: time to open a file and build the index
+static int BenchOpen(const bench_config_t *config, int repeat)
+{
+    static const char *variants[] = { "buffered", "mapped", "cached", "stream0" };
+    static const int flags[] = { 0, XED_READER_MAPPED, XED_READER_INDEX_CACHE, 0 };
+    static const uint32_t streamMasks[] = { XED_STREAM_MASK_ALL, XED_STREAM_MASK_ALL, XED_STREAM_MASK_ALL, 0x01 };    // stream0: a depth-only job (only stream 0 is indexed, and no global index)
+    char cacheFilename[256];
+    int v;
+
+    // The first cached open writes the cache
+    sprintf(cacheFilename, "%.250s.idx", config->filename);
+    remove(cacheFilename);
+    XedCloseReader(XedNewReaderEx(config->filename, XED_STREAM_MASK_ALL, XED_READER_INDEX_CACHE));
+
+    for (v = 0; v < 4; v++)
+    {
+        const char *variant = variants[v];
+        double best = -1, total = 0;
+        int r, events = 0;
+        for (r = 0; r < repeat; r++)
+        {
+            double start = BenchTime(), elapsed;
+            struct xed_reader *reader = XedNewReaderEx(config->filename, streamMasks[v], flags[v]);
+            if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); return -1; }
+            if (streamMasks[v] == XED_STREAM_MASK_ALL) { events = XedGetNumEvents(reader, XED_STREAM_ALL); }
+            else if (XedGetIndexEntry(reader, 0, 0) != NULL) { events = XedGetNumEvents(reader, 0); }     // (Loads the stream index)
+            XedCloseReader(reader);
+            elapsed = BenchTime() - start;
+            total += elapsed;
+            if (best < 0 || elapsed < best) { best = elapsed; }
+        }
+        BenchResult("open", variant, "events", events, "count");
+        BenchResult("open", variant, "best", best * 1000.0, "ms");
+        BenchResult("open", variant, "mean", total * 1000.0 / repeat, "ms");
+        BenchResult("open", variant, "rate", events / best / 1.0e6, "Mentries/s");
+    }
+    remove(cacheFilename);
+    return 0;
+}
+
+
+// Benchmark walking the global index: in order, and in a pseudo-random order
+static int BenchIndex(const bench_config_t *config, int repeat)
+{
+    struct xed_reader *reader = XedNewReader(config->filename);
+    int events, random;
+    if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); return -1; }
+    events = XedGetNumEvents(reader, XED_STREAM_ALL);
+    for (random = 0; random <= 1 && events > 0; random++)
+    {
+        const char *variant = random ? "random" : "sequential";
+        double best = -1;
+        uint64_t check = 0;
+        int r, i;
+        for (r = 0; r < repeat; r++)
+        {
+            double start = BenchTime(), elapsed;
+            uint32_t index = 0;
+            for (i = 0; i < events; i++)
+            {
+                const xed_index_t *entry;
+                if (random) { index = (index * 1664525u + 1013904223u); entry = XedGetIndexEntry(reader, XED_STREAM_ALL, (int)(index % (uint32_t)events)); }
+                else { entry = XedGetIndexEntry(reader, XED_STREAM_ALL, i); }
+                check += entry->indexEntry.frameFileOffset;
+            }
+            elapsed = BenchTime() - start;
+            if (best < 0 || elapsed < best) { best = elapsed; }
+        }
+        if (check == 0) { fprintf(stderr, "WARNING: Unexpected index contents.\n"); }
+        BenchResult("index", variant, "best", best * 1000.0, "ms");
+        BenchResult("index", variant, "rate", events / best / 1.0e6, "Mentries/s");
+    }
+    XedCloseReader(reader);
+    return 0;
+}
+
+// The expected result of a timestamp seek on the global index, by a linear scan (ties: the first event at or after in file order, the last at or before)
+static int BenchSeekScan(struct xed_reader *reader, int events, uint64_t timestamp, int mode)
+{
+    uint64_t floorTime = 0, ceilTime = 0;
+    int floorIndex = -1, ceilIndex = -1;
+    int i;
+    for (i = 0; i < events; i++)
+    {
+        uint64_t t = XedGetIndexEntry(reader, XED_STREAM_ALL, i)->indexEntry.frameTimestamp;
+        if (t == 0) { continue; }
+        if (t <= timestamp && (floorIndex < 0 || t >= floorTime)) { floorIndex = i; floorTime = t; }
+        if (t >= timestamp && (ceilIndex < 0 || t < ceilTime)) { ceilIndex = i; ceilTime = t; }
+    }
+    if (mode == XED_FIND_NEAREST && floorIndex >= 0 && ceilIndex >= 0) { return (ceilTime - timestamp == 0 || ceilTime - timestamp < timestamp - floorTime) ? ceilIndex : floorIndex; }
+    if (mode == XED_FIND_FLOOR || (mode == XED_FIND_NEAREST && floorIndex >= 0)) { return (floorIndex >= 0) ? floorIndex : XED_E_NOT_FOUND; }
+    return (ceilIndex >= 0) ? ceilIndex : XED_E_NOT_FOUND;
+}
+
+// Benchmark timestamp seeks over all streams (XedFindEventByTime on the global index), first checking a sample of seeks against a linear scan
+static int BenchSeek(const bench_config_t *config, int samples, int repeat)
+{
+    static const char *variants[] = { "nearest", "floor", "ceil" };
+    static const int modes[] = { XED_FIND_NEAREST, XED_FIND_FLOOR, XED_FIND_CEIL };
+    const int checks = 100;
+    struct xed_reader *reader = XedNewReader(config->filename);
+    uint64_t minTime = 0, maxTime = 0, span;
+    int events, v, i;
+
+    if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); return -1; }
+    events = XedGetNumEvents(reader, XED_STREAM_ALL);
+    for (i = 0; i < events; i++)
+    {
+        uint64_t t = XedGetIndexEntry(reader, XED_STREAM_ALL, i)->indexEntry.frameTimestamp;
+        if (t == 0) { continue; }
+        if (minTime == 0 || t < minTime) { minTime = t; }
+        if (t > maxTime) { maxTime = t; }
+    }
+    if (minTime == 0) { XedCloseReader(reader); return 0; }
+    span = maxTime - minTime + 2000;                        // (Includes seeks just outside the recording)
+
+    for (v = 0; v < 3; v++)
+    {
+        double best = -1;
+        uint32_t seed = 1;
+        int r, differ = 0;
+
+        for (i = 0; i < checks; i++)
+        {
+            uint64_t timestamp;
+            seed = seed * 1664525u + 1013904223u;
+            timestamp = minTime - 1000 + (uint64_t)seed % span;
+            if (XedFindEventByTime(reader, XED_STREAM_ALL, timestamp, modes[v]) != BenchSeekScan(reader, events, timestamp, modes[v])) { differ++; }
+        }
+        if (differ > 0) { fprintf(stderr, "ERROR: %d of %d seeks (%s) differ from a linear scan.\n", differ, checks, variants[v]); XedCloseReader(reader); return -1; }
+
+        for (r = 0; r < repeat; r++)
+        {
+            double start = BenchTime(), elapsed;
+            for (i = 0; i < samples; i++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                XedFindEventByTime(reader, XED_STREAM_ALL, minTime - 1000 + (uint64_t)seed % span, modes[v]);
+            }
+            elapsed = BenchTime() - start;
+            if (best < 0 || elapsed < best) { best = elapsed; }
+        }
+        if (best <= 0) { best = 1e-9; }
+        BenchResult("seek", variants[v], "mean", best * 1.0e6 / samples, "us");
+        BenchResult("seek", variants[v], "rate", samples / best / 1.0e6, "Mseeks/s");
+    }
+
+    XedCloseReader(reader);
+    return 0;
+}
+
+// Benchmark reading every event in file order: copied (XedReadEvent) from a buffered, a mapped and a direct I/O reader, and zero-copy (XedMapEvent) from a mapped reader
+static int BenchRead(const bench_config_t *config, int repeat)
+{
+    static const char *variants[] = { "buffered", "mapped", "mapped-view", "direct" };
+    static const int flags[] = { 0, XED_READER_MAPPED, XED_READER_MAPPED, XED_READER_DIRECT };
+    unsigned char *buffer;
+    int v;
+
+    buffer = (unsigned char *)malloc(config->frameSize + 1);
+    if (buffer == NULL) { return -1; }
+
+    for (v = 0; v < 4; v++)
+    {
+        const char *variant = variants[v];
+        struct xed_reader *reader = XedNewReaderEx(config->filename, XED_STREAM_MASK_ALL, flags[v]);
+        double best = -1, bytes = 0;
+        int events, frames = 0;
+        int r, i;
+        if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); free(buffer); return -1; }
+        events = XedGetNumEvents(reader, XED_STREAM_ALL);
+        for (r = 0; r < repeat; r++)
+        {
+            double start = BenchTime(), elapsed;
+            bytes = 0;
+            frames = 0;
+            for (i = 0; i < events; i++)
+            {
+                int ret;
+                if (v == 2)
+                {
+                    xed_event_view_t view;
+                    ret = XedMapEvent(reader, XED_STREAM_ALL, i, &view);
+                    if (ret == XED_OK) { bytes += view.length; if (view.event.timestamp != 0) { frames++; } XedUnmapEvent(reader, &view); }
+                }
+                else
+                {
+                    xed_event_t event;
+                    xed_frame_info_t frameInfo;
+                    ret = XedReadEvent(reader, XED_STREAM_ALL, i, &event, &frameInfo, buffer, config->frameSize + 1);
+                    if (ret == XED_OK) { bytes += event.length; if (event.timestamp != 0) { frames++; } }
+                }
+                if (ret != XED_OK) { fprintf(stderr, "ERROR: Problem reading event %d (%d).\n", i, ret); XedCloseReader(reader); free(buffer); return -1; }
+            }
+            elapsed = BenchTime() - start;
+            if (best < 0 || elapsed < best) { best = elapsed; }
+        }
+        XedCloseReader(reader);
+        if (best <= 0) { best = 1e-9; }
+        BenchResult("read", variant, "best", best * 1000.0, "ms");
+        BenchResult("read", variant, "throughput", bytes / best / 1048576.0, "MB/s");
+        BenchResult("read", variant, "frames", frames / best, "frames/s");
+    }
+
+    free(buffer);
+    return 0;
+}
+
+// Benchmark reading a selection of one stream's events (every 4th), one XedReadEvent call each, and as one XedReadEvents batch
+static int BenchBatch(const bench_config_t *config, int repeat)
+{
+    struct xed_reader *reader = XedNewReader(config->filename);
+    xed_event_t *events;
+    xed_frame_info_t *frameInfos;
+    unsigned char *buffer;
+    void **buffers;
+    int *indices;
+    int count, numEvents, batched, i;
+
+    if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); return -1; }
+    numEvents = XedGetNumEvents(reader, 0);
+    if (numEvents <= 0 || XedGetIndexEntry(reader, 0, 0) == NULL) { XedCloseReader(reader); return 0; }     // (Loads the stream index)
+    count = (numEvents + 3) / 4;
+    indices = (int *)malloc(sizeof(int) * (count + 1));
+    events = (xed_event_t *)malloc(sizeof(xed_event_t) * (count + 1));
+    frameInfos = (xed_frame_info_t *)malloc(sizeof(xed_frame_info_t) * (count + 1));
+    buffers = (void **)malloc(sizeof(void *) * (count + 1));
+    buffer = (unsigned char *)malloc((size_t)(count + 1) * (config->frameSize + 1));
+    if (indices == NULL || events == NULL || frameInfos == NULL || buffers == NULL || buffer == NULL) { free(indices); free(events); free(frameInfos); free(buffers); free(buffer); XedCloseReader(reader); return -1; }
+    for (i = 0; i < count; i++)
+    {
+        indices[i] = i * 4;
+        buffers[i] = buffer + (size_t)i * (config->frameSize + 1);
+    }
+
+    for (batched = 0; batched <= 1 && count > 0; batched++)
+    {
+        const char *variant = batched ? "batched" : "single";
+        xed_reader_stats_t before, after;
+        double best = -1;
+        int r;
+        XedGetStats(reader, &before);
+        for (r = 0; r < repeat; r++)
+        {
+            double start = BenchTime(), elapsed;
+            int ret = XED_OK;
+            if (batched) { ret = XedReadEvents(reader, 0, indices, count, events, frameInfos, buffers, config->frameSize + 1); }
+            else { for (i = 0; i < count && ret == XED_OK; i++) { ret = XedReadEvent(reader, 0, indices[i], &events[i], &frameInfos[i], buffers[i], config->frameSize + 1); } }
+            elapsed = BenchTime() - start;
+            if (ret != XED_OK) { fprintf(stderr, "ERROR: Problem reading events (%d).\n", ret); break; }
+            if (best < 0 || elapsed < best) { best = elapsed; }
+        }
+        XedGetStats(reader, &after);
+        if (best <= 0) { best = 1e-9; }
+        BenchResult("batch", variant, "best", best * 1000.0, "ms");
+        BenchResult("batch", variant, "frames", count / best, "frames/s");
+        BenchResult("batch", variant, "reads", (double)(after.reads - before.reads) / repeat, "count");
+    }
+
+    free(indices); free(events); free(frameInfos); free(buffers); free(buffer);
+    XedCloseReader(reader);
+    return 0;
+}
+
+
+static int BenchCompareDouble(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+// Benchmark the latency of reading single events (XedReadEvent) in a pseudo-random order, as percentiles
+static int BenchLatency(const bench_config_t *config, int samples)
+{
+    static const char *variants[] = { "buffered", "mapped" };
+    static const int flags[] = { 0, XED_READER_MAPPED };
+    unsigned char *buffer;
+    double *latency;
+    int v;
+
+    buffer = (unsigned char *)malloc(config->frameSize + 1);
+    latency = (double *)malloc(sizeof(double) * samples);
+    if (buffer == NULL || latency == NULL) { free(buffer); free(latency); return -1; }
+
+    for (v = 0; v < 2; v++)
+    {
+        const char *variant = variants[v];
+        struct xed_reader *reader = XedNewReaderEx(config->filename, XED_STREAM_MASK_ALL, flags[v]);
+        uint32_t index = 12345;
+        int events, i;
+        if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); free(buffer); free(latency); return -1; }
+        events = XedGetNumEvents(reader, XED_STREAM_ALL);
+        for (i = 0; i < samples && events > 0; i++)
+        {
+            xed_event_t event;
+            xed_frame_info_t frameInfo;
+            double start;
+            index = (index * 1664525u + 1013904223u);
+            start = BenchTime();
+            if (XedReadEvent(reader, XED_STREAM_ALL, (int)(index % (uint32_t)events), &event, &frameInfo, buffer, config->frameSize + 1) != XED_OK) { fprintf(stderr, "ERROR: Problem reading event.\n"); break; }
+            latency[i] = BenchTime() - start;
+        }
+        XedCloseReader(reader);
+        if (i == 0) { continue; }
+
+        qsort(latency, i, sizeof(double), BenchCompareDouble);
+        BenchResult("latency", variant, "samples", i, "count");
+        BenchResult("latency", variant, "p50", latency[i * 50 / 100] * 1.0e6, "us");
+        BenchResult("latency", variant, "p90", latency[i * 90 / 100] * 1.0e6, "us");
+        BenchResult("latency", variant, "p99", latency[i * 99 / 100] * 1.0e6, "us");
+        BenchResult("latency", variant, "max", latency[i - 1] * 1.0e6, "us");
+    }
+
+    free(buffer);
+    free(latency);
+    return 0;
+}
+
+// Asynchronous read requests available for reuse
+typedef struct
+{
+    xed_async_request_t **free;
+    int numFree;
+} bench_async_pool_t;
+
+static void BenchAsyncCompleted(xed_async_request_t *request)
+{
+    bench_async_pool_t *pool = (bench_async_pool_t *)request->userData;
+    if (request->result != XED_OK) { fprintf(stderr, "ERROR: Problem reading event %d (%d).\n", request->index, request->result); }
+    pool->free[pool->numFree++] = request;
+}
+
+// Benchmark random-access reads with many outstanding (io_uring, or the thread pool), against one blocking XedReadEvent at a time
+static int BenchAsync(const bench_config_t *config, int samples, int repeat)
+{
+    static const char *variants[] = { "sync", "uring", "threads" };
+    const int depth = 32;
+    struct xed_reader *reader = XedNewReader(config->filename);
+    xed_async_request_t *requests;
+    bench_async_pool_t pool;
+    unsigned char *buffers;
+    int events, v, i;
+
+    if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); return -1; }
+    events = XedGetNumEvents(reader, XED_STREAM_ALL);
+    requests = (xed_async_request_t *)calloc(depth, sizeof(xed_async_request_t));
+    pool.free = (xed_async_request_t **)malloc(sizeof(xed_async_request_t *) * depth);
+    buffers = (unsigned char *)malloc((size_t)depth * (config->frameSize + 1));
+    if (requests == NULL || pool.free == NULL || buffers == NULL) { free(requests); free(pool.free); free(buffers); XedCloseReader(reader); return -1; }
+
+    for (v = 0; v < 3 && events > 0; v++)
+    {
+        struct xed_async *async = NULL;
+        double best = -1;
+        int r;
+
+        if (v > 0)
+        {
+            async = XedNewAsync(reader, depth, (v == 2) ? XED_ASYNC_THREADS : 0);
+            if (async == NULL) { fprintf(stderr, "ERROR: Problem starting asynchronous reads.\n"); break; }
+            if (v == 1 && !XedAsyncIsUring(async)) { XedCloseAsync(async); continue; }     // (Not available)
+        }
+        for (r = 0; r < repeat; r++)
+        {
+            double start = BenchTime(), elapsed;
+            uint32_t index = 12345;
+            pool.numFree = 0;
+            for (i = 0; i < depth; i++)
+            {
+                requests[i].buffer = buffers + (size_t)i * (config->frameSize + 1);
+                requests[i].bufferSize = config->frameSize + 1;
+                requests[i].callback = BenchAsyncCompleted;
+                requests[i].userData = &pool;
+                pool.free[pool.numFree++] = &requests[i];
+            }
+            for (i = 0; i < samples; i++)
+            {
+                index = (index * 1664525u + 1013904223u);
+                if (async == NULL)
+                {
+                    xed_event_t event;
+                    xed_frame_info_t frameInfo;
+                    XedReadEvent(reader, XED_STREAM_ALL, (int)(index % (uint32_t)events), &event, &frameInfo, buffers, config->frameSize + 1);
+                }
+                else
+                {
+                    xed_async_request_t *request;
+                    if (pool.numFree == 0) { XedPollCompletions(async, 1); }
+                    request = pool.free[--pool.numFree];
+                    request->stream = XED_STREAM_ALL;
+                    request->index = (int)(index % (uint32_t)events);
+                    XedSubmitRead(async, request);                  // (Queued reads are passed to the kernel together when polled)
+                }
+            }
+            if (async != NULL) { XedPollCompletions(async, depth); }
+            elapsed = BenchTime() - start;
+            if (best < 0 || elapsed < best) { best = elapsed; }
+        }
+        if (async != NULL) { XedCloseAsync(async); }
+        if (best <= 0) { best = 1e-9; }
+        BenchResult("async", variants[v], "best", best * 1000.0, "ms");
+        BenchResult("async", variants[v], "rate", samples / best, "reads/s");
+    }
+
+    free(requests);
+    free(pool.free);
+    free(buffers);
+    XedCloseReader(reader);
+    return 0;
+}
+
+
+// Benchmark the depth kernels on a synthetic 640x480 frame, at each available SIMD level
+static int BenchDepth(int repeat)
+{
+    static const char *levels[] = { "scalar", "sse2", "avx2" };
+    const int width = 640, height = 480, iterations = 100;
+    const size_t pixels = (size_t)width * height;
+    unsigned char *src;
+    uint16_t *depth;
+    uint32_t *rgba;
+    xed_depth_colormap_t colormap555, colormap32;
+    size_t i;
+    int level;
+
+    src = (unsigned char *)malloc(pixels * 2);
+    depth = (uint16_t *)malloc(pixels * sizeof(uint16_t));
+    rgba = (uint32_t *)malloc(pixels * sizeof(uint32_t));
+    if (src == NULL || depth == NULL || rgba == NULL) { free(src); free(depth); free(rgba); return -1; }
+    XedDepthColormapInit(&colormap555, XED_PIXEL_RGB555, 850, 4000, XED_PALETTE_HUE);
+    XedDepthColormapInit(&colormap32, XED_PIXEL_RGBA32, 850, 4000, XED_PALETTE_HUE);
+
+    // Big-endian depth with player index bits, as a Kinect depth frame
+    for (i = 0; i < pixels; i++)
+    {
+        uint16_t v = (uint16_t)(((i % 7) << 12) | (800 + (i * 13) % 3300));
+        src[2 * i] = (unsigned char)(v >> 8); src[2 * i + 1] = (unsigned char)v;
+    }
+
+    for (level = XED_SIMD_NONE; level <= XED_SIMD_AVX2; level++)
+    {
+        int kernel;
+        if (XedDepthSetSimdLevel(level) != level) { continue; }     // (Not available)
+        for (kernel = 0; kernel < 3; kernel++)
+        {
+            static const char *kernels[] = { "unpack", "colorize-rgb555", "colorize-rgba32" };
+            char variant[64];
+            double best = -1;
+            int r, n;
+            for (r = 0; r < repeat; r++)
+            {
+                double start = BenchTime(), elapsed;
+                for (n = 0; n < iterations; n++)
+                {
+                    if (kernel == 0) { XedUnpackDepth(src, depth, pixels, 0); }
+                    else if (kernel == 1) { XedDepthColorize(&colormap555, src, width * 2, depth, width * 2, width, height); }
+                    else { XedDepthColorize(&colormap32, src, width * 2, rgba, width * 4, width, height); }
+                }
+                elapsed = BenchTime() - start;
+                if (best < 0 || elapsed < best) { best = elapsed; }
+            }
+            if (best <= 0) { best = 1e-9; }
+            sprintf(variant, "%s-%s", kernels[kernel], levels[level]);
+            BenchResult("depth", variant, "frame", best * 1.0e6 / iterations, "us");
+            BenchResult("depth", variant, "rate", (double)pixels * iterations / best / 1.0e6, "Mpixels/s");
+        }
+    }
+    XedDepthSetSimdLevel(XED_SIMD_AVX2);
+
+    free(src);
+    free(depth);
+    free(rgba);
+    return 0;
+}
+
+
+// Benchmark the depth archive on a synthetic 640x480 depth recording: creating it (XedArchiveCreate), and decoding every frame in order, with and without temporal frames
+static int BenchArchive(const bench_config_t *config, int repeat)
+{
+    static const char *variants[] = { "temporal", "key-only" };
+    static const int flags[] = { XED_ARCHIVE_TEMPORAL, 0 };
+    bench_config_t depth = *config;
+    char depthFilename[256], archiveFilename[256];
+    unsigned char *buffer;
+    double inputBytes;
+    int v, ret = 0;
+
+    sprintf(depthFilename, "%.240s.depth.xed", config->filename);
+    sprintf(archiveFilename, "%.240s.xdz", config->filename);
+    depth.filename = depthFilename;
+    depth.numStreams = 1;
+    depth.numEvents = 90;
+    depth.frameWidth = 640;
+    depth.frameHeight = 480;
+    depth.frameSize = depth.frameWidth * depth.frameHeight * 2;
+    inputBytes = (double)depth.numEvents * depth.frameSize;
+    buffer = (unsigned char *)malloc(depth.frameSize);
+    if (buffer == NULL || BenchGenerate(&depth) != 0) { fprintf(stderr, "ERROR: Problem generating synthetic depth file.\n"); free(buffer); return -1; }
+
+    for (v = 0; v < 2 && ret == 0; v++)
+    {
+        double bestEncode = -1, bestDecode = -1, archiveBytes = 0;
+        int r, frames = 0;
+        for (r = 0; r < repeat && ret == 0; r++)
+        {
+            struct xed_reader *reader = XedNewReader(depthFilename);
+            struct xed_archive *archive;
+            double start = BenchTime(), elapsed;
+            int i;
+
+            if (reader == NULL || XedArchiveCreate(reader, 0, archiveFilename, flags[v], XED_ARCHIVE_DEFAULT_KEY_INTERVAL) != XED_OK) { fprintf(stderr, "ERROR: Problem creating archive.\n"); XedCloseReader(reader); ret = -1; break; }
+            elapsed = BenchTime() - start;
+            XedCloseReader(reader);
+            if (bestEncode < 0 || elapsed < bestEncode) { bestEncode = elapsed; }
+
+            start = BenchTime();
+            archive = XedOpenArchive(archiveFilename);
+            frames = XedArchiveGetNumFrames(archive);
+            for (i = 0; i < frames; i++)
+            {
+                xed_event_t event;
+                xed_frame_info_t frameInfo;
+                if (XedArchiveReadFrame(archive, i, &event, &frameInfo, buffer, depth.frameSize) != XED_OK) { fprintf(stderr, "ERROR: Problem decoding archive frame %d.\n", i); ret = -1; break; }
+            }
+            XedCloseArchive(archive);
+            elapsed = BenchTime() - start;
+            if (archive == NULL || frames != depth.numEvents) { fprintf(stderr, "ERROR: Unexpected archive contents.\n"); ret = -1; }
+            if (bestDecode < 0 || elapsed < bestDecode) { bestDecode = elapsed; }
+        }
+        if (ret != 0) { break; }
+
+        {
+            FILE *fp = fopen(archiveFilename, "rb");
+            if (fp != NULL) { fseek(fp, 0, SEEK_END); archiveBytes = (double)ftell(fp); fclose(fp); }
+        }
+        if (bestEncode <= 0) { bestEncode = 1e-9; }
+        if (bestDecode <= 0) { bestDecode = 1e-9; }
+        BenchResult("archive", variants[v], "ratio", 100.0 * archiveBytes / inputBytes, "%");
+        BenchResult("archive", variants[v], "encode", inputBytes / bestEncode / 1048576.0, "MB/s");
+        BenchResult("archive", variants[v], "decode", inputBytes / bestDecode / 1048576.0, "MB/s");
+        BenchResult("archive", variants[v], "decode-frames", frames / bestDecode, "frames/s");
+    }
+
+    remove(archiveFilename);
+    remove(depthFilename);
+    free(buffer);
+    return ret;
+}
+
+
+// Check and benchmark index recovery (XED_READER_RECOVER) on a truncated copy of a synthetic file, with and without frame information in the index blocks:
+// the recovered index must match the original index for every event before the truncation (and the stream reader must find every event of the complete file)
+static int BenchRecover(const bench_config_t *config, int repeat)
+{
+    static const char *variants[] = { "frame-info", "trimmed" };
+    static const int frameInfoSizes[] = { 24, 0 };
+    bench_config_t recover = *config;
+    char recoverFilename[256], truncatedFilename[256];
+    int v, ret = 0;
+
+    sprintf(recoverFilename, "%.240s.recover.xed", config->filename);
+    sprintf(truncatedFilename, "%.240s.truncated.xed", config->filename);
+    recover.filename = recoverFilename;
+    recover.frameSize = 16;
+    recover.frameWidth = 8;
+    recover.frameHeight = 1;
+    recover.numEvents = 4 * config->maxIndexEntries + config->maxIndexEntries / 2;    // Several index blocks per stream before the truncation
+
+    for (v = 0; v < 2 && ret == 0; v++)
+    {
+        struct xed_reader *original;
+        uint64_t length = 0, truncated;
+        double best = -1;
+        int r, s, recovered = 0;
+
+        // Copy the first three quarters of the file (ending part-way through an event, and without the end of file information)
+        recover.frameInfoSize = frameInfoSizes[v];
+        if (BenchGenerate(&recover) != 0) { fprintf(stderr, "ERROR: Problem generating synthetic file.\n"); ret = -1; break; }
+        {
+            FILE *in = fopen(recoverFilename, "rb"), *out = fopen(truncatedFilename, "wb");
+            unsigned char buffer[65536];
+            if (in != NULL) { fseek(in, 0, SEEK_END); length = (uint64_t)ftell(in); fseek(in, 0, SEEK_SET); }
+            truncated = length * 3 / 4 + 5;
+            if (in == NULL || out == NULL) { fprintf(stderr, "ERROR: Problem creating truncated file.\n"); if (in != NULL) { fclose(in); } if (out != NULL) { fclose(out); } ret = -1; break; }
+            for (length = 0; length < truncated; )
+            {
+                size_t n = (truncated - length < sizeof(buffer)) ? (size_t)(truncated - length) : sizeof(buffer);
+                if (fread(buffer, 1, n, in) != n || fwrite(buffer, 1, n, out) != n) { break; }
+                length += n;
+            }
+            fclose(in);
+            if (fclose(out) != 0 || length != truncated) { fprintf(stderr, "ERROR: Problem creating truncated file.\n"); ret = -1; break; }
+        }
+
+        original = XedNewReader(recoverFilename);
+        if (original == NULL) { fprintf(stderr, "ERROR: Problem opening synthetic file.\n"); ret = -1; break; }
+
+        // The forward-only stream reader must skip the index blocks to find every event
+        {
+            FILE *fp = fopen(recoverFilename, "rb");
+            struct xed_stream *stream = (fp != NULL) ? XedOpenStream(fp) : NULL;
+            xed_event_view_t view;
+            int count = 0, status = XED_E_POINTER;
+            while (stream != NULL && (status = XedNextEvent(stream, &view)) == XED_OK) { count++; }
+            XedCloseStream(stream);
+            if (fp != NULL) { fclose(fp); }
+            if (status != XED_E_ABORT || count != XedGetNumEvents(original, XED_STREAM_ALL)) { fprintf(stderr, "ERROR: Stream reader found %d events (%s), expected %d.\n", count, variants[v], XedGetNumEvents(original, XED_STREAM_ALL)); XedCloseReader(original); ret = -1; break; }
+        }
+        for (r = 0; r < repeat && ret == 0; r++)
+        {
+            double start = BenchTime(), elapsed;
+            struct xed_reader *reader = XedNewReaderEx(truncatedFilename, XED_STREAM_MASK_ALL, XED_READER_RECOVER);
+            elapsed = BenchTime() - start;
+            if (reader == NULL) { fprintf(stderr, "ERROR: Problem recovering truncated file (%s).\n", variants[v]); ret = -1; break; }
+            if (best < 0 || elapsed < best) { best = elapsed; }
+
+            // Every complete event before the truncation, and nothing else
+            recovered = 0;
+            for (s = 0; s < recover.numStreams && ret == 0; s++)
+            {
+                int count = XedGetNumEvents(original, s), numRecovered = XedGetNumEvents(reader, s), i;
+                for (i = 0; i < count; i++)
+                {
+                    const xed_index_t *expected = XedGetIndexEntry(original, s, i);
+                    const xed_index_t *entry;
+                    if (expected->indexEntry.frameFileOffset + 24 + (expected->indexEntry.frameTimestamp != 0 ? 24 : 0) + expected->indexEntry.dataSize > truncated) { break; }
+                    entry = (i < numRecovered) ? XedGetIndexEntry(reader, s, i) : NULL;
+                    if (entry == NULL || entry->streamId != expected->streamId || entry->indexEntry.frameFileOffset != expected->indexEntry.frameFileOffset || entry->indexEntry.frameTimestamp != expected->indexEntry.frameTimestamp
+                     || entry->indexEntry.dataSize != expected->indexEntry.dataSize || entry->indexEntry.dataSize2 != expected->indexEntry.dataSize2
+                     || (recover.frameInfoSize > 0 && memcmp(&entry->frameInfo, &expected->frameInfo, sizeof(xed_frame_info_t)) != 0))
+                    {
+                        fprintf(stderr, "ERROR: Recovered index differs (%s) for stream %d event %d.\n", variants[v], s, i);
+                        ret = -1;
+                        break;
+                    }
+                }
+                if (ret == 0 && numRecovered != i) { fprintf(stderr, "ERROR: Recovered %d events (%s) for stream %d, expected %d.\n", numRecovered, variants[v], s, i); ret = -1; }
+                recovered += numRecovered;
+            }
+            XedCloseReader(reader);
+        }
+        XedCloseReader(original);
+        if (ret != 0) { break; }
+
+        if (best <= 0) { best = 1e-9; }
+        BenchResult("recover", variants[v], "events", recovered, "events");
+        BenchResult("recover", variants[v], "scan", truncated / best / 1048576.0, "MB/s");
+    }
+
+    remove(truncatedFilename);
+    remove(recoverFilename);
+    return ret;
+}
+
+
+int main(int argc, char *argv[])
+{
+    bench_config_t config;
+    int repeat = 5;
+    int samples = 10000;
+    int keep = 0;
+    int help = 0;
+    int ret = 0;
+    int i;
+
+    config.filename = "xed_bench.xed";
+    config.numStreams = 5;
+    config.numEvents = 100000;
+    config.frameSize = 16;
+    config.maxIndexEntries = 1024;
+    config.frameInfoSize = 24;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcasecmp(argv[i], "--help")) { help = 1; break; }
+        else if (!strcasecmp(argv[i], "--file") && i + 1 < argc) { config.filename = argv[++i]; }
+        else if (!strcasecmp(argv[i], "--streams") && i + 1 < argc) { config.numStreams = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--events") && i + 1 < argc) { config.numEvents = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--frame-size") && i + 1 < argc) { config.frameSize = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--index-entries") && i + 1 < argc) { config.maxIndexEntries = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--repeat") && i + 1 < argc) { repeat = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--samples") && i + 1 < argc) { samples = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--keep")) { keep = 1; }
+        else { fprintf(stderr, "ERROR: Unknown option: %s\n", argv[i]); help = 1; break; }
+    }
+
+    if (config.numStreams < 1 || config.numStreams > XED_MAX_STREAMS || config.numEvents < 0 || config.frameSize < 0 || config.maxIndexEntries < 1 || repeat < 1 || samples < 1) { fprintf(stderr, "ERROR: Invalid configuration.\n"); help = 1; }
+
+    // Frame dimensions: rows of 640 values where they divide the frame size (e.g. 614400 bytes is a 640x480 depth frame), otherwise a single row
+    if (config.frameSize >= 1280 && config.frameSize % 1280 == 0) { config.frameWidth = 640; config.frameHeight = config.frameSize / 1280; }
+    else { config.frameWidth = config.frameSize / 2; config.frameHeight = 1; }
+
+    if (help)
+    {
+        fprintf(stderr, "Usage: xed_bench [--file <synthetic.xed>] [--streams <n>] [--events <n>] [--frame-size <bytes>] [--index-entries <n>] [--repeat <n>] [--samples <n>] [--keep]\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Generates a synthetic EVENTS1 file and reports benchmark results as CSV on stdout.\n");
+        fprintf(stderr, "Frame sizes that are a multiple of 1280 bytes are 640-wide depth frames (e.g. --frame-size 614400 for 640x480).\n");
+        return -1;
+    }
+
+    fprintf(stderr, "NOTE: Generating %d streams x %d events of %d bytes (%d entries per index): %s\n", config.numStreams, config.numEvents, config.frameSize, config.maxIndexEntries, config.filename);
+    if (BenchGenerate(&config) != 0) { fprintf(stderr, "ERROR: Problem generating synthetic file.\n"); return 1; }
+
+    printf("benchmark,variant,metric,value,unit\n");
+    if (BenchOpen(&config, repeat) != 0) { ret = 1; }
+    if (BenchIndex(&config, repeat) != 0) { ret = 1; }
+    if (BenchSeek(&config, samples, repeat) != 0) { ret = 1; }
+    if (BenchRead(&config, repeat) != 0) { ret = 1; }
+    if (BenchBatch(&config, repeat) != 0) { ret = 1; }
+    if (BenchLatency(&config, samples) != 0) { ret = 1; }
+    if (BenchAsync(&config, samples, repeat) != 0) { ret = 1; }
+    if (BenchDepth(repeat) != 0) { ret = 1; }
+    if (BenchArchive(&config, repeat) != 0) { ret = 1; }
+    if (BenchRecover(&config, repeat) != 0) { ret = 1; }
+
+    if (!keep) { remove(config.filename); }
+    return ret;
+}
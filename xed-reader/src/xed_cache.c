@@ -0,0 +1,239 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Index Cache -- the fully built indexes in a sidecar file, mapped on later opens
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+
+
+// Cache file layout (host byte order and structure layout, all sections 8-byte aligned):
+//   xed_index_cache_header_t header;
+//   xed_end_stream_info_t streamInfo[numStreams];
+//   xed_index_t streamIndex[numStreams][streamInfo[n].totalIndexEntries];
+//   xed_index_t globalIndex[totalEvents];
+#define XED_CACHE_BYTE_ORDER 0x01020304
+
+typedef struct
+{
+    char magic[8];                  // @ 0 "XEDIDX1\0"
+    uint32_t byteOrder;             // @ 8 XED_CACHE_BYTE_ORDER in host order (caches are not portable between byte orders)
+    uint32_t headerSize;            // @12 sizeof(xed_index_cache_header_t)
+    uint32_t streamInfoSize;        // @16 sizeof(xed_end_stream_info_t)
+    uint32_t entrySize;             // @20 sizeof(xed_index_t)
+    uint64_t fileSize;              // @24 Size of the indexed file
+    uint64_t fileTime;              // @32 Modification time of the indexed file
+    xed_file_header_t fileHeader;   // @40 Header of the indexed file (including indexFileOffset)
+    uint32_t numStreams;            // @64 Number of streams cached
+    uint32_t totalEvents;           // @68 Number of global index entries
+                                    // @72 <end>
+} xed_index_cache_header_t;
+
+// Fill in the expected cache header for an open reader
+static void XedIndexCacheHeader(const xed_reader_t *reader, xed_index_cache_header_t *header)
+{
+    memset(header, 0, sizeof(xed_index_cache_header_t));
+    memcpy(header->magic, "XEDIDX1", 8);
+    header->byteOrder = XED_CACHE_BYTE_ORDER;
+    header->headerSize = sizeof(xed_index_cache_header_t);
+    header->streamInfoSize = sizeof(xed_end_stream_info_t);
+    header->entrySize = sizeof(xed_index_t);
+    header->fileSize = reader->fileSize;
+    header->fileTime = reader->fileTime;
+    header->fileHeader = reader->header;
+    header->numStreams = (reader->header.numStreams < XED_MAX_STREAMS) ? reader->header.numStreams : XED_MAX_STREAMS;
+}
+
+// Round a section size up to keep the next section aligned
+static uint64_t XedIndexCacheAlign(uint64_t size) { return (size + 7) & ~(uint64_t)7; }
+
+
+int XedIndexCacheLoad(xed_reader_t *reader, const char *cacheFilename)
+{
+    xed_index_cache_header_t expected, header;
+    const unsigned char *map = NULL;
+    uint64_t mapSize = 0, offset, total;
+    unsigned int i;
+
+    if (reader == NULL || cacheFilename == NULL) { return XED_E_POINTER; }
+
+    // Map the cache file
+#ifdef _WIN32
+    {
+        LARGE_INTEGER size;
+        HANDLE file = CreateFileA(cacheFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        HANDLE mapHandle = NULL;
+        if (file == INVALID_HANDLE_VALUE) { return XED_E_ACCESS_DENIED; }
+        if (GetFileSizeEx(file, &size) && size.QuadPart >= (LONGLONG)sizeof(header) && (uint64_t)size.QuadPart == (uint64_t)(size_t)size.QuadPart)
+        {
+            mapHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapHandle != NULL) { map = (const unsigned char *)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0); }
+            mapSize = (uint64_t)size.QuadPart;
+        }
+        if (mapHandle != NULL) { CloseHandle(mapHandle); }  // The view keeps the mapping
+        CloseHandle(file);
+        if (map == NULL) { return XED_E_ACCESS_DENIED; }
+    }
+#else
+    {
+        struct stat st;
+        int fd = open(cacheFilename, O_RDONLY);
+        if (fd < 0) { return XED_E_ACCESS_DENIED; }
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(header) && (uint64_t)st.st_size == (uint64_t)(size_t)st.st_size)
+        {
+            void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (view != MAP_FAILED) { map = (const unsigned char *)view; }
+            mapSize = (uint64_t)st.st_size;
+        }
+        close(fd);                                          // The mapping keeps the file
+        if (map == NULL) { return XED_E_ACCESS_DENIED; }
+    }
+#endif
+    reader->indexCache = map;
+    reader->indexCacheSize = mapSize;
+
+    // Check the cache is for this version of the file, and this build
+    XedIndexCacheHeader(reader, &expected);
+    memcpy(&header, map, sizeof(header));
+    expected.totalEvents = header.totalEvents;
+    if (memcmp(&header, &expected, sizeof(header)) != 0) { XedIndexCacheClose(reader); return XED_E_INVALID_DATA; }
+
+    // Check the size of the sections
+    offset = XedIndexCacheAlign(sizeof(header));
+    total = XedIndexCacheAlign((uint64_t)header.numStreams * sizeof(xed_end_stream_info_t));
+    if (offset + total > mapSize) { XedIndexCacheClose(reader); return XED_E_INVALID_DATA; }
+    total = 0;
+    for (i = 0; i < header.numStreams; i++)
+    {
+        const xed_end_stream_info_t *streamInfo = (const xed_end_stream_info_t *)(map + offset) + i;
+        total += streamInfo->totalIndexEntries;
+    }
+    if (total != header.totalEvents || offset + XedIndexCacheAlign((uint64_t)header.numStreams * sizeof(xed_end_stream_info_t)) + 2 * total * sizeof(xed_index_t) != mapSize)
+    {
+        XedIndexCacheClose(reader);
+        return XED_E_INVALID_DATA;
+    }
+
+    // Point the indexes into the cache
+    memcpy(reader->streamInfo, map + offset, header.numStreams * sizeof(xed_end_stream_info_t));
+    offset += XedIndexCacheAlign((uint64_t)header.numStreams * sizeof(xed_end_stream_info_t));
+    for (i = 0; i < header.numStreams; i++)
+    {
+        reader->streamIndex[i] = (xed_index_t *)(map + offset);
+        offset += (uint64_t)reader->streamInfo[i].totalIndexEntries * sizeof(xed_index_t);
+    }
+    reader->globalIndex = (xed_index_t *)(map + offset);
+    reader->totalEvents = (int)header.totalEvents;
+
+    return XED_OK;
+}
+
+
+int XedIndexCacheSave(const xed_reader_t *reader, const char *cacheFilename)
+{
+    static const unsigned char padding[8] = {0};
+    xed_index_cache_header_t header;
+    char *tempFilename;
+    FILE *fp;
+    size_t streamInfoSize;
+    unsigned int i;
+    int ok = 1;
+
+    if (reader == NULL || cacheFilename == NULL) { return XED_E_POINTER; }
+    if (reader->globalIndex == NULL) { return XED_E_NOT_VALID_STATE; }
+
+    XedIndexCacheHeader(reader, &header);
+    header.totalEvents = (uint32_t)reader->totalEvents;
+    streamInfoSize = header.numStreams * sizeof(xed_end_stream_info_t);
+
+    // Write to a temporary file, then replace the cache (so a reader never sees a partial cache)
+    tempFilename = (char *)malloc(strlen(cacheFilename) + 5);
+    if (tempFilename == NULL) { return XED_E_OUT_OF_MEMORY; }
+    sprintf(tempFilename, "%s.tmp", cacheFilename);
+    fp = fopen(tempFilename, "wb");
+    if (fp == NULL) { free(tempFilename); return XED_E_ACCESS_DENIED; }
+
+    ok &= fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok &= fwrite(padding, 1, (size_t)(XedIndexCacheAlign(sizeof(header)) - sizeof(header)), fp) == (size_t)(XedIndexCacheAlign(sizeof(header)) - sizeof(header));
+    ok &= fwrite(reader->streamInfo, 1, streamInfoSize, fp) == streamInfoSize;
+    ok &= fwrite(padding, 1, (size_t)(XedIndexCacheAlign(streamInfoSize) - streamInfoSize), fp) == (size_t)(XedIndexCacheAlign(streamInfoSize) - streamInfoSize);
+    for (i = 0; i < header.numStreams; i++)
+    {
+        size_t count = reader->streamInfo[i].totalIndexEntries;
+        ok &= fwrite(reader->streamIndex[i], sizeof(xed_index_t), count, fp) == count;
+    }
+    ok &= fwrite(reader->globalIndex, sizeof(xed_index_t), (size_t)reader->totalEvents, fp) == (size_t)reader->totalEvents;
+    ok &= fclose(fp) == 0;
+
+#ifdef _WIN32
+    if (ok) { ok = MoveFileExA(tempFilename, cacheFilename, MOVEFILE_REPLACE_EXISTING) != 0; }
+#else
+    if (ok) { ok = rename(tempFilename, cacheFilename) == 0; }
+#endif
+    if (!ok) { remove(tempFilename); }
+    free(tempFilename);
+
+    return ok ? XED_OK : XED_E_ACCESS_DENIED;
+}
+
+
+void XedIndexCacheClose(xed_reader_t *reader)
+{
+    int i;
+
+    if (reader == NULL || reader->indexCache == NULL) { return; }
+
+#ifdef _WIN32
+    UnmapViewOfFile(reader->indexCache);
+#else
+    munmap((void *)reader->indexCache, (size_t)reader->indexCacheSize);
+#endif
+    reader->indexCache = NULL;
+    reader->indexCacheSize = 0;
+
+    // The indexes pointed into the cache
+    for (i = 0; i < XED_MAX_STREAMS; i++) { reader->streamIndex[i] = NULL; }
+    reader->globalIndex = NULL;
+    reader->totalEvents = 0;
+}
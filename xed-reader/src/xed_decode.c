@@ -37,67 +37,106 @@
 #include <string.h>
 #include "xed/xed.h"
 #include "xed/bmp.h"
+#include "xed/image.h"
+#include "xed/depth.h"
+#include "xed/npy.h"
+#include "xed_thread.h"
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+
+// Snapshot types
+#define SNAPSHOT_NONE  0
+#define SNAPSHOT_DEPTH 1
+#define SNAPSHOT_COLOR 2
 
-int xed_decode(const char *filename)
+// A packet on its way through the read, convert and write stages
+typedef struct
 {
-    size_t bufferSize = 1024 * 768 * 3;
-    void *buffer;
-    struct xed_reader *reader;
-    int count0 = 0, count1 = 0;
     int packet;
+    xed_event_t frame;
+    xed_frame_info_t frameInfo;
+    int snapshot;                   // SNAPSHOT_NONE/SNAPSHOT_DEPTH/SNAPSHOT_COLOR
+    int number;                     // Snapshot number (in the output file name)
+    xed_event_view_t view;          // Snapshot payload (read stage to convert stage)
+    unsigned char *buffer;          // Converted snapshot (convert stage to write stage)
+    size_t bufferSize;
+} decode_job_t;
+
+// Depth snapshot colors (read-only once initialized)
+static xed_depth_colormap_t depthColormap;
+static xed_depth_colormap_t depthColormapRgb;
+
+// Snapshot output (set before reading)
+static int snapshotEvery0 = 30;     // Every n-th depth frame
+static int snapshotEvery1 = 10;     // Every n-th color frame
+static int imageFormat = IMAGE_FORMAT_BMP;
+static image_stream_t *imageStream0 = NULL;     // All depth snapshots in one file (NULL for a file each)
+static image_stream_t *imageStream1 = NULL;     // All color snapshots in one file
+static int showStats = 0;                       // Report the reader statistics on closing
+
+// Frame counters, used to select the snapshots
+typedef struct
+{
+    int count0;                     // Depth frames
+    int count1;                     // Color frames
+} decode_counts_t;
 
-    // Create reader
-    reader = XedNewReader(filename);
-    if (reader == NULL)
+
+// Decide whether the packet is a snapshot (in packet order)
+static void DecodeSelect(decode_counts_t *counts, decode_job_t *job)
+{
+    if (job->frame.length == job->frameInfo.width * job->frameInfo.height * 2)
     { 
-        fprintf(stderr, "ERROR: Problem opening reader for file: %s\n", filename); 
-        return 1;
+        // Save snapshots
+        if ((counts->count0 % snapshotEvery0) == 0 && job->frameInfo.width > 0 && job->frameInfo.height > 0)
+        {
+            job->snapshot = SNAPSHOT_DEPTH;
+            job->number = counts->count0 / snapshotEvery0;
+        }
+        counts->count0++;
     }
-
-    // Allocate buffer
-    buffer = malloc(bufferSize);
-    if (buffer == NULL) { fprintf(stderr, "ERROR: Out of memory.\n"); XedCloseReader(reader); return -2; }
-
-printf("XED,packet,stream,type,len,time,unknown,len2"
-       ",unk1,unk2,unk3,unk4,width,height,seq,unk5,time\n");
-
-    // Read packets
-    for (packet = 0; packet < XedGetNumEvents(reader, XED_STREAM_ALL); packet++)
-    {
-        int ret;
-        xed_event_t frame;
-        xed_frame_info_t frameInfo;
-
-        ret = XedReadEvent(reader, XED_STREAM_ALL, packet, &frame, &frameInfo, buffer, bufferSize);
-        //printf("%d;", frame.streamId);
-        if (ret != XED_OK)
+    else if (job->frame.length == job->frameInfo.width * job->frameInfo.height * 1)        // Colour data might be RGBX bayer pattern? (Possibly with IR data as RGBI?)
+    { 
+        // Save snapshots
+        if ((counts->count1 % snapshotEvery1) == 0 && job->frameInfo.width > 0 && job->frameInfo.height > 0)
         {
-            if (ret == XED_E_ABORT) { fprintf(stderr, "NOTE: Stopped reading file (%d depth frames in stream 0, %0.2fs @ 30 Hz, %d color frames in stream 0, %0.2fs @ 30 Hz)\n", count0, count0 / 30.0f, count1, count1 / 30.0f); }
-            else { fprintf(stderr, "ERROR: Problem reading file (%d)\n", ret); }
-            break;
+            job->snapshot = SNAPSHOT_COLOR;
+            job->number = counts->count1 / snapshotEvery1;
         }
+        counts->count1++;
+    }
+}
 
-//     "XED,packet,stream,flags,len,time,unknown,len2"
-printf("XED,%d    ,%u    ,%u  ,%u ,%llu,0x%08x ,%u  ", packet, frame.streamId, frame._flags, frame.length, frame.timestamp, frame._unknown1, frame.length2);
-
-if (frame.streamId != 0xffff)
+// Read stage (in packet order): read the event header, decide whether it is a snapshot, and if so map its payload
+static int DecodeRead(struct xed_reader *reader, decode_counts_t *counts, int packet, decode_job_t *job)
 {
-//     ",unk1,unk2,unk3,unk4,width,height,seq,unk5,time"
-printf(",%u  ,%u  ,%u  ,%u  ,%u   ,%u    ,%u ,%u  ,%u  ", frameInfo._unknown1, frameInfo._unknown2, frameInfo._unknown3, frameInfo._unknown4, frameInfo.width, frameInfo.height, frameInfo.sequenceNumber, frameInfo._unknown5, frameInfo.timestamp);
-} else { printf(",,,,,,,,,"); }
+    int ret;
+
+    job->packet = packet;
+    job->snapshot = SNAPSHOT_NONE;
+    memset(&job->view, 0, sizeof(job->view));
+
+    // Header only
+    ret = XedReadEvent(reader, XED_STREAM_ALL, packet, &job->frame, &job->frameInfo, NULL, 0);
+    if (ret != XED_OK) { return ret; }
 
 #if 0
-if (frame.length <= 16)
+if (job->frame.length <= 16)
 {
+    unsigned char buffer[16];
     int z;
+    XedReadEvent(reader, XED_STREAM_ALL, packet, &job->frame, &job->frameInfo, buffer, sizeof(buffer));
     printf(",");
-    for (z = 0; z < (int)frame.length; z++)
+    for (z = 0; z < (int)job->frame.length; z++)
     {
         if (z > 0) { printf(":"); }
-        printf("%02x", ((unsigned char *)buffer)[z]);
+        printf("%02x", buffer[z]);
     }
-    if (frame.length == 16)
+    if (job->frame.length == 16)
     {
         printf(",%d,%d,%d,%d", ((int16_t *)buffer)[0], ((int16_t *)buffer)[1], ((int16_t *)buffer)[2], ((int16_t *)buffer)[3]);
     }
@@ -105,133 +144,485 @@ if (frame.length <= 16)
 printf("\n");
 #endif
 
-        if (frame.length == frameInfo.width * frameInfo.height * 2)
-        { 
-            // Save snapshots
-            if ((count0 % 30) == 0 && frameInfo.width > 0 && frameInfo.height > 0)
-            {
-                int width = frameInfo.width, height = frameInfo.height;
+    DecodeSelect(counts, job);
 
-#if 1
-                // Arrange 16-bit buffer
-                {
-                    int y;
-                    for (y = 0; y < height; y++)
-                    {
-                        unsigned char *p = (unsigned char *)buffer + (y * (width * 2)); 
-                        int x;
-                        for (x = 0; x < width; x++)
-                        {
-                            unsigned short v = ((unsigned short)p[0] << 8) | p[1]; // Read (big endian)
-
-                            // Mask for depth-only
-                            v &= 0x0fff;
-
-// Stretch
-if (v < 850) { v = 0; } else { v = (unsigned short)((int)(v - 850) * 4096 / (4000 - 850)); if (v >= 4096) { v = 4095; } }
-
-// Band
-//if (y < 16) { v = (unsigned short)((int)4096 * x / width); }
-
-                            // Simple greyscale
-                            //r = g = b = (unsigned char)(v >> 4);
-
-#if 1
-                            {
-                                // Convert to RGB
-                                unsigned char r, g, b;
-                                unsigned char z;
-
-                                //const int DEPTH_UNKNOWN = 0;
-                                //const int DEPTH_MIN = 800;  // 850;
-                                //const int DEPTH_MAX = 4100; // 4000;
-
-                                #define RGB_MAX 255
-                                #define V_MAX 4096
-
-                                z = (unsigned char)(RGB_MAX * ((int)v % (V_MAX / 6 + 1)) / (V_MAX / 6 + 1));
-                                if      (v < (1 * V_MAX / 6)) { r = RGB_MAX;     g = z;           b = 0; }
-                                else if (v < (2 * V_MAX / 6)) { r = RGB_MAX - z; g = RGB_MAX;     b = 0; }
-                                else if (v < (3 * V_MAX / 6)) { r = 0;           g = RGB_MAX;     b = z; }
-                                else if (v < (4 * V_MAX / 6)) { r = 0;           g = RGB_MAX - z; b = RGB_MAX; }
-                                else if (v < (5 * V_MAX / 6)) { r = z;           g = 0;           b = RGB_MAX; }
-                                //else                          { r = RGB_MAX;     g = 0;           b = RGB_MAX - z; }
-                                else                          { r = RGB_MAX;     g = z;           b = RGB_MAX; }
-
-                                // Convert to RGB555
-                                v = ((unsigned short)(r >> 3) << 10) | ((unsigned short)(g >> 3) << 5) | ((unsigned short)(b >> 3) << 0);
-                            }
-#endif
+    // Only the snapshot frames are read -- for a mapped reader this is zero-copy until converted
+    if (job->snapshot != SNAPSHOT_NONE)
+    {
+        ret = XedMapEvent(reader, XED_STREAM_ALL, packet, &job->view);
+        if (ret != XED_OK) { return ret; }
+    }
 
-                            // Write back (little endian)
-                            p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+    return XED_OK;
+}
 
-                            p += 2;
+// Convert stage (any order): convert the snapshot payload into the job buffer for output
+static int DecodeConvert(struct xed_reader *reader, decode_job_t *job)
+{
+    int width = job->frameInfo.width, height = job->frameInfo.height;
+    size_t size;
+    void *buffer;
 
-                        }
-                    }
-                }
+    if (job->snapshot == SNAPSHOT_NONE) { return XED_OK; }
 
-                // Write image
-                {
-                    char filename[32];
-                    sprintf(filename, "out16-%0d.bmp", count0 / 30);
-                    BitmapWrite(filename, buffer, 16, width, width * 2, height);
-                }
-#endif
+    size = (job->snapshot == SNAPSHOT_DEPTH && imageFormat == IMAGE_FORMAT_PPM) ? (size_t)width * height * 3 : job->view.length;
+    if (job->bufferSize < size)
+    {
+        unsigned char *newBuffer = (unsigned char *)realloc(job->buffer, size);
+        if (newBuffer == NULL) { XedUnmapEvent(reader, &job->view); job->snapshot = SNAPSHOT_NONE; return XED_E_OUT_OF_MEMORY; }
+        job->buffer = newBuffer;
+        job->bufferSize = size;
+    }
+    buffer = job->buffer;
 
+    if (job->snapshot == SNAPSHOT_DEPTH)
+    {
+        // Colorize the 16-bit depth straight from the payload into the RGB555 (BMP) or RGB24 (PPM) buffer, or unpack the depth values (PGM)
+        if (imageFormat == IMAGE_FORMAT_PGM) { XedUnpackDepth(job->view.data, (uint16_t *)buffer, (size_t)width * height, 0); }
+        else if (imageFormat == IMAGE_FORMAT_PPM) { XedDepthColorize(&depthColormapRgb, job->view.data, width * 2, buffer, width * 3, width, height); }
+        else { XedDepthColorize(&depthColormap, job->view.data, width * 2, buffer, width * 2, width, height); }
+        XedUnmapEvent(reader, &job->view);
+    }
+    else if (job->snapshot == SNAPSHOT_COLOR)
+    {
+        memcpy(buffer, job->view.data, job->view.length);
+        XedUnmapEvent(reader, &job->view);
 
-            }
-            count0++;
-        }
-        else if (frame.length == frameInfo.width * frameInfo.height * 1)        // Colour data might be RGBX bayer pattern? (Possibly with IR data as RGBI?)
-        { 
-            // Save snapshots
-            if ((count1 % 10) == 0 && frameInfo.width > 0 && frameInfo.height > 0)
+        // Arrange 32-bit buffer
+        {
+            int y;
+            for (y = 0; y < height; y++)
             {
-                int width = frameInfo.width, height = frameInfo.height;
-
-                // Arrange 32-bit buffer
+                uint32_t *p = (uint32_t *)buffer + (y * (width * 4)); 
+                int x;
+                for (x = 0; x < width; x++)
                 {
-                    int y;
-                    for (y = 0; y < height; y++)
-                    {
-                        uint32_t *p = (uint32_t *)buffer + (y * (width * 4)); 
-                        int x;
-                        for (x = 0; x < width; x++)
-                        {
-                            // "Swizzle" the RGBX components to XBGR
+                    // "Swizzle" the RGBX components to XBGR
 //                            uint32_t v = *p;
 //                            *p = (v << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | ((v >> 24) & 0xff);
 //                            p++;
-                        }
-                    }
                 }
+            }
+        }
+    }
 
-                // Write image
-                {
-                    char filename[32];
-                    sprintf(filename, "out32-%0d.bmp", count1 / 10);
-//                    BitmapWrite(filename, buffer, 32, width, width * 4, height);
-BitmapWrite(filename, buffer, 8, width, width * 1, height);
-                }
+    return XED_OK;
+}
 
-            }
-            count1++;
+// Write stage (in packet order): output the packet information and any snapshot image
+static void DecodeWrite(decode_job_t *job)
+{
+    xed_event_t frame = job->frame;
+    xed_frame_info_t frameInfo = job->frameInfo;
+    int width = frameInfo.width, height = frameInfo.height;
+
+//     "XED,packet,stream,flags,len,time,unknown,len2"
+printf("XED,%d    ,%u    ,%u  ,%u ,%llu,0x%08x ,%u  ", job->packet, frame.streamId, frame._flags, frame.length, frame.timestamp, frame._unknown1, frame.length2);
+
+if (frame.streamId != 0xffff)
+{
+//     ",unk1,unk2,unk3,unk4,width,height,seq,unk5,time"
+printf(",%u  ,%u  ,%u  ,%u  ,%u   ,%u    ,%u ,%u  ,%u  ", frameInfo._unknown1, frameInfo._unknown2, frameInfo._unknown3, frameInfo._unknown4, frameInfo.width, frameInfo.height, frameInfo.sequenceNumber, frameInfo._unknown5, frameInfo.timestamp);
+} else { printf(",,,,,,,,,"); }
+
+    if (job->snapshot == SNAPSHOT_DEPTH && imageFormat != IMAGE_FORMAT_BMP)
+    {
+        // Write image: 12-bit depth (PGM) or colorized depth (PPM)
+        int bitsPerPixel = (imageFormat == IMAGE_FORMAT_PGM) ? 12 : 24;
+        int stride = width * ((imageFormat == IMAGE_FORMAT_PGM) ? 2 : 3);
+        if (imageStream0 != NULL) { ImageStreamWrite(imageStream0, imageFormat, job->buffer, bitsPerPixel, width, stride, height); }
+        else
+        {
+            char filename[32];
+            sprintf(filename, "out16-%0d.%s", job->number, (imageFormat == IMAGE_FORMAT_PGM) ? "pgm" : "ppm");
+            ImageWrite(filename, imageFormat, job->buffer, bitsPerPixel, width, stride, height);
         }
+    }
+    else if (job->snapshot == SNAPSHOT_COLOR && imageFormat != IMAGE_FORMAT_BMP)
+    {
+        // Write image (single channel, as 8-bit PGM)
+        if (imageStream1 != NULL) { ImageStreamWrite(imageStream1, IMAGE_FORMAT_PGM, job->buffer, 8, width, width * 1, height); }
+        else
+        {
+            char filename[32];
+            sprintf(filename, "out32-%0d.pgm", job->number);
+            ImageWrite(filename, IMAGE_FORMAT_PGM, job->buffer, 8, width, width * 1, height);
+        }
+    }
+    else if (job->snapshot == SNAPSHOT_DEPTH)
+    {
+        // Write image
+        char filename[32];
+        if (imageStream0 != NULL) { ImageStreamWrite(imageStream0, IMAGE_FORMAT_BMP, job->buffer, 16, width, width * 2, height); }
+        else
+        {
+            sprintf(filename, "out16-%0d.bmp", job->number);
+            BitmapWrite(filename, job->buffer, 16, width, width * 2, height);
+        }
+    }
+    else if (job->snapshot == SNAPSHOT_COLOR)
+    {
+        // Write image
+        char filename[32];
+        if (imageStream1 != NULL) { ImageStreamWrite(imageStream1, IMAGE_FORMAT_BMP, job->buffer, 8, width, width * 1, height); }
+        else
+        {
+            sprintf(filename, "out32-%0d.bmp", job->number);
+//            BitmapWrite(filename, job->buffer, 32, width, width * 4, height);
+BitmapWrite(filename, job->buffer, 8, width, width * 1, height);
+        }
+    }
+}
+
+// Report why reading stopped
+static void DecodeStopped(int ret, const decode_counts_t *counts)
+{
+    if (ret == XED_E_ABORT) { fprintf(stderr, "NOTE: Stopped reading file (%d depth frames in stream 0, %0.2fs @ 30 Hz, %d color frames in stream 0, %0.2fs @ 30 Hz)\n", counts->count0, counts->count0 / 30.0f, counts->count1, counts->count1 / 30.0f); }
+    else { fprintf(stderr, "ERROR: Problem reading file (%d)\n", ret); }
+}
+
+// Report the reader's I/O and timing counters (--stats)
+static void DecodeReportStats(struct xed_reader *reader)
+{
+    xed_reader_stats_t stats;
+    if (!showStats || XedGetStats(reader, &stats) != XED_OK) { return; }
+    fprintf(stderr, "NOTE: Read %.1f MB in %llu reads (%llu seeks), %llu events decoded, %llu cache hits\n", stats.bytesRead / 1048576.0, (unsigned long long)stats.reads, (unsigned long long)stats.seeks, (unsigned long long)stats.eventsDecoded, (unsigned long long)stats.cacheHits);
+    fprintf(stderr, "NOTE: Time reading metadata %.3f s, payloads %.3f s\n", stats.metadataTime / 1.0e9, stats.payloadTime / 1.0e9);
+}
+
+
+// Pipeline: the read stage (calling thread) fills a bounded ring of job slots in packet order, 
+// a pool of workers converts them in any order, and the write stage (one thread) empties them in packet order.
+#define SLOT_FREE       0
+#define SLOT_READ       1
+#define SLOT_CONVERTING 2
+#define SLOT_CONVERTED  3
+
+typedef struct
+{
+    struct xed_reader *reader;
+    decode_job_t *jobs;
+    int *state;
+    int capacity;
+    int numRead;                    // Packets read so far (next slot to fill)
+    int numClaimed;                 // Packets claimed by a worker
+    int numWritten;                 // Packets written
+    int readDone;
+    xed_mutex_t mutex;
+    xed_cond_t changed;
+} decode_pipeline_t;
+
+static XED_THREAD_FUNC DecodeWorkerThread(void *arg)
+{
+    decode_pipeline_t *pipeline = (decode_pipeline_t *)arg;
+
+    XedMutexLock(&pipeline->mutex);
+    for (;;)
+    {
+        int slot;
 
+        // Wait for the next packet to convert (or the end)
+        while (pipeline->numClaimed >= pipeline->numRead && !pipeline->readDone) { XedCondWait(&pipeline->changed, &pipeline->mutex); }
+        if (pipeline->numClaimed >= pipeline->numRead) { break; }
+        slot = pipeline->numClaimed++ % pipeline->capacity;
+        pipeline->state[slot] = SLOT_CONVERTING;
+        XedMutexUnlock(&pipeline->mutex);
+
+        if (DecodeConvert(pipeline->reader, &pipeline->jobs[slot]) != XED_OK) { fprintf(stderr, "ERROR: Out of memory converting packet %d.\n", pipeline->jobs[slot].packet); }
+
+        XedMutexLock(&pipeline->mutex);
+        pipeline->state[slot] = SLOT_CONVERTED;
+        XedCondBroadcast(&pipeline->changed);
+    }
+    XedMutexUnlock(&pipeline->mutex);
+    return 0;
+}
+
+static XED_THREAD_FUNC DecodeWriterThread(void *arg)
+{
+    decode_pipeline_t *pipeline = (decode_pipeline_t *)arg;
+
+    XedMutexLock(&pipeline->mutex);
+    for (;;)
+    {
+        int slot = pipeline->numWritten % pipeline->capacity;
+
+        // Wait for the next packet in order (or the end)
+        while (!(pipeline->numWritten < pipeline->numRead && pipeline->state[slot] == SLOT_CONVERTED) && !(pipeline->readDone && pipeline->numWritten >= pipeline->numRead)) { XedCondWait(&pipeline->changed, &pipeline->mutex); }
+        if (pipeline->numWritten >= pipeline->numRead) { break; }
+        XedMutexUnlock(&pipeline->mutex);
+
+        DecodeWrite(&pipeline->jobs[slot]);
+
+        XedMutexLock(&pipeline->mutex);
+        pipeline->state[slot] = SLOT_FREE;
+        pipeline->numWritten++;
+        XedCondBroadcast(&pipeline->changed);
+    }
+    XedMutexUnlock(&pipeline->mutex);
+    return 0;
+}
+
+static int DecodePipeline(struct xed_reader *reader, decode_counts_t *counts, int numThreads)
+{
+    decode_pipeline_t pipeline = {0};
+    xed_thread_t *workers;
+    xed_thread_t writer;
+    int writerStarted = 0;
+    int numWorkers = 0;
+    int packet, i;
+    int ret = XED_OK;
+
+    pipeline.reader = reader;
+    pipeline.capacity = 4 * numThreads + 4;
+    pipeline.jobs = (decode_job_t *)calloc(pipeline.capacity, sizeof(decode_job_t));
+    pipeline.state = (int *)calloc(pipeline.capacity, sizeof(int));
+    workers = (xed_thread_t *)calloc(numThreads, sizeof(xed_thread_t));
+    if (pipeline.jobs == NULL || pipeline.state == NULL || workers == NULL) { free(pipeline.jobs); free(pipeline.state); free(workers); return XED_E_OUT_OF_MEMORY; }
+    XedMutexInit(&pipeline.mutex);
+    XedCondInit(&pipeline.changed);
+
+    if (XedThreadCreate(&writer, DecodeWriterThread, &pipeline) == 0) { writerStarted = 1; } else { ret = XED_E_FAIL; }
+    for (i = 0; i < numThreads && ret == XED_OK; i++)
+    {
+        if (XedThreadCreate(&workers[i], DecodeWorkerThread, &pipeline) != 0) { break; }
+        numWorkers++;
+    }
+    if (numWorkers == 0) { ret = XED_E_FAIL; }
+
+    // Read stage
+    for (packet = 0; ret == XED_OK && packet < XedGetNumEvents(reader, XED_STREAM_ALL); packet++)
+    {
+        int slot = packet % pipeline.capacity;
+
+        // Wait for the slot to be free
+        XedMutexLock(&pipeline.mutex);
+        while (pipeline.state[slot] != SLOT_FREE) { XedCondWait(&pipeline.changed, &pipeline.mutex); }
+        XedMutexUnlock(&pipeline.mutex);
+
+        ret = DecodeRead(reader, counts, packet, &pipeline.jobs[slot]);
+        if (ret != XED_OK) { break; }
+
+        XedMutexLock(&pipeline.mutex);
+        pipeline.state[slot] = SLOT_READ;
+        pipeline.numRead++;
+        XedCondBroadcast(&pipeline.changed);
+        XedMutexUnlock(&pipeline.mutex);
+    }
+
+    XedMutexLock(&pipeline.mutex);
+    pipeline.readDone = 1;
+    XedCondBroadcast(&pipeline.changed);
+    XedMutexUnlock(&pipeline.mutex);
+
+    for (i = 0; i < numWorkers; i++) { XedThreadJoin(workers[i]); }
+    if (writerStarted) { XedThreadJoin(writer); }
+
+    for (i = 0; i < pipeline.capacity; i++) { free(pipeline.jobs[i].buffer); }
+    XedCondDestroy(&pipeline.changed);
+    XedMutexDestroy(&pipeline.mutex);
+    free(pipeline.jobs);
+    free(pipeline.state);
+    free(workers);
+    return ret;
+}
+
+
+// Read packets in order through a readahead cursor (the payloads are read on a background thread), single-threaded conversion
+static int DecodePrefetch(struct xed_reader *reader, decode_counts_t *counts, int queueDepth)
+{
+    struct xed_prefetch *prefetch;
+    xed_prefetch_stats_t stats;
+    decode_job_t job = {0};
+    int ret;
+
+    prefetch = XedNewPrefetch(reader, XED_STREAM_ALL, 0, queueDepth, 0);
+    if (prefetch == NULL) { return XED_E_FAIL; }
+
+    for (job.packet = 0; ; job.packet++)
+    {
+        ret = XedPrefetchNext(prefetch, &job.view);
+        if (ret != XED_OK) { break; }
+        job.frame = job.view.event;
+        job.frameInfo = job.view.frameInfo;
+        job.snapshot = SNAPSHOT_NONE;
+        DecodeSelect(counts, &job);
+
+        if (DecodeConvert(reader, &job) != XED_OK) { fprintf(stderr, "ERROR: Out of memory.\n"); }
+        DecodeWrite(&job);
+    }
+    free(job.buffer);
+
+    XedPrefetchGetStats(prefetch, &stats);
+    fprintf(stderr, "NOTE: Readahead: %llu events, %llu bytes, %llu stalls, %llu full waits.\n", (unsigned long long)stats.eventsReturned, (unsigned long long)stats.bytesRead, (unsigned long long)stats.stalls, (unsigned long long)stats.fullWaits);
+
+    XedClosePrefetch(prefetch);
+    return ret;
+}
+
+// Read packets in file order from a forward-only stream (e.g. stdin), single-threaded
+static int DecodeStream(FILE *fp, decode_counts_t *counts)
+{
+    struct xed_stream *stream;
+    decode_job_t job = {0};
+    int ret;
+
+    stream = XedOpenStream(fp);
+    if (stream == NULL) { return XED_E_INVALID_DATA; }
+
+    for (job.packet = 0; ; job.packet++)
+    {
+        ret = XedNextEvent(stream, &job.view);
+        if (ret != XED_OK) { break; }
+        job.frame = job.view.event;
+        job.frameInfo = job.view.frameInfo;
+        job.snapshot = SNAPSHOT_NONE;
+        DecodeSelect(counts, &job);
+
+        // The payload is only valid until the next event (there is no reader to unmap from)
+        if (DecodeConvert(NULL, &job) != XED_OK) { fprintf(stderr, "ERROR: Out of memory.\n"); }
+        DecodeWrite(&job);
+    }
+    free(job.buffer);
+
+    XedCloseStream(stream);
+    return ret;
+}
+
+
+int xed_decode(const char *filename, int flags, int numThreads, int readahead)
+{
+    struct xed_reader *reader;
+    decode_counts_t counts = {0};
+    int ret = XED_OK;
+
+    // Depth snapshot colors: hue over 850-4000 mm
+    XedDepthColormapInit(&depthColormap, XED_PIXEL_RGB555, 850, 4000, XED_PALETTE_HUE);
+    XedDepthColormapInit(&depthColormapRgb, XED_PIXEL_RGB24, 850, 4000, XED_PALETTE_HUE);
+
+    // Forward-only input from stdin
+    if (!strcmp(filename, "-"))
+    {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+printf("XED,packet,stream,type,len,time,unknown,len2"
+       ",unk1,unk2,unk3,unk4,width,height,seq,unk5,time\n");
+        ret = DecodeStream(stdin, &counts);
+        DecodeStopped(ret, &counts);
+        return 0;
+    }
+
+    // Create reader
+    reader = XedNewReaderEx(filename, XED_STREAM_MASK_ALL, flags);
+    if (reader == NULL)
+    { 
+        fprintf(stderr, "ERROR: Problem opening reader for file: %s\n", filename); 
+        return 1;
     }
 
+printf("XED,packet,stream,type,len,time,unknown,len2"
+       ",unk1,unk2,unk3,unk4,width,height,seq,unk5,time\n");
+
+    if (numThreads > 0)
+    {
+        // Read packets through the pipeline
+        ret = DecodePipeline(reader, &counts, numThreads);
+        if (ret == XED_E_FAIL) { fprintf(stderr, "ERROR: Problem starting threads.\n"); XedCloseReader(reader); return -2; }
+        if (ret == XED_E_OUT_OF_MEMORY) { fprintf(stderr, "ERROR: Out of memory.\n"); XedCloseReader(reader); return -2; }
+    }
+    else if (readahead > 0)
+    {
+        // Read packets ahead on a background thread
+        ret = DecodePrefetch(reader, &counts, readahead);
+        if (ret == XED_E_FAIL) { fprintf(stderr, "ERROR: Problem starting readahead.\n"); XedCloseReader(reader); return -2; }
+    }
+    else
+    {
+        // Read packets
+        decode_job_t job = {0};
+        int packet;
+
+        for (packet = 0; packet < XedGetNumEvents(reader, XED_STREAM_ALL); packet++)
+        {
+            ret = DecodeRead(reader, &counts, packet, &job);
+            if (ret != XED_OK) { break; }
+            if (DecodeConvert(reader, &job) != XED_OK) { fprintf(stderr, "ERROR: Out of memory.\n"); }
+            DecodeWrite(&job);
+        }
+        free(job.buffer);
+    }
+
+    if (ret != XED_OK) { DecodeStopped(ret, &counts); }
 
     // Close reader
+    DecodeReportStats(reader);
     XedCloseReader(reader);
 
-    free(buffer);
-
     return 0;
 }
 
 
+// Export the depth frames (stream 0) in a time window (seconds from the first timestamped event) as a uint16[frames][height][width] .npy volume, in one sequential pass
+int xed_export_npy(const char *filename, int flags, const char *outfile, double startTime, double endTime, int stride)
+{
+    struct xed_reader *reader;
+    struct xed_iterator *iterator;
+    npy_writer_t *npy = NULL;
+    xed_filter_t filter = {0};
+    xed_event_view_t view;
+    uint64_t origin = 0;
+    int width = 0, height = 0, skipped = 0, frames;
+    int ret;
+
+    reader = XedNewReaderEx(filename, XED_STREAM_MASK_ALL, flags);
+    if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening reader for file: %s\n", filename); return 1; }
+
+    // Times are relative to the first timestamped event of any stream
+    ret = XedGetStartTime(reader, &origin);
+    if (ret != XED_OK && ret != XED_E_NOT_FOUND) { fprintf(stderr, "ERROR: Problem reading the index (%d).\n", ret); XedCloseReader(reader); return 1; }
+
+    // Depth frames in the window (the window always starts at a timestamp, so only frames are selected)
+    filter.streamMask = 0x01;
+    filter.startTime = origin + (uint64_t)(startTime * XED_EVENT_TICKS_PER_SECOND);
+    filter.endTime = (endTime > 0) ? origin + (uint64_t)(endTime * XED_EVENT_TICKS_PER_SECOND) : 0;
+    filter.stride = stride;
+    iterator = XedNewIterator(reader, &filter);
+    if (iterator == NULL) { fprintf(stderr, "ERROR: Problem selecting frames.\n"); XedCloseReader(reader); return 1; }
+
+    // Unpack each frame straight into the output buffer (written in large blocks)
+    while ((ret = XedIteratorNext(iterator, &view, NULL)) == XED_OK)
+    {
+        uint16_t *frame;
+
+        if (view.frameInfo.width == 0 || view.frameInfo.height == 0 || view.length != (size_t)view.frameInfo.width * view.frameInfo.height * 2) { skipped++; continue; }
+        if (npy == NULL)
+        {
+            width = view.frameInfo.width;
+            height = view.frameInfo.height;
+            npy = NpyWriterOpen(outfile, width, height);
+            if (npy == NULL) { fprintf(stderr, "ERROR: Problem creating output file: %s\n", outfile); XedCloseIterator(iterator); XedCloseReader(reader); return 1; }
+        }
+        if (view.frameInfo.width != width || view.frameInfo.height != height) { skipped++; continue; }    // (The volume has one frame size)
+
+        frame = NpyWriterNextFrame(npy);
+        if (frame == NULL) { fprintf(stderr, "ERROR: Problem writing output file: %s\n", outfile); break; }
+        XedUnpackDepth(view.data, frame, (size_t)width * height, 0);
+    }
+
+    XedCloseIterator(iterator);
+    DecodeReportStats(reader);
+    XedCloseReader(reader);
+
+    if (npy == NULL) { fprintf(stderr, "ERROR: No depth frames in the selection.\n"); return 1; }
+    frames = NpyWriterClose(npy);
+    if (frames < 0) { fprintf(stderr, "ERROR: Problem writing output file: %s\n", outfile); return 1; }
+    fprintf(stderr, "NOTE: Exported %d depth frames of %dx%d to: %s\n", frames, width, height, outfile);
+    if (skipped > 0) { fprintf(stderr, "WARNING: Skipped %d events that are not depth frames of %dx%d.\n", skipped, width, height); }
+    return (ret == XED_E_ABORT) ? 0 : 1;
+}
+
+
 int main(int argc, char *argv[])
 {
     int ret = 0;
@@ -239,6 +630,14 @@ int main(int argc, char *argv[])
     int positional;
     int i;
     const char *infile = NULL;
+    int flags = 0;
+    int numThreads = 0;
+    int readahead = 0;
+    const char *npyfile = NULL;
+    double startTime = 0, duration = 0, endTime = 0;
+    int stride = 1;
+    int every = 0;
+    int streamImages = 0;
     
     fprintf(stderr, "XED File Format Parser\n");
     fprintf(stderr, "2013, Dan Jackson\n");
@@ -248,7 +647,29 @@ int main(int argc, char *argv[])
     for (i = 1; i < argc; i++)
     {
         if (!strcasecmp(argv[i], "--help")) { help = 1; break; }
-        else if (argv[i][0] == '-')
+        else if (!strcasecmp(argv[i], "--mmap")) { flags |= XED_READER_MAPPED; }
+        else if (!strcasecmp(argv[i], "--index-cache")) { flags |= XED_READER_INDEX_CACHE; }
+        else if (!strcasecmp(argv[i], "--recover")) { flags |= XED_READER_RECOVER; }
+        else if (!strcasecmp(argv[i], "--direct")) { flags |= XED_READER_DIRECT; }
+        else if (!strcasecmp(argv[i], "--stats")) { showStats = 1; }
+        else if (!strcasecmp(argv[i], "--threads") && i + 1 < argc) { numThreads = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--readahead") && i + 1 < argc) { readahead = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--npy") && i + 1 < argc) { npyfile = argv[++i]; }
+        else if (!strcasecmp(argv[i], "--start") && i + 1 < argc) { startTime = atof(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--duration") && i + 1 < argc) { duration = atof(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--end") && i + 1 < argc) { endTime = atof(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--stride") && i + 1 < argc) { stride = atoi(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--every") && i + 1 < argc) { every = atoi(argv[++i]); if (every < 1) { fprintf(stderr, "ERROR: Invalid snapshot interval.\n"); help = 1; break; } }
+        else if (!strcasecmp(argv[i], "--image-stream")) { streamImages = 1; }
+        else if (!strcasecmp(argv[i], "--image-format") && i + 1 < argc)
+        {
+            i++;
+            if (!strcasecmp(argv[i], "bmp")) { imageFormat = IMAGE_FORMAT_BMP; }
+            else if (!strcasecmp(argv[i], "pgm")) { imageFormat = IMAGE_FORMAT_PGM; }
+            else if (!strcasecmp(argv[i], "ppm")) { imageFormat = IMAGE_FORMAT_PPM; }
+            else { fprintf(stderr, "ERROR: Unknown image format: %s\n", argv[i]); help = 1; break; }
+        }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0')
         {
             fprintf(stderr, "ERROR: Unknown option: %s\n", argv[i]); 
             help = 1;
@@ -271,18 +692,48 @@ int main(int argc, char *argv[])
     }
     
     if (infile == NULL) { fprintf(stderr, "ERROR: Input file not specified.\n"); help = 1; }
+    if (duration > 0) { endTime = startTime + duration; }
+    if (!help && (startTime < 0 || duration < 0 || (endTime != 0 && endTime <= startTime) || stride < 1)) { fprintf(stderr, "ERROR: Invalid export selection.\n"); help = 1; }
+    if (!help && npyfile != NULL && !strcmp(infile, "-")) { fprintf(stderr, "ERROR: Export needs an indexed input file (not stdin).\n"); help = 1; }
     
     if (help)
     {
         fprintf(stderr, "\n");
-        fprintf(stderr, "Usage: xed_decode <input.xed>\n");
+        fprintf(stderr, "Usage: xed_decode [--mmap | --direct] [--index-cache] [--recover] [--stats] [--threads <n> | --readahead <n>] <input.xed>\n");
+        fprintf(stderr, "       xed_decode - < <input.xed>\n");
+        fprintf(stderr, "       xed_decode [--mmap] --npy <depth.npy> [--start <s>] [--duration <s> | --end <s>] [--stride <n>] <input.xed>\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "  -              Read forward-only from stdin (e.g. a pipe, or a recording still being written), in file order, ignoring the index\n");
+        fprintf(stderr, "  --mmap         Read the file through a memory mapping rather than buffered reads\n");
+        fprintf(stderr, "  --direct       Read with direct I/O, so a pass over a large recording does not fill the page cache\n");
+        fprintf(stderr, "  --index-cache  Load the indexes from <input.xed>.idx, (re)writing it if it is missing or stale\n");
+        fprintf(stderr, "  --recover      Rebuild a missing or damaged index (e.g. truncated recording) by scanning the events (with --index-cache, saves the repaired index)\n");
+        fprintf(stderr, "  --stats        Report the bytes, reads, seeks and time spent reading metadata and payloads\n");
+        fprintf(stderr, "  --threads <n>  Convert snapshots on <n> worker threads, with separate reader and writer stages (0 = single-threaded)\n");
+        fprintf(stderr, "  --readahead <n> Single-threaded, but read up to <n> packets ahead on a background thread\n");
+        fprintf(stderr, "  --every <n>    Snapshot every <n>th depth and color frame (default: every 30th depth, every 10th color frame)\n");
+        fprintf(stderr, "  --image-format bmp|pgm|ppm  Snapshot images as BMP (default), PGM (12-bit depth values) or PPM (colorized depth); color snapshots are PGM unless BMP\n");
+        fprintf(stderr, "  --image-stream Append the snapshots to one file for each frame type (out16.*, out32.*), rather than a file each\n");
+        fprintf(stderr, "  --npy <file>   Export the depth frames as one uint16[frames][height][width] .npy volume (depth in mm), rather than snapshots\n");
+        fprintf(stderr, "  --start <s>    Export from this time (seconds from the start of the recording), --duration <s> or --end <s> to stop early\n");
+        fprintf(stderr, "  --stride <n>   Export every <n>th depth frame\n");
         fprintf(stderr, "\n");
         ret = -1;
     }
     else
     {
         fprintf(stderr, "NOTE: Processing: %s\n", infile); 
-        ret = xed_decode(infile);
+        if (every > 0) { snapshotEvery0 = snapshotEvery1 = every; }
+        if (streamImages)
+        {
+            imageStream0 = ImageStreamOpen((imageFormat == IMAGE_FORMAT_BMP) ? "out16.bmp" : (imageFormat == IMAGE_FORMAT_PGM) ? "out16.pgm" : "out16.ppm");
+            imageStream1 = ImageStreamOpen((imageFormat == IMAGE_FORMAT_BMP) ? "out32.bmp" : "out32.pgm");
+            if (imageStream0 == NULL || imageStream1 == NULL) { fprintf(stderr, "WARNING: Problem creating image stream files, writing a file for each snapshot.\n"); }
+        }
+        if (npyfile != NULL) { ret = xed_export_npy(infile, flags, npyfile, startTime, endTime, stride); }
+        else { ret = xed_decode(infile, flags, numThreads, readahead); }
+        if (imageStream0 != NULL) { ImageStreamClose(imageStream0); }
+        if (imageStream1 != NULL) { ImageStreamClose(imageStream1); }
         fprintf(stderr, "NOTE: End processing\n"); 
     }
    
@@ -0,0 +1,334 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Frame Cache -- recently used event payloads (raw or unpacked), under a byte budget with LRU eviction
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+#include "xed_thread.h"
+
+
+// A cached event
+typedef struct xed_frame_entry
+{
+    int stream;
+    int index;
+    xed_event_t event;
+    xed_frame_info_t frameInfo;
+    void *data;                     // Payload (owned, unless it points into the reader's file mapping)
+    int owned;
+    size_t length;
+    size_t charged;                 // Bytes counted towards the budget (the entry itself, and its payload if owned)
+    int refCount;                   // Views returned and not yet released
+    int loading;                    // Being read by one thread (others wait for it)
+    int ret;                        // Result of the load
+    struct xed_frame_entry *hashNext;
+    struct xed_frame_entry *lruPrev;   // Towards the most recently used
+    struct xed_frame_entry *lruNext;   // Towards the least recently used
+} xed_frame_entry_t;
+
+typedef struct xed_frame_cache
+{
+    xed_reader_t *reader;
+    size_t budget;
+    xed_frame_unpack_t unpack;
+    void *unpackArg;
+    xed_frame_entry_t **buckets;
+    unsigned int numBuckets;        // Power of two
+    xed_frame_entry_t *lruHead;     // Most recently used
+    xed_frame_entry_t *lruTail;     // Least recently used
+    xed_frame_cache_stats_t stats;
+    xed_mutex_t mutex;
+    xed_cond_t loaded;
+} xed_frame_cache_t;
+
+
+static unsigned int XedFrameCacheHash(int stream, int index)
+{
+    uint32_t h = (uint32_t)index * 2654435761u ^ (uint32_t)(stream + 1) * 40503u;
+    return h ^ (h >> 15);
+}
+
+static xed_frame_entry_t **XedFrameCacheFind(xed_frame_cache_t *cache, int stream, int index)
+{
+    xed_frame_entry_t **link = &cache->buckets[XedFrameCacheHash(stream, index) & (cache->numBuckets - 1)];
+    while (*link != NULL && ((*link)->stream != stream || (*link)->index != index)) { link = &(*link)->hashNext; }
+    return link;
+}
+
+static void XedFrameCacheUnlink(xed_frame_cache_t *cache, xed_frame_entry_t *entry)
+{
+    if (entry->lruPrev == NULL && cache->lruHead != entry) { return; }   // Not in the list (still loading, or failed)
+    if (entry->lruPrev != NULL) { entry->lruPrev->lruNext = entry->lruNext; } else { cache->lruHead = entry->lruNext; }
+    if (entry->lruNext != NULL) { entry->lruNext->lruPrev = entry->lruPrev; } else { cache->lruTail = entry->lruPrev; }
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void XedFrameCacheMakeRecent(xed_frame_cache_t *cache, xed_frame_entry_t *entry)
+{
+    if (cache->lruHead == entry) { return; }
+    XedFrameCacheUnlink(cache, entry);
+    entry->lruNext = cache->lruHead;
+    if (cache->lruHead != NULL) { cache->lruHead->lruPrev = entry; } else { cache->lruTail = entry; }
+    cache->lruHead = entry;
+}
+
+// Remove an entry from the cache and free it
+static void XedFrameCacheRemove(xed_frame_cache_t *cache, xed_frame_entry_t *entry)
+{
+    xed_frame_entry_t **link = XedFrameCacheFind(cache, entry->stream, entry->index);
+    if (*link == entry) { *link = entry->hashNext; }
+    XedFrameCacheUnlink(cache, entry);
+    cache->stats.bytesCached -= entry->charged;
+    cache->stats.entries--;
+    if (entry->owned) { free(entry->data); }
+    free(entry);
+}
+
+// Evict the least recently used entries (not in use) until within the budget
+static void XedFrameCacheTrim(xed_frame_cache_t *cache)
+{
+    xed_frame_entry_t *entry = cache->lruTail;
+    while (entry != NULL && cache->stats.bytesCached > cache->budget)
+    {
+        xed_frame_entry_t *prev = entry->lruPrev;
+        if (entry->refCount == 0 && !entry->loading)
+        {
+            XedFrameCacheRemove(cache, entry);
+            cache->stats.evictions++;
+        }
+        entry = prev;
+    }
+}
+
+// Double the hash table size (keeps the chains short)
+static void XedFrameCacheGrow(xed_frame_cache_t *cache)
+{
+    unsigned int numBuckets = cache->numBuckets * 2;
+    xed_frame_entry_t **buckets = (xed_frame_entry_t **)calloc(numBuckets, sizeof(xed_frame_entry_t *));
+    unsigned int i;
+
+    if (buckets == NULL) { return; }                        // Stays at the current size
+    for (i = 0; i < cache->numBuckets; i++)
+    {
+        xed_frame_entry_t *entry = cache->buckets[i];
+        while (entry != NULL)
+        {
+            xed_frame_entry_t *next = entry->hashNext;
+            unsigned int b = XedFrameCacheHash(entry->stream, entry->index) & (numBuckets - 1);
+            entry->hashNext = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->numBuckets = numBuckets;
+}
+
+// Read (and unpack) an event's payload into an entry (called without the lock held)
+static int XedFrameCacheLoad(xed_frame_cache_t *cache, xed_frame_entry_t *entry)
+{
+    xed_event_view_t raw;
+    int ret;
+
+    ret = XedMapEvent(cache->reader, entry->stream, entry->index, &raw);
+    if (ret != XED_OK) { return ret; }
+    entry->event = raw.event;
+    entry->frameInfo = raw.frameInfo;
+
+    if (cache->unpack != NULL)
+    {
+        void *data = NULL;
+        size_t length = 0;
+        ret = cache->unpack(cache->unpackArg, &raw, &data, &length);
+        XedUnmapEvent(cache->reader, &raw);
+        if (ret != XED_OK) { free(data); return ret; }
+        entry->data = data;
+        entry->owned = 1;
+        entry->length = length;
+    }
+    else if (raw._buffer != NULL)
+    {
+        // Keep the copy that was read
+        entry->data = raw._buffer;
+        entry->owned = 1;
+        entry->length = raw.length;
+    }
+    else
+    {
+        // A mapped reader's payload is already in memory: only the header is cached (and only the entry counts towards the budget)
+        entry->data = (void *)raw.data;
+        entry->owned = 0;
+        entry->length = raw.length;
+    }
+
+    return XED_OK;
+}
+
+
+xed_frame_cache_t *XedNewFrameCache(xed_reader_t *reader, size_t budget, xed_frame_unpack_t unpack, void *unpackArg)
+{
+    xed_frame_cache_t *cache;
+
+    if (reader == NULL) { return NULL; }                    // XED_E_POINTER
+
+    cache = (xed_frame_cache_t *)malloc(sizeof(xed_frame_cache_t));
+    if (cache == NULL) { return NULL; }                     // XED_E_OUT_OF_MEMORY
+    memset(cache, 0, sizeof(xed_frame_cache_t));
+    cache->reader = reader;
+    cache->budget = budget;
+    cache->unpack = unpack;
+    cache->unpackArg = unpackArg;
+    cache->numBuckets = 64;
+    cache->buckets = (xed_frame_entry_t **)calloc(cache->numBuckets, sizeof(xed_frame_entry_t *));
+    if (cache->buckets == NULL) { free(cache); return NULL; }
+
+    XedMutexInit(&cache->mutex);
+    XedCondInit(&cache->loaded);
+    return cache;
+}
+
+
+int XedFrameCacheGet(xed_frame_cache_t *cache, int stream, int index, xed_event_view_t *view)
+{
+    xed_frame_entry_t **link;
+    xed_frame_entry_t *entry;
+    int ret;
+
+    if (cache == NULL || view == NULL) { return XED_E_POINTER; }
+    memset(view, 0, sizeof(xed_event_view_t));
+
+    XedMutexLock(&cache->mutex);
+
+    link = XedFrameCacheFind(cache, stream, index);
+    entry = *link;
+    if (entry != NULL)
+    {
+        // Hit (possibly still being loaded by another thread)
+        cache->stats.hits++;
+        XedStatsAdd(cache->reader, cacheHits, 1);
+        entry->refCount++;
+        while (entry->loading) { XedCondWait(&cache->loaded, &cache->mutex); }
+    }
+    else
+    {
+        // Miss: add a placeholder, so other threads wait for this load rather than repeat it, then load without the lock
+        cache->stats.misses++;
+        entry = (xed_frame_entry_t *)malloc(sizeof(xed_frame_entry_t));
+        if (entry == NULL) { XedMutexUnlock(&cache->mutex); return XED_E_OUT_OF_MEMORY; }
+        memset(entry, 0, sizeof(xed_frame_entry_t));
+        entry->stream = stream;
+        entry->index = index;
+        entry->refCount = 1;
+        entry->loading = 1;
+        *link = entry;
+        cache->stats.entries++;
+        if ((unsigned int)cache->stats.entries > cache->numBuckets) { XedFrameCacheGrow(cache); }
+        XedMutexUnlock(&cache->mutex);
+
+        ret = XedFrameCacheLoad(cache, entry);
+
+        XedMutexLock(&cache->mutex);
+        entry->ret = ret;
+        entry->loading = 0;
+        if (ret == XED_OK)
+        {
+            entry->charged = sizeof(xed_frame_entry_t) + (entry->owned ? entry->length : 0);
+            cache->stats.bytesCached += entry->charged;
+        }
+        XedCondBroadcast(&cache->loaded);
+    }
+
+    ret = entry->ret;
+    if (ret != XED_OK)
+    {
+        // Failed loads are not kept (the last waiter removes the entry)
+        if (--entry->refCount == 0) { XedFrameCacheRemove(cache, entry); }
+        XedMutexUnlock(&cache->mutex);
+        return ret;
+    }
+
+    XedFrameCacheMakeRecent(cache, entry);
+    XedFrameCacheTrim(cache);
+    XedMutexUnlock(&cache->mutex);
+
+    view->event = entry->event;
+    view->frameInfo = entry->frameInfo;
+    view->data = entry->data;
+    view->length = entry->length;
+    view->_buffer = entry;
+    return XED_OK;
+}
+
+
+int XedFrameCacheRelease(xed_frame_cache_t *cache, xed_event_view_t *view)
+{
+    xed_frame_entry_t *entry;
+
+    if (cache == NULL || view == NULL) { return XED_E_POINTER; }
+    entry = (xed_frame_entry_t *)view->_buffer;
+    if (entry == NULL) { return XED_E_INVALID_ARG; }
+
+    XedMutexLock(&cache->mutex);
+    entry->refCount--;
+    if (entry->refCount == 0 && cache->stats.bytesCached > cache->budget) { XedFrameCacheTrim(cache); }
+    XedMutexUnlock(&cache->mutex);
+
+    memset(view, 0, sizeof(xed_event_view_t));
+    return XED_OK;
+}
+
+
+int XedFrameCacheGetStats(xed_frame_cache_t *cache, xed_frame_cache_stats_t *stats)
+{
+    if (cache == NULL || stats == NULL) { return XED_E_POINTER; }
+    XedMutexLock(&cache->mutex);
+    *stats = cache->stats;
+    XedMutexUnlock(&cache->mutex);
+    return XED_OK;
+}
+
+
+int XedCloseFrameCache(xed_frame_cache_t *cache)
+{
+    if (cache == NULL) { return XED_E_POINTER; }
+
+    // (All views should have been released)
+    while (cache->lruHead != NULL) { XedFrameCacheRemove(cache, cache->lruHead); }
+    XedCondDestroy(&cache->loaded);
+    XedMutexDestroy(&cache->mutex);
+    free(cache->buckets);
+    free(cache);
+    return XED_OK;
+}
@@ -0,0 +1,119 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED File Format Parser -- reader internals shared between the library modules (not part of the library interface)
+// Dan Jackson, 2013
+
+
+#ifndef XED_INTERNAL_H
+#define XED_INTERNAL_H
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "xed/xed.h"
+#include "xed_thread.h"
+
+
+// Reader state structure
+typedef struct xed_reader
+{
+#ifdef _WIN32
+    HANDLE file;                    // Open file (INVALID_HANDLE_VALUE if none)
+    HANDLE mapHandle;
+#else
+    int fd;                         // Open file (-1 if none)
+#endif
+    uint64_t fileSize;
+    uint64_t fileTime;              // Last modification time (seconds on POSIX, 100 ns units on Windows)
+    const unsigned char *map;       // Read-only view of the whole file (NULL if not mapped)
+    uint64_t mapSize;
+    unsigned char *scratch;         // Unmapped metadata reads only: holds the most recently fetched bytes
+    size_t scratchSize;
+    const unsigned char *indexCache;// Read-only view of the index cache file that the indexes point into (NULL if the indexes are allocated)
+    uint64_t indexCacheSize;
+    xed_file_header_t header;
+    xed_end_stream_info_t streamInfo[XED_MAX_STREAMS];
+    xed_index_t *streamIndex[XED_MAX_STREAMS];
+    int totalEvents;
+    xed_index_t *globalIndex;       // All streams' entries, in file order
+    uint32_t streamMask;            // Streams to index (bit n for stream n)
+    uint64_t *indexOffsets[XED_MAX_STREAMS];    // File offsets of each stream's index blocks (from the end information)
+    volatile int streamLoaded[XED_MAX_STREAMS]; // Stream index loaded on first use: 0 = not yet, 1 = loaded, or the error from loading it
+    volatile int globalLoaded;      // Global index built on first use (as streamLoaded)
+    xed_mutex_t loadMutex;          // Held while loading an index
+    xed_reader_stats_t stats;       // Counters (XedStatsAdd)
+    volatile uint64_t lastReadEnd;  // File offset after the last read (for counting seeks)
+    int direct;                     // XED_READER_DIRECT: 0 (off), XED_DIRECT_IO or XED_DIRECT_DROP
+    unsigned char *directBuffer;    // XED_DIRECT_IO: aligned window of the file, reads are copied from it (held under directMutex)
+    size_t directBufferSize;
+    uint64_t directOffset;          // File offset of the window (aligned)
+    size_t directLength;            // Bytes in the window
+    xed_mutex_t directMutex;
+} xed_reader_t;
+
+#define XED_DIRECT_IO   1           // The file is open for direct I/O (all reads are aligned, through the window)
+#define XED_DIRECT_DROP 2           // Direct I/O is not supported: buffered reads, then the pages are dropped from the cache
+
+
+// xed.c: diagnostics (XedLog is level-gated, XED_TRACE is compiled out of release builds: XED_TRACE(("format", ...)))
+void XedLog(int level, const char *format, ...);
+void XedTrace(const char *format, ...);
+#if defined(XED_DEBUG) || defined(_DEBUG)
+#define XED_TRACE(args) XedTrace args
+#else
+#define XED_TRACE(args) ((void)0)
+#endif
+
+// xed.c: reader statistics
+uint64_t XedStatsClock(void);                                                           // Monotonic nanoseconds
+void XedStatsRead(xed_reader_t *reader, uint64_t offset, uint64_t length, int calls);   // Count bytes read (or copied from the mapping), and the read calls made
+#define XedStatsAdd(reader, counter, amount) XedAtomicAdd64((volatile uint64_t *)&(reader)->stats.counter, (uint64_t)(amount))
+
+// xed.c: decoding of the on-disk structures
+void XedDecodeEvent(const unsigned char *p, xed_event_t *event);                        // Event header (24 bytes, little-endian)
+void XedDecodeEventFrameInfo(const unsigned char *p, xed_frame_info_t *frameInfo);     // Event frame information (24 bytes, big-endian)
+int XedCheckHeader(const unsigned char *p, size_t length, uint64_t offset, uint32_t numStreams, uint64_t fileSize);    // Consistent event, index block or end information header?
+
+// xed.c: event access
+int XedReadAt(xed_reader_t *reader, uint64_t offset, void *buffer, size_t length);      // Copy bytes from the file (safe to call concurrently)
+#ifndef _WIN32
+struct iovec;
+int64_t XedReadVectorAt(xed_reader_t *reader, uint64_t offset, struct iovec *iov, int iovcnt);     // Vectored positional read from the file (not the mapping), short at the end of the file, -1 on error
+#endif
+int XedParseEventHeader(xed_reader_t *reader, const unsigned char *header, size_t headerLength, xed_event_t *event, xed_frame_info_t *frameInfo, size_t *headerSize, size_t *payloadSize);   // headerLength 48 (or to the end of the file)
+int XedLocateEvent(xed_reader_t *reader, int stream, int index, xed_event_t *event, xed_frame_info_t *frameInfo, uint64_t *payloadOffset, size_t *payloadSize);
+
+// xed_writer.c: encoding of the on-disk structures
+void XedEncodeEvent(unsigned char *p, const xed_event_t *event);                        // Event header (24 bytes, little-endian)
+void XedEncodeEventFrameInfo(unsigned char *p, const xed_frame_info_t *frameInfo);     // Event frame information (24 bytes, big-endian)
+
+// xed_cache.c: sidecar index cache (<file>.idx)
+int XedIndexCacheLoad(xed_reader_t *reader, const char *cacheFilename);     // Point the indexes into the cache, if it is valid for the open file
+int XedIndexCacheSave(const xed_reader_t *reader, const char *cacheFilename);
+void XedIndexCacheClose(xed_reader_t *reader);
+
+#endif
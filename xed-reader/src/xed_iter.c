@@ -0,0 +1,174 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Event Iterator -- a selection of events (streams, time window, stride, count) resolved from the indexes, read in file order
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+
+
+// A selected event
+typedef struct
+{
+    uint64_t offset;                // File offset (the reading order)
+    int stream;
+    int index;                      // Index in the stream
+} xed_iterator_item_t;
+
+typedef struct xed_iterator
+{
+    xed_reader_t *reader;
+    xed_iterator_item_t *items;
+    int count;
+    int next;
+    xed_event_view_t view;          // The most recently returned event (released on the next call)
+} xed_iterator_t;
+
+
+static int XedIteratorCompare(const void *a, const void *b)
+{
+    const xed_iterator_item_t *itemA = (const xed_iterator_item_t *)a;
+    const xed_iterator_item_t *itemB = (const xed_iterator_item_t *)b;
+    if (itemA->offset < itemB->offset) { return -1; }
+    if (itemA->offset > itemB->offset) { return 1; }
+    return itemA->stream - itemB->stream;
+}
+
+// Range [*first, *last) of a stream's events within the filter's time window (all events if there is no window)
+static void XedIteratorRange(xed_reader_t *reader, int stream, int numEvents, const xed_filter_t *filter, int *first, int *last)
+{
+    *first = 0;
+    *last = numEvents;
+    if (filter->startTime == 0 && filter->endTime == 0) { return; }
+
+    // Only timestamped events can be in a time window
+    *first = XedFindEventByTime(reader, stream, filter->startTime, XED_FIND_CEIL);
+    if (*first < 0) { *first = *last = 0; return; }
+    if (filter->endTime != 0)
+    {
+        int end = XedFindEventByTime(reader, stream, filter->endTime, XED_FIND_CEIL);
+        if (end >= 0) { *last = end; }
+    }
+    if (*last < *first) { *last = *first; }
+}
+
+
+xed_iterator_t *XedNewIterator(xed_reader_t *reader, const xed_filter_t *filter)
+{
+    static const xed_filter_t all = {0};
+    xed_iterator_t *iterator;
+    int stride, capacity = 0;
+    int stream;
+
+    if (reader == NULL) { return NULL; }                    // XED_E_POINTER
+    if (filter == NULL) { filter = &all; }
+    stride = (filter->stride > 1) ? filter->stride : 1;
+
+    iterator = (xed_iterator_t *)malloc(sizeof(xed_iterator_t));
+    if (iterator == NULL) { return NULL; }                  // XED_E_OUT_OF_MEMORY
+    memset(iterator, 0, sizeof(xed_iterator_t));
+    iterator->reader = reader;
+
+    // Resolve the selection from the stream indexes (only the selected streams' indexes are loaded)
+    for (stream = 0; stream < XED_MAX_STREAMS && stream < (int)reader->header.numStreams; stream++)
+    {
+        int numEvents, first, last, i;
+
+        if (filter->streamMask != 0 && !(filter->streamMask & (1u << stream))) { continue; }
+        numEvents = XedGetNumEvents(reader, stream);
+        if (numEvents <= 0) { continue; }                   // (Including streams the reader does not index)
+        XedIteratorRange(reader, stream, numEvents, filter, &first, &last);
+
+        for (i = first; i < last; i += stride)
+        {
+            const xed_index_t *entry = XedGetIndexEntry(reader, stream, i);
+            if (entry == NULL) { XedCloseIterator(iterator); return NULL; }    // XED_E_INVALID_DATA
+            if (iterator->count >= capacity)
+            {
+                int newCapacity = capacity ? 2 * capacity : 256;
+                xed_iterator_item_t *newItems = (xed_iterator_item_t *)realloc(iterator->items, newCapacity * sizeof(xed_iterator_item_t));
+                if (newItems == NULL) { XedCloseIterator(iterator); return NULL; }  // XED_E_OUT_OF_MEMORY
+                iterator->items = newItems;
+                capacity = newCapacity;
+            }
+            iterator->items[iterator->count].offset = entry->indexEntry.frameFileOffset;
+            iterator->items[iterator->count].stream = stream;
+            iterator->items[iterator->count].index = i;
+            iterator->count++;
+        }
+    }
+
+    // Read in file order (sequential I/O across the streams), limited to the first maxCount events
+    if (iterator->count > 1) { qsort(iterator->items, iterator->count, sizeof(xed_iterator_item_t), XedIteratorCompare); }
+    if (filter->maxCount > 0 && iterator->count > filter->maxCount) { iterator->count = filter->maxCount; }
+
+    return iterator;
+}
+
+
+int XedIteratorCount(xed_iterator_t *iterator)
+{
+    if (iterator == NULL) { return XED_E_POINTER; }
+    return iterator->count;
+}
+
+
+int XedIteratorNext(xed_iterator_t *iterator, xed_event_view_t *view, int *index)
+{
+    const xed_iterator_item_t *item;
+    int ret;
+
+    if (iterator == NULL || view == NULL) { return XED_E_POINTER; }
+    XedUnmapEvent(iterator->reader, &iterator->view);
+    memset(view, 0, sizeof(xed_event_view_t));
+    if (iterator->next >= iterator->count) { return XED_E_ABORT; }
+
+    item = &iterator->items[iterator->next++];
+    ret = XedMapEvent(iterator->reader, item->stream, item->index, &iterator->view);
+    if (ret != XED_OK) { return ret; }
+
+    *view = iterator->view;
+    view->_buffer = NULL;                                   // (Owned by the iterator)
+    if (index != NULL) { *index = item->index; }
+    return XED_OK;
+}
+
+
+int XedCloseIterator(xed_iterator_t *iterator)
+{
+    if (iterator == NULL) { return XED_E_POINTER; }
+    XedUnmapEvent(iterator->reader, &iterator->view);
+    free(iterator->items);
+    free(iterator);
+    return XED_OK;
+}
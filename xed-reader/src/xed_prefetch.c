@@ -0,0 +1,263 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Readahead -- a background thread reads the following events into a ring of buffers for sequential playback
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+#include "xed_thread.h"
+
+
+#define XED_PREFETCH_DEFAULT_DEPTH 8
+
+// A ring slot: one read-ahead event (the buffer is kept and grown for later events)
+typedef struct
+{
+    int ret;                        // Result of reading the event (XED_OK, or the error to report in its place)
+    xed_event_t event;
+    xed_frame_info_t frameInfo;
+    unsigned char *buffer;
+    size_t bufferSize;
+    size_t length;                  // Payload bytes in the buffer
+} xed_prefetch_slot_t;
+
+// Readahead state: slots [head, head + count) are filled in event order, the consumer holds slot 'held' until its next call
+typedef struct xed_prefetch
+{
+    xed_reader_t *reader;
+    int stream;
+    int nextIndex;                  // Next event for the thread to read
+    int endIndex;
+    int capacity;                   // Number of slots (queue depth, plus one held by the consumer)
+    size_t memoryBudget;            // Maximum payload bytes queued (0 = unlimited)
+    xed_prefetch_slot_t *slots;
+    int head;
+    int count;                      // Slots filled (including the held slot)
+    int held;                       // Slot returned by the last XedPrefetchNext (-1 if none)
+    size_t bytesQueued;             // Payload bytes in the filled slots
+    int done;                       // Thread has read its last event (or failed)
+    int stop;                       // Closing: the thread should exit
+    xed_prefetch_stats_t stats;
+    xed_thread_t thread;
+    xed_mutex_t mutex;
+    xed_cond_t changed;
+} xed_prefetch_t;
+
+
+// Whether another event of the given size can be queued
+static int XedPrefetchHasRoom(const xed_prefetch_t *prefetch, size_t length)
+{
+    if (prefetch->count >= prefetch->capacity) { return 0; }
+    if (prefetch->memoryBudget > 0 && prefetch->count > (prefetch->held >= 0 ? 1 : 0) && prefetch->bytesQueued + length > prefetch->memoryBudget) { return 0; }  // Always allow one queued event, however large
+    return 1;
+}
+
+static XED_THREAD_FUNC XedPrefetchThread(void *arg)
+{
+    xed_prefetch_t *prefetch = (xed_prefetch_t *)arg;
+
+    for (;;)
+    {
+        xed_prefetch_slot_t *slot;
+        xed_event_t event;
+        xed_frame_info_t frameInfo;
+        uint64_t offset = 0;
+        size_t size = 0;
+        int index, ret;
+
+        memset(&event, 0, sizeof(event));
+        memset(&frameInfo, 0, sizeof(frameInfo));
+        index = prefetch->nextIndex;                        // Only changed by this thread
+
+        // Locate the next event (so its size is known), then wait for room in the ring
+        if (index >= prefetch->endIndex) { ret = XED_E_ABORT; }
+        else { ret = XedLocateEvent(prefetch->reader, prefetch->stream, index, &event, &frameInfo, &offset, &size); }
+        if (ret != XED_OK) { size = 0; }
+
+        XedMutexLock(&prefetch->mutex);
+        if (!prefetch->stop && !XedPrefetchHasRoom(prefetch, size))
+        {
+            prefetch->stats.fullWaits++;                    // The ring is full: the consumer is slower than the reads
+            while (!prefetch->stop && !XedPrefetchHasRoom(prefetch, size)) { XedCondWait(&prefetch->changed, &prefetch->mutex); }
+        }
+        if (prefetch->stop) { XedMutexUnlock(&prefetch->mutex); break; }
+        slot = &prefetch->slots[(prefetch->head + prefetch->count) % prefetch->capacity];
+        XedMutexUnlock(&prefetch->mutex);
+
+        // Read the payload into the free slot (outside the lock: the consumer never touches unfilled slots)
+        if (ret == XED_OK && size > slot->bufferSize)
+        {
+            unsigned char *newBuffer = (unsigned char *)realloc(slot->buffer, size);
+            if (newBuffer == NULL) { ret = XED_E_OUT_OF_MEMORY; }
+            else { slot->buffer = newBuffer; slot->bufferSize = size; }
+        }
+        if (ret == XED_OK && size > 0)
+        {
+            uint64_t start = XedStatsClock();
+            if (XedReadAt(prefetch->reader, offset, slot->buffer, size) != XED_OK) { ret = XED_E_ACCESS_DENIED; }
+            XedStatsAdd(prefetch->reader, payloadTime, XedStatsClock() - start);
+        }
+        slot->ret = ret;
+        slot->event = event;
+        slot->frameInfo = frameInfo;
+        slot->length = (ret == XED_OK) ? size : 0;
+
+        // Publish the slot (an error or the end is queued in place of the event, and ends the readahead)
+        XedMutexLock(&prefetch->mutex);
+        prefetch->count++;
+        prefetch->bytesQueued += slot->length;
+        prefetch->nextIndex = index + 1;
+        if (ret == XED_OK) { prefetch->stats.eventsRead++; prefetch->stats.bytesRead += slot->length; }
+        else { prefetch->done = 1; }
+        XedCondBroadcast(&prefetch->changed);
+        XedMutexUnlock(&prefetch->mutex);
+
+        if (ret != XED_OK) { break; }
+    }
+
+    return 0;
+}
+
+
+xed_prefetch_t *XedNewPrefetch(xed_reader_t *reader, int stream, int firstIndex, int queueDepth, size_t memoryBudget)
+{
+    xed_prefetch_t *prefetch;
+    int numEvents;
+
+    if (reader == NULL) { return NULL; }                    // XED_E_POINTER
+    numEvents = XedGetNumEvents(reader, stream);
+    if (numEvents < 0 || firstIndex < 0) { return NULL; }   // XED_E_INVALID_ARG
+    if (queueDepth <= 0) { queueDepth = XED_PREFETCH_DEFAULT_DEPTH; }
+
+    prefetch = (xed_prefetch_t *)malloc(sizeof(xed_prefetch_t));
+    if (prefetch == NULL) { return NULL; }                  // XED_E_OUT_OF_MEMORY
+    memset(prefetch, 0, sizeof(xed_prefetch_t));
+    prefetch->reader = reader;
+    prefetch->stream = stream;
+    prefetch->nextIndex = firstIndex;
+    prefetch->endIndex = numEvents;
+    prefetch->capacity = queueDepth + 1;
+    prefetch->memoryBudget = memoryBudget;
+    prefetch->held = -1;
+    prefetch->slots = (xed_prefetch_slot_t *)calloc(prefetch->capacity, sizeof(xed_prefetch_slot_t));
+    if (prefetch->slots == NULL) { free(prefetch); return NULL; }
+
+    XedMutexInit(&prefetch->mutex);
+    XedCondInit(&prefetch->changed);
+    if (XedThreadCreate(&prefetch->thread, XedPrefetchThread, prefetch) != 0)
+    {
+        XedCondDestroy(&prefetch->changed);
+        XedMutexDestroy(&prefetch->mutex);
+        free(prefetch->slots);
+        free(prefetch);
+        return NULL;                                        // XED_E_FAIL
+    }
+
+    return prefetch;
+}
+
+
+int XedPrefetchNext(xed_prefetch_t *prefetch, xed_event_view_t *view)
+{
+    xed_prefetch_slot_t *slot;
+    int ret;
+
+    if (prefetch == NULL || view == NULL) { return XED_E_POINTER; }
+    memset(view, 0, sizeof(xed_event_view_t));
+
+    XedMutexLock(&prefetch->mutex);
+
+    // Release the previously returned event
+    if (prefetch->held >= 0)
+    {
+        prefetch->bytesQueued -= prefetch->slots[prefetch->held].length;
+        prefetch->head = (prefetch->head + 1) % prefetch->capacity;
+        prefetch->count--;
+        prefetch->held = -1;
+        XedCondBroadcast(&prefetch->changed);
+    }
+
+    // Wait for the next event (a stall: the consumer has caught up with the reads)
+    if (prefetch->count == 0)
+    {
+        prefetch->stats.stalls++;
+        while (prefetch->count == 0) { XedCondWait(&prefetch->changed, &prefetch->mutex); }
+    }
+
+    slot = &prefetch->slots[prefetch->head];
+    ret = slot->ret;
+    if (ret == XED_OK)
+    {
+        prefetch->held = prefetch->head;
+        prefetch->stats.eventsReturned++;
+        view->event = slot->event;
+        view->frameInfo = slot->frameInfo;
+        view->data = slot->buffer;
+        view->length = slot->length;
+    }
+
+    XedMutexUnlock(&prefetch->mutex);
+    return ret;
+}
+
+
+int XedPrefetchGetStats(xed_prefetch_t *prefetch, xed_prefetch_stats_t *stats)
+{
+    if (prefetch == NULL || stats == NULL) { return XED_E_POINTER; }
+    XedMutexLock(&prefetch->mutex);
+    *stats = prefetch->stats;
+    stats->queued = prefetch->count - (prefetch->held >= 0 ? 1 : 0) - (prefetch->done ? 1 : 0);   // Not counting the held event, or the end
+    XedMutexUnlock(&prefetch->mutex);
+    return XED_OK;
+}
+
+
+int XedClosePrefetch(xed_prefetch_t *prefetch)
+{
+    int i;
+
+    if (prefetch == NULL) { return XED_E_POINTER; }
+
+    XedMutexLock(&prefetch->mutex);
+    prefetch->stop = 1;
+    XedCondBroadcast(&prefetch->changed);
+    XedMutexUnlock(&prefetch->mutex);
+    XedThreadJoin(prefetch->thread);
+
+    XedCondDestroy(&prefetch->changed);
+    XedMutexDestroy(&prefetch->mutex);
+    for (i = 0; i < prefetch->capacity; i++) { free(prefetch->slots[i].buffer); }
+    free(prefetch->slots);
+    free(prefetch);
+    return XED_OK;
+}
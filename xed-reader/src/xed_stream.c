@@ -0,0 +1,238 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Streaming Reader -- forward-only reads in file order (for pipes and stdin)
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+
+
+// Streaming reader state: only the current event is held, so memory use is constant however long the recording is
+typedef struct xed_stream
+{
+    FILE *fp;
+    xed_file_header_t header;
+    uint64_t offset;                                // File offset of the next byte to read
+    uint64_t lastOffset[XED_MAX_STREAMS];           // Offset of each stream's most recent event (to recognize the stream of an index block)
+    uint16_t additionalLength[XED_MAX_STREAMS];     // Frame information size per index entry, from each stream's initial event (0xffff if not seen)
+    unsigned char pending[24];                      // An event header that was read while skipping an index block
+    int hasPending;
+    unsigned char *buffer;                          // Payload of the current event (grows to the largest event)
+    size_t bufferSize;
+} xed_stream_t;
+
+
+// Read exactly the given number of bytes (returns the number read)
+static size_t XedStreamRead(xed_stream_t *stream, void *buffer, size_t length)
+{
+    size_t n = fread(buffer, 1, length, stream->fp);
+    stream->offset += n;
+    return n;
+}
+
+// Make sure the buffer holds at least the given number of bytes
+static int XedStreamReserve(xed_stream_t *stream, size_t length)
+{
+    if (length > stream->bufferSize)
+    {
+        unsigned char *newBuffer = (unsigned char *)realloc(stream->buffer, length);
+        if (newBuffer == NULL) { return XED_E_OUT_OF_MEMORY; }
+        stream->buffer = newBuffer;
+        stream->bufferSize = length;
+    }
+    return XED_OK;
+}
+
+// Read and discard bytes (the input cannot seek)
+static int XedStreamSkip(xed_stream_t *stream, uint64_t length)
+{
+    const size_t chunk = 64 * 1024;
+    if (XedStreamReserve(stream, chunk) != XED_OK) { return XED_E_OUT_OF_MEMORY; }
+    while (length > 0)
+    {
+        size_t n = (length < chunk) ? (size_t)length : chunk;
+        if (XedStreamRead(stream, stream->buffer, n) != n) { return XED_E_INVALID_DATA; }
+        length -= n;
+    }
+    return XED_OK;
+}
+
+// Skip an index block (after its 24-byte header): numEntries index entries, then the frame information for each entry
+static int XedStreamSkipIndex(xed_stream_t *stream, uint32_t numEntries)
+{
+    unsigned int numStreams = (stream->header.numStreams < XED_MAX_STREAMS) ? stream->header.numStreams : XED_MAX_STREAMS;
+    uint64_t lastEntryOffset;
+    unsigned int frameInfoSize = 0xffff;
+    unsigned int s;
+    size_t n;
+    int ret;
+
+    if (numEntries == 0) { return XED_OK; }
+
+    // Entries (only the last one is needed)
+    ret = XedStreamSkip(stream, (uint64_t)(numEntries - 1) * 24);
+    if (ret != XED_OK) { return ret; }
+    if (XedStreamRead(stream, stream->buffer, 24) != 24) { return XED_E_INVALID_DATA; }
+    lastEntryOffset = (uint64_t)stream->buffer[0] | ((uint64_t)stream->buffer[1] << 8) | ((uint64_t)stream->buffer[2] << 16) | ((uint64_t)stream->buffer[3] << 24) | ((uint64_t)stream->buffer[4] << 32) | ((uint64_t)stream->buffer[5] << 40) | ((uint64_t)stream->buffer[6] << 48) | ((uint64_t)stream->buffer[7] << 56);
+
+    // An index block is written after the last event it indexes: use that stream's frame information size
+    for (s = 0; s < numStreams; s++)
+    {
+        if (stream->lastOffset[s] == lastEntryOffset) { frameInfoSize = stream->additionalLength[s]; break; }
+    }
+
+    if (frameInfoSize == 0xffff)
+    {
+        XedLog(XED_LOG_ERROR, "Index block for a stream with no initial event (frame information size not known) @%llu.", (unsigned long long)(stream->offset - (uint64_t)numEntries * 24 - 24));
+        return XED_E_INVALID_DATA;
+    }
+    ret = XedStreamSkip(stream, (uint64_t)numEntries * frameInfoSize);
+    if (ret != XED_OK) { return ret; }
+
+    // The next header (kept for XedNextEvent) must be consistent, or the end of the input
+    n = XedStreamRead(stream, stream->pending, 24);
+    if (n == 0) { return XED_OK; }
+    if (n != 24 || !XedCheckHeader(stream->pending, 24, stream->offset - 24, stream->header.numStreams, 0))
+    {
+        XedLog(XED_LOG_ERROR, "Unexpected data after an index block @%llu.", (unsigned long long)(stream->offset - n));
+        return XED_E_INVALID_DATA;
+    }
+    stream->hasPending = 1;
+    return XED_OK;
+}
+
+
+xed_stream_t *XedOpenStream(FILE *fp)
+{
+    unsigned char p[24];
+    xed_stream_t *stream;
+    int i;
+
+    if (fp == NULL) { return NULL; }                        // XED_E_POINTER
+
+    stream = (xed_stream_t *)malloc(sizeof(xed_stream_t));
+    if (stream == NULL) { return NULL; }                    // XED_E_OUT_OF_MEMORY
+    memset(stream, 0, sizeof(xed_stream_t));
+    stream->fp = fp;
+    for (i = 0; i < XED_MAX_STREAMS; i++)
+    {
+        stream->lastOffset[i] = (uint64_t)-1;
+        stream->additionalLength[i] = 0xffff;
+    }
+
+    // Read header
+    if (XedStreamRead(stream, p, sizeof(p)) != sizeof(p) || memcmp(p, "EVENTS1\0", 8) != 0)
+    {
+        XedLog(XED_LOG_ERROR, "Stream header not the expected \"EVENTS1\".");
+        free(stream);
+        return NULL;                                        // XED_E_INVALID_DATA
+    }
+    memcpy(stream->header.fileType, p, sizeof(stream->header.fileType));
+    stream->header._version = (uint32_t)p[8] | ((uint32_t)p[9] << 8) | ((uint32_t)p[10] << 16) | ((uint32_t)p[11] << 24);
+    stream->header.numStreams = (uint32_t)p[12] | ((uint32_t)p[13] << 8) | ((uint32_t)p[14] << 16) | ((uint32_t)p[15] << 24);
+    stream->header.indexFileOffset = 0;                     // Not used (and usually not yet written while recording)
+
+    return stream;
+}
+
+
+int XedNextEvent(xed_stream_t *stream, xed_event_view_t *view)
+{
+    unsigned char header[24];
+    uint64_t offset;
+    int ret;
+
+    if (stream == NULL || view == NULL) { return XED_E_POINTER; }
+    memset(view, 0, sizeof(xed_event_view_t));
+
+    // Next event header, skipping any index blocks
+    for (;;)
+    {
+        offset = stream->offset;
+        if (stream->hasPending)
+        {
+            memcpy(header, stream->pending, sizeof(header));
+            stream->hasPending = 0;
+            offset -= sizeof(header);
+        }
+        else
+        {
+            size_t n = XedStreamRead(stream, header, sizeof(header));
+            if (n == 0) { return XED_E_ABORT; }             // End of input (without end information, e.g. still recording)
+            if (n < sizeof(header)) { return XED_E_INVALID_DATA; }
+        }
+        XedDecodeEvent(header, &view->event);
+        if (view->event.streamId != 0xffff) { break; }
+
+        ret = XedStreamSkipIndex(stream, view->event.length);
+        if (ret != XED_OK) { return ret; }
+    }
+
+    if (view->event.streamId == stream->header.numStreams) { return XED_E_ABORT; }     // End of file information
+    if (view->event.streamId > stream->header.numStreams) { XedLog(XED_LOG_ERROR, "Unexpected stream number %d.", view->event.streamId); return XED_E_INVALID_DATA; }
+
+    // Frame information (if timestamped)
+    if (view->event.timestamp != 0)
+    {
+        unsigned char frameInfo[24];
+        if (XedStreamRead(stream, frameInfo, sizeof(frameInfo)) != sizeof(frameInfo)) { return XED_E_INVALID_DATA; }
+        XedDecodeEventFrameInfo(frameInfo, &view->frameInfo);
+    }
+
+    // Payload
+    if (XedStreamReserve(stream, view->event.length) != XED_OK) { return XED_E_OUT_OF_MEMORY; }
+    if (XedStreamRead(stream, stream->buffer, view->event.length) != view->event.length) { return XED_E_INVALID_DATA; }
+    view->data = stream->buffer;
+    view->length = view->event.length;
+
+    // Remember the stream's most recent event, and its index frame information size (from the initial event)
+    if (view->event.streamId < XED_MAX_STREAMS)
+    {
+        stream->lastOffset[view->event.streamId] = offset;
+        if (stream->additionalLength[view->event.streamId] == 0xffff && view->event.timestamp == 0 && view->length >= 284)
+        {
+            stream->additionalLength[view->event.streamId] = (uint16_t)stream->buffer[282] | ((uint16_t)stream->buffer[283] << 8);
+        }
+    }
+
+    return XED_OK;
+}
+
+
+int XedCloseStream(xed_stream_t *stream)
+{
+    if (stream == NULL) { return XED_E_POINTER; }
+    free(stream->buffer);
+    free(stream);
+    return XED_OK;
+}
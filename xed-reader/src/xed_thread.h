@@ -0,0 +1,95 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// Minimal threading wrappers (pthreads / Win32) -- internal, not part of the library interface
+// Dan Jackson, 2013
+
+
+#ifndef XED_THREAD_H
+#define XED_THREAD_H
+
+#include <stdint.h>
+#ifdef _WIN32
+#include <windows.h>
+#define XED_INLINE __inline
+#else
+#include <pthread.h>
+#define XED_INLINE inline
+#endif
+
+
+#ifdef _WIN32
+
+typedef HANDLE xed_thread_t;
+typedef CRITICAL_SECTION xed_mutex_t;
+typedef CONDITION_VARIABLE xed_cond_t;
+#define XED_THREAD_FUNC DWORD WINAPI            // Thread function: static XED_THREAD_FUNC MyThread(void *arg) { ...; return 0; }
+typedef DWORD (WINAPI *xed_thread_func_t)(void *);
+
+static XED_INLINE int XedThreadCreate(xed_thread_t *thread, xed_thread_func_t func, void *arg) { *thread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)func, arg, 0, NULL); return (*thread != NULL) ? 0 : -1; }
+static XED_INLINE void XedThreadJoin(xed_thread_t thread) { WaitForSingleObject(thread, INFINITE); CloseHandle(thread); }
+static XED_INLINE void XedMutexInit(xed_mutex_t *mutex) { InitializeCriticalSection(mutex); }
+static XED_INLINE void XedMutexDestroy(xed_mutex_t *mutex) { DeleteCriticalSection(mutex); }
+static XED_INLINE void XedMutexLock(xed_mutex_t *mutex) { EnterCriticalSection(mutex); }
+static XED_INLINE void XedMutexUnlock(xed_mutex_t *mutex) { LeaveCriticalSection(mutex); }
+static XED_INLINE void XedCondInit(xed_cond_t *cond) { InitializeConditionVariable(cond); }
+static XED_INLINE void XedCondDestroy(xed_cond_t *cond) { (void)cond; }
+static XED_INLINE void XedCondWait(xed_cond_t *cond, xed_mutex_t *mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+static XED_INLINE void XedCondSignal(xed_cond_t *cond) { WakeConditionVariable(cond); }
+static XED_INLINE void XedCondBroadcast(xed_cond_t *cond) { WakeAllConditionVariable(cond); }
+static XED_INLINE int XedAtomicGet(volatile int *value) { return (int)InterlockedCompareExchange((volatile LONG *)value, 0, 0); }     // Acquire: later reads see writes made before the matching XedAtomicSet
+static XED_INLINE void XedAtomicSet(volatile int *value, int newValue) { InterlockedExchange((volatile LONG *)value, (LONG)newValue); } // Release
+static XED_INLINE void XedAtomicAdd64(volatile uint64_t *value, uint64_t amount) { InterlockedExchangeAdd64((volatile LONG64 *)value, (LONG64)amount); }   // (Counters: no ordering)
+static XED_INLINE uint64_t XedAtomicGet64(volatile uint64_t *value) { return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)value, 0, 0); }
+static XED_INLINE void XedAtomicSet64(volatile uint64_t *value, uint64_t newValue) { InterlockedExchange64((volatile LONG64 *)value, (LONG64)newValue); }
+
+#else
+
+typedef pthread_t xed_thread_t;
+typedef pthread_mutex_t xed_mutex_t;
+typedef pthread_cond_t xed_cond_t;
+#define XED_THREAD_FUNC void *                  // Thread function: static XED_THREAD_FUNC MyThread(void *arg) { ...; return 0; }
+typedef void *(*xed_thread_func_t)(void *);
+
+static XED_INLINE int XedThreadCreate(xed_thread_t *thread, xed_thread_func_t func, void *arg) { return pthread_create(thread, NULL, func, arg); }
+static XED_INLINE void XedThreadJoin(xed_thread_t thread) { pthread_join(thread, NULL); }
+static XED_INLINE void XedMutexInit(xed_mutex_t *mutex) { pthread_mutex_init(mutex, NULL); }
+static XED_INLINE void XedMutexDestroy(xed_mutex_t *mutex) { pthread_mutex_destroy(mutex); }
+static XED_INLINE void XedMutexLock(xed_mutex_t *mutex) { pthread_mutex_lock(mutex); }
+static XED_INLINE void XedMutexUnlock(xed_mutex_t *mutex) { pthread_mutex_unlock(mutex); }
+static XED_INLINE void XedCondInit(xed_cond_t *cond) { pthread_cond_init(cond, NULL); }
+static XED_INLINE void XedCondDestroy(xed_cond_t *cond) { pthread_cond_destroy(cond); }
+static XED_INLINE void XedCondWait(xed_cond_t *cond, xed_mutex_t *mutex) { pthread_cond_wait(cond, mutex); }
+static XED_INLINE void XedCondSignal(xed_cond_t *cond) { pthread_cond_signal(cond); }
+static XED_INLINE void XedCondBroadcast(xed_cond_t *cond) { pthread_cond_broadcast(cond); }
+static XED_INLINE int XedAtomicGet(volatile int *value) { return __atomic_load_n(value, __ATOMIC_ACQUIRE); }     // Acquire: later reads see writes made before the matching XedAtomicSet
+static XED_INLINE void XedAtomicSet(volatile int *value, int newValue) { __atomic_store_n(value, newValue, __ATOMIC_RELEASE); }   // Release
+static XED_INLINE void XedAtomicAdd64(volatile uint64_t *value, uint64_t amount) { __atomic_fetch_add(value, amount, __ATOMIC_RELAXED); }  // (Counters: no ordering)
+static XED_INLINE uint64_t XedAtomicGet64(volatile uint64_t *value) { return __atomic_load_n(value, __ATOMIC_RELAXED); }
+static XED_INLINE void XedAtomicSet64(volatile uint64_t *value, uint64_t newValue) { __atomic_store_n(value, newValue, __ATOMIC_RELAXED); }
+
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED Trim -- copies a time range and/or a selection of streams of an EVENTS1 file to a new, re-indexed, file
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "xed/xed.h"
+
+
+// Events to copy from a stream: the initial and empty events [0, head), then the frames [first, last)
+typedef struct
+{
+    int next;
+    int head;
+    int first;
+    int last;
+} trim_range_t;
+
+
+// Monotonic time in seconds
+static double TrimTime(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+#endif
+}
+
+
+static int xed_trim(const char *inputFilename, const char *outputFilename, double startTime, double endTime, uint32_t streamMask)
+{
+    struct xed_reader *reader;
+    struct xed_writer *writer;
+    trim_range_t ranges[XED_MAX_STREAMS];
+    uint64_t origin = 0, windowStart, windowEnd;
+    uint64_t bytes = 0;
+    int numStreams, maxIndexEntries = 0;
+    int events = 0;
+    double start;
+    int stream;
+    int ret;
+
+    start = TrimTime();
+    reader = XedNewReader(inputFilename);
+    if (reader == NULL) { fprintf(stderr, "ERROR: Problem opening input file: %s\n", inputFilename); return 1; }
+
+    // Times are relative to the first timestamped event of any stream
+    for (numStreams = 0; numStreams < XED_MAX_STREAMS && XedGetNumEvents(reader, numStreams) >= 0; numStreams++) { ; }
+    ret = XedGetStartTime(reader, &origin);
+    if (ret != XED_OK && ret != XED_E_NOT_FOUND) { fprintf(stderr, "ERROR: Problem reading the index of input file (%d): %s\n", ret, inputFilename); XedCloseReader(reader); return 1; }
+    if (numStreams == 0) { fprintf(stderr, "ERROR: No streams in input file: %s\n", inputFilename); XedCloseReader(reader); return 1; }
+    windowStart = origin + (uint64_t)(startTime * XED_EVENT_TICKS_PER_SECOND);
+    windowEnd = (endTime > 0) ? origin + (uint64_t)(endTime * XED_EVENT_TICKS_PER_SECOND) : 0;
+
+    // The events to copy from each stream (every stream keeps its initial and empty events, so the stream numbering is unchanged)
+    for (stream = 0; stream < numStreams; stream++)
+    {
+        trim_range_t *range = &ranges[stream];
+        int numEvents = XedGetNumEvents(reader, stream);
+        xed_event_view_t view;
+
+        range->next = 0;
+        range->head = (numEvents < 2) ? numEvents : 2;
+        range->first = range->head;
+        range->last = numEvents;
+        if (!(streamMask & (1u << stream))) { range->last = range->head; }
+        else if (startTime > 0 || endTime > 0)
+        {
+            int first = XedFindEventByTime(reader, stream, windowStart, XED_FIND_CEIL);
+            int last = (windowEnd != 0) ? XedFindEventByTime(reader, stream, windowEnd, XED_FIND_CEIL) : numEvents;
+            if (first < 0) { first = numEvents; }
+            if (last < 0) { last = numEvents; }
+            range->first = (first > range->head) ? first : range->head;
+            range->last = (last > range->first) ? last : range->first;
+        }
+
+        // Keep the largest index block size of the input (xed_initial_data_t.maxIndexEntries)
+        if (numEvents > 0 && XedMapEvent(reader, stream, 0, &view) == XED_OK)
+        {
+            if (view.length >= 288)
+            {
+                const unsigned char *p = (const unsigned char *)view.data + 284;
+                int streamMaxIndexEntries = (int)(p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+                if (streamMaxIndexEntries > maxIndexEntries) { maxIndexEntries = streamMaxIndexEntries; }
+            }
+            XedUnmapEvent(reader, &view);
+        }
+    }
+
+    writer = XedNewWriter(outputFilename, numStreams, maxIndexEntries);
+    if (writer == NULL) { XedCloseReader(reader); return 1; }
+
+    // Copy in the order of the input file (adjacent events are copied together)
+    ret = XED_OK;
+    for (;;)
+    {
+        uint64_t bestOffset = 0;
+        int best = -1, index;
+        const xed_index_t *entry;
+
+        for (stream = 0; stream < numStreams; stream++)
+        {
+            const trim_range_t *range = &ranges[stream];
+            if (range->next >= range->head && range->next >= range->last) { continue; }
+            entry = XedGetIndexEntry(reader, stream, range->next);
+            if (entry == NULL) { continue; }
+            if (best < 0 || entry->indexEntry.frameFileOffset < bestOffset) { best = stream; bestOffset = entry->indexEntry.frameFileOffset; }
+        }
+        if (best < 0) { break; }
+
+        index = ranges[best].next++;
+        if (ranges[best].next == ranges[best].head) { ranges[best].next = ranges[best].first; }
+        ret = XedWriterCopyEvent(writer, reader, best, index);
+        if (ret != XED_OK) { fprintf(stderr, "ERROR: Problem copying event %d of stream %d (%d).\n", index, best, ret); break; }
+        entry = XedGetIndexEntry(reader, best, index);
+        events++;
+        bytes += entry->indexEntry.dataSize;
+    }
+
+    if (XedCloseWriter(writer) != XED_OK && ret == XED_OK) { fprintf(stderr, "ERROR: Problem writing output file: %s\n", outputFilename); ret = XED_E_ACCESS_DENIED; }
+    XedCloseReader(reader);
+
+    fprintf(stderr, "NOTE: Copied %d events (%.1f MB of payload) in %.3f s.\n", events, bytes / 1048576.0, TrimTime() - start);
+    return (ret == XED_OK) ? 0 : 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *inputFilename = NULL;
+    const char *outputFilename = NULL;
+    double startTime = 0, duration = 0, endTime = 0;
+    uint32_t streamMask = XED_STREAM_MASK_ALL;
+    int help = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcasecmp(argv[i], "--help")) { help = 1; break; }
+        else if (!strcasecmp(argv[i], "--start") && i + 1 < argc) { startTime = atof(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--duration") && i + 1 < argc) { duration = atof(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--end") && i + 1 < argc) { endTime = atof(argv[++i]); }
+        else if (!strcasecmp(argv[i], "--streams") && i + 1 < argc) { streamMask = (uint32_t)strtoul(argv[++i], NULL, 0); }
+        else if (argv[i][0] == '-' && argv[i][1] != '\0') { fprintf(stderr, "ERROR: Unknown option: %s\n", argv[i]); help = 1; break; }
+        else if (inputFilename == NULL) { inputFilename = argv[i]; }
+        else if (outputFilename == NULL) { outputFilename = argv[i]; }
+        else { fprintf(stderr, "ERROR: Unexpected parameter: %s\n", argv[i]); help = 1; break; }
+    }
+
+    if (duration > 0) { endTime = startTime + duration; }
+    if (!help && (inputFilename == NULL || outputFilename == NULL)) { fprintf(stderr, "ERROR: Input and output files not specified.\n"); help = 1; }
+    if (!help && (startTime < 0 || duration < 0 || (endTime != 0 && endTime <= startTime) || streamMask == 0)) { fprintf(stderr, "ERROR: Invalid selection.\n"); help = 1; }
+
+    if (help)
+    {
+        fprintf(stderr, "Usage: xed_trim [--start <seconds>] [--duration <seconds> | --end <seconds>] [--streams <mask>] <input.xed> <output.xed>\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Copies the frames in the time range (seconds from the start of the recording) of the selected streams (bit n for stream n) to a new file.\n");
+        return -1;
+    }
+
+    return xed_trim(inputFilename, outputFilename, startTime, endTime, streamMask);
+}
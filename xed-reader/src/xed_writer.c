@@ -0,0 +1,468 @@
+/* 
+ * Copyright (c) 2013, Dan Jackson.
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions are met: 
+ * 1. Redistributions of source code must retain the above copyright notice, 
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice, 
+ *    this list of conditions and the following disclaimer in the documentation 
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE 
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE. 
+ */
+
+// XED File Writer -- emits EVENTS1 files (events, periodic stream indexes, end of file information), copying events from a reader without going through user space where possible
+// Dan Jackson, 2013
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#else
+#define _GNU_SOURCE
+#endif
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#endif
+
+#include "xed/xed.h"
+#include "xed_internal.h"
+
+// copy_file_range() (in-kernel copy, or a reflink on filesystems that support it) is in glibc 2.27 onwards
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define XED_COPY_FILE_RANGE 1
+#endif
+
+#define XED_WRITER_BUFFER_SIZE (1024 * 1024)
+#define XED_WRITER_DEFAULT_MAX_INDEX_ENTRIES 1024
+
+
+// Per-stream state: index entries not yet written to an index block, and the end information
+typedef struct
+{
+    xed_index_entry_t *entries;     // [maxIndexEntries]
+    unsigned char (*frameInfo)[24]; // [maxIndexEntries] (big-endian, as in the file)
+    unsigned int pending;
+    unsigned int total;
+    uint64_t *indexOffsets;
+    unsigned int numIndexes;
+    unsigned int maxIndexes;
+    uint32_t frameSize;             // Payload size of the most recent frame
+    xed_index_entry_t event0, event1;
+} xed_writer_stream_t;
+
+typedef struct xed_writer
+{
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int fd;
+#endif
+    int failed;                     // A write has failed (reported on closing)
+    uint64_t offset;                // Offset of the next byte in the output file
+    unsigned char *buffer;          // Buffered small writes
+    size_t bufferLength;
+    xed_reader_t *copyReader;       // Pending run of events to copy from a reader: [copyStart, copyEnd) of its file
+    uint64_t copyStart;
+    uint64_t copyEnd;
+    unsigned int numStreams;
+    unsigned int maxIndexEntries;
+    xed_writer_stream_t streams[XED_MAX_STREAMS];
+} xed_writer_t;
+
+
+// Utility methods (encode little/big-endian values into a byte buffer)
+static void put_uint16(unsigned char *p, uint16_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static void put_uint32(unsigned char *p, uint32_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24); }
+static void put_uint64(unsigned char *p, uint64_t v) { put_uint32(p, (uint32_t)v); put_uint32(p + 4, (uint32_t)(v >> 32)); }
+static void put_uint16_be(unsigned char *p, uint16_t v) { p[0] = (unsigned char)(v >> 8); p[1] = (unsigned char)v; }
+static void put_uint32_be(unsigned char *p, uint32_t v) { p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16); p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v; }
+
+// Encode an event header (xed_event_t, 24 bytes)
+void XedEncodeEvent(unsigned char *p, const xed_event_t *event)
+{
+    put_uint16(p + 0, event->streamId);
+    put_uint16(p + 2, event->_flags);
+    put_uint32(p + 4, event->length);
+    put_uint64(p + 8, event->timestamp);
+    put_uint32(p + 16, event->_unknown1);
+    put_uint32(p + 20, event->length2);
+}
+
+// Encode event frame information (xed_frame_info_t, 24 bytes, big-endian)
+void XedEncodeEventFrameInfo(unsigned char *p, const xed_frame_info_t *frameInfo)
+{
+    put_uint16_be(p + 0, frameInfo->_unknown1);
+    put_uint16_be(p + 2, frameInfo->_unknown2);
+    put_uint16_be(p + 4, frameInfo->_unknown3);
+    put_uint16_be(p + 6, frameInfo->_unknown4);
+    put_uint16_be(p + 8, frameInfo->width);
+    put_uint16_be(p + 10, frameInfo->height);
+    put_uint32_be(p + 12, frameInfo->sequenceNumber);
+    put_uint32_be(p + 16, frameInfo->_unknown5);
+    put_uint32_be(p + 20, frameInfo->timestamp);
+}
+
+
+// Write directly to the file
+static int XedWriterWriteFile(xed_writer_t *writer, const void *data, size_t length)
+{
+    while (length > 0)
+    {
+#ifdef _WIN32
+        DWORD chunk = (length > 0x40000000) ? 0x40000000 : (DWORD)length;
+        DWORD count = 0;
+        if (!WriteFile(writer->file, data, chunk, &count, NULL) || count == 0) { writer->failed = 1; return XED_E_ACCESS_DENIED; }
+#else
+        ssize_t count = write(writer->fd, data, length);
+        if (count < 0 && errno == EINTR) { continue; }
+        if (count <= 0) { writer->failed = 1; return XED_E_ACCESS_DENIED; }
+#endif
+        data = (const char *)data + count;
+        length -= (size_t)count;
+    }
+    return XED_OK;
+}
+
+// Copy a range of the reader's file to the output: in the kernel where supported, otherwise through a buffer (and always for XED_READER_DIRECT, whose reads are aligned or drop the pages afterwards)
+static int XedWriterCopyRange(xed_writer_t *writer, xed_reader_t *reader, uint64_t offset, uint64_t length)
+{
+#ifndef _WIN32
+    if (reader->fd >= 0 && !reader->direct)
+    {
+#ifdef XED_COPY_FILE_RANGE
+        while (length > 0)
+        {
+            loff_t inOffset = (loff_t)offset;
+            ssize_t count = copy_file_range(reader->fd, &inOffset, writer->fd, NULL, (size_t)((length > 0x40000000) ? 0x40000000 : length), 0);
+            if (count < 0 && errno == EINTR) { continue; }
+            if (count <= 0) { break; }                      // (e.g. EXDEV on older kernels, or not supported by the filesystem) try the next method
+            offset += (uint64_t)count;
+            length -= (uint64_t)count;
+        }
+#endif
+#ifdef __linux__
+        while (length > 0)
+        {
+            off_t inOffset = (off_t)offset;
+            ssize_t count = sendfile(writer->fd, reader->fd, &inOffset, (size_t)((length > 0x40000000) ? 0x40000000 : length));
+            if (count < 0 && errno == EINTR) { continue; }
+            if (count <= 0) { break; }
+            offset += (uint64_t)count;
+            length -= (uint64_t)count;
+        }
+#endif
+    }
+#endif
+
+    // Fallback: through the writer's buffer
+    while (length > 0)
+    {
+        size_t chunk = (length > XED_WRITER_BUFFER_SIZE) ? XED_WRITER_BUFFER_SIZE : (size_t)length;
+        if (XedReadAt(reader, offset, writer->buffer, chunk) != XED_OK) { writer->failed = 1; return XED_E_ACCESS_DENIED; }
+        if (XedWriterWriteFile(writer, writer->buffer, chunk) != XED_OK) { return XED_E_ACCESS_DENIED; }
+        offset += chunk;
+        length -= chunk;
+    }
+    return XED_OK;
+}
+
+// Write out any buffered bytes and any pending run of copied events (the output offset already includes them)
+static int XedWriterFlush(xed_writer_t *writer)
+{
+    int ret = XED_OK;
+    if (writer->bufferLength > 0)
+    {
+        ret = XedWriterWriteFile(writer, writer->buffer, writer->bufferLength);
+        writer->bufferLength = 0;
+    }
+    if (writer->copyReader != NULL)
+    {
+        if (ret == XED_OK) { ret = XedWriterCopyRange(writer, writer->copyReader, writer->copyStart, writer->copyEnd - writer->copyStart); }
+        writer->copyReader = NULL;
+    }
+    return ret;
+}
+
+// Append bytes to the output (buffered)
+static int XedWriterPut(xed_writer_t *writer, const void *data, size_t length)
+{
+    if (writer->copyReader != NULL || writer->bufferLength + length > XED_WRITER_BUFFER_SIZE)
+    {
+        if (XedWriterFlush(writer) != XED_OK) { return XED_E_ACCESS_DENIED; }
+    }
+    if (length > XED_WRITER_BUFFER_SIZE)
+    {
+        if (XedWriterWriteFile(writer, data, length) != XED_OK) { return XED_E_ACCESS_DENIED; }
+    }
+    else
+    {
+        memcpy(writer->buffer + writer->bufferLength, data, length);
+        writer->bufferLength += length;
+    }
+    writer->offset += length;
+    return XED_OK;
+}
+
+// Write a stream's pending index entries as an index block
+static int XedWriterFlushIndex(xed_writer_t *writer, xed_writer_stream_t *stream)
+{
+    unsigned char header[24] = {0};
+    unsigned int k;
+
+    if (stream->numIndexes >= stream->maxIndexes)
+    {
+        unsigned int maxIndexes = stream->maxIndexes ? 2 * stream->maxIndexes : 16;
+        uint64_t *indexOffsets = (uint64_t *)realloc(stream->indexOffsets, maxIndexes * sizeof(uint64_t));
+        if (indexOffsets == NULL) { writer->failed = 1; return XED_E_OUT_OF_MEMORY; }
+        stream->indexOffsets = indexOffsets;
+        stream->maxIndexes = maxIndexes;
+    }
+    stream->indexOffsets[stream->numIndexes++] = writer->offset;
+
+    put_uint16(header + 0, 0xffff);                         // packetType
+    put_uint32(header + 4, stream->pending);                // numEntries
+    XedWriterPut(writer, header, sizeof(header));
+    for (k = 0; k < stream->pending; k++)
+    {
+        unsigned char p[24];
+        put_uint64(p + 0, stream->entries[k].frameFileOffset);
+        put_uint64(p + 8, stream->entries[k].frameTimestamp);
+        put_uint32(p + 16, stream->entries[k].dataSize);
+        put_uint32(p + 20, stream->entries[k].dataSize2);
+        XedWriterPut(writer, p, sizeof(p));
+    }
+    XedWriterPut(writer, stream->frameInfo, (size_t)stream->pending * 24);
+    stream->pending = 0;
+    return writer->failed ? XED_E_ACCESS_DENIED : XED_OK;
+}
+
+// Index an event that has just been added at the given offset (the first two events of each stream are its initial and empty events)
+static int XedWriterAddEntry(xed_writer_t *writer, const xed_event_t *event, const xed_frame_info_t *frameInfo, uint64_t offset, uint32_t dataSize, uint32_t dataSize2)
+{
+    xed_writer_stream_t *stream = &writer->streams[event->streamId];
+    xed_index_entry_t *entry = &stream->entries[stream->pending];
+
+    entry->frameFileOffset = offset;
+    entry->frameTimestamp = event->timestamp;
+    entry->dataSize = dataSize;
+    entry->dataSize2 = dataSize2;
+    if (event->timestamp != 0) { XedEncodeEventFrameInfo(stream->frameInfo[stream->pending], frameInfo); stream->frameSize = event->length; }
+    else { memset(stream->frameInfo[stream->pending], 0, 24); }
+    if (stream->total == 0) { stream->event0 = *entry; }
+    if (stream->total == 1) { stream->event1 = *entry; }
+    stream->pending++;
+    stream->total++;
+
+    // Periodic index, after the event that fills it
+    if (stream->pending >= writer->maxIndexEntries) { return XedWriterFlushIndex(writer, stream); }
+    return XED_OK;
+}
+
+
+xed_writer_t *XedNewWriter(const char *filename, int numStreams, int maxIndexEntries)
+{
+    unsigned char header[24] = {0};
+    xed_writer_t *writer;
+    int i;
+
+    if (filename == NULL || numStreams <= 0 || numStreams > XED_MAX_STREAMS) { return NULL; }  // XED_E_INVALID_ARG
+    if (maxIndexEntries <= 0) { maxIndexEntries = XED_WRITER_DEFAULT_MAX_INDEX_ENTRIES; }
+
+    writer = (xed_writer_t *)malloc(sizeof(xed_writer_t));
+    if (writer == NULL) { return NULL; }                    // XED_E_OUT_OF_MEMORY
+    memset(writer, 0, sizeof(xed_writer_t));
+    writer->numStreams = (unsigned int)numStreams;
+    writer->maxIndexEntries = (unsigned int)maxIndexEntries;
+    writer->buffer = (unsigned char *)malloc(XED_WRITER_BUFFER_SIZE);
+    for (i = 0; i < numStreams; i++)
+    {
+        writer->streams[i].entries = (xed_index_entry_t *)malloc(sizeof(xed_index_entry_t) * maxIndexEntries);
+        writer->streams[i].frameInfo = (unsigned char (*)[24])malloc(24 * (size_t)maxIndexEntries);
+        if (writer->streams[i].entries == NULL || writer->streams[i].frameInfo == NULL) { writer->failed = 1; }
+    }
+
+#ifdef _WIN32
+    writer->file = CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (writer->file == INVALID_HANDLE_VALUE) { writer->failed = 1; }
+#else
+    writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (writer->fd < 0) { writer->failed = 1; }
+#endif
+    if (writer->buffer == NULL || writer->failed)
+    {
+        XedLog(XED_LOG_ERROR, "Problem creating output file: %s", filename);
+        XedCloseWriter(writer);
+        return NULL;
+    }
+
+    // File header (the end information offset is written on closing)
+    memcpy(header, "EVENTS1", 8);
+    put_uint32(header + 8, 3);                              // _version
+    put_uint32(header + 12, (uint32_t)numStreams);
+    XedWriterPut(writer, header, sizeof(header));
+
+    return writer;
+}
+
+
+int XedWriterWriteEvent(xed_writer_t *writer, const xed_event_t *event, const xed_frame_info_t *frameInfo, const void *data)
+{
+    unsigned char p[48];
+    uint64_t offset;
+    size_t headerLength = 24;
+
+    if (writer == NULL || event == NULL || (event->length > 0 && data == NULL)) { return XED_E_POINTER; }
+    if (event->streamId >= writer->numStreams) { return XED_E_INVALID_ARG; }
+    if (event->timestamp != 0 && frameInfo == NULL) { return XED_E_POINTER; }
+    if (writer->failed) { return XED_E_ACCESS_DENIED; }
+
+    // Event header, frame information (if timestamped), payload
+    offset = writer->offset;
+    XedEncodeEvent(p, event);
+    if (event->timestamp != 0) { XedEncodeEventFrameInfo(p + 24, frameInfo); headerLength += 24; }
+    XedWriterPut(writer, p, headerLength);
+    if (event->length > 0) { XedWriterPut(writer, data, event->length); }
+    if (writer->failed) { return XED_E_ACCESS_DENIED; }
+
+    return XedWriterAddEntry(writer, event, frameInfo, offset, event->length, event->length2);
+}
+
+
+int XedWriterCopyEvent(xed_writer_t *writer, struct xed_reader *reader, int stream, int index)
+{
+    const xed_index_t *entry;
+    xed_event_t event;
+    xed_frame_info_t frameInfo;
+    uint64_t payloadOffset, start, end, offset;
+    size_t payloadSize;
+    int ret;
+
+    if (writer == NULL || reader == NULL) { return XED_E_POINTER; }
+    if (writer->failed) { return XED_E_ACCESS_DENIED; }
+
+    entry = XedGetIndexEntry(reader, stream, index);
+    if (entry == NULL) { return XED_E_INVALID_ARG; }
+    ret = XedLocateEvent(reader, stream, index, &event, &frameInfo, &payloadOffset, &payloadSize);
+    if (ret != XED_OK) { return ret; }
+    if (event.streamId >= writer->numStreams) { return XED_E_INVALID_ARG; }
+
+    // The whole event is copied as it is: extend the pending run if this event follows it in the source file, otherwise start a new run
+    start = entry->indexEntry.frameFileOffset;
+    end = payloadOffset + payloadSize;
+    if (writer->copyReader != reader || writer->copyEnd != start)
+    {
+        if (XedWriterFlush(writer) != XED_OK) { return XED_E_ACCESS_DENIED; }
+        writer->copyReader = reader;
+        writer->copyStart = start;
+    }
+    writer->copyEnd = end;
+    offset = writer->offset;
+    writer->offset += end - start;
+
+    return XedWriterAddEntry(writer, &event, &frameInfo, offset, entry->indexEntry.dataSize, entry->indexEntry.dataSize2);
+}
+
+
+int XedCloseWriter(xed_writer_t *writer)
+{
+    unsigned char p[120];
+    uint64_t indexFileOffset;
+    unsigned int s, i;
+    int ret;
+
+    if (writer == NULL) { return XED_E_POINTER; }
+
+    if (!writer->failed)
+    {
+        // Closing index for each stream
+        for (s = 0; s < writer->numStreams; s++)
+        {
+            if (writer->streams[s].pending > 0) { XedWriterFlushIndex(writer, &writer->streams[s]); }
+        }
+
+        // End of file information
+        indexFileOffset = writer->offset;
+        put_uint16(p, (uint16_t)writer->numStreams);
+        XedWriterPut(writer, p, 2);
+        for (s = 0; s < writer->numStreams; s++)
+        {
+            const xed_writer_stream_t *stream = &writer->streams[s];
+            memset(p, 0, sizeof(p));
+            put_uint16(p + 0, 0xffff);
+            put_uint16(p + 2, 0xffff);
+            put_uint16(p + 4, (uint16_t)s);                 // streamNumber
+            put_uint16(p + 6, 24);                          // extraPerIndexEntry
+            put_uint32(p + 8, stream->total);               // totalIndexEntries
+            put_uint32(p + 12, stream->frameSize);
+            put_uint32(p + 16, writer->maxIndexEntries);
+            put_uint32(p + 20, stream->numIndexes);
+            put_uint64(p + 24, stream->event0.frameFileOffset); put_uint64(p + 32, stream->event0.frameTimestamp); put_uint32(p + 40, stream->event0.dataSize); put_uint32(p + 44, stream->event0.dataSize2);
+            put_uint64(p + 48, stream->event1.frameFileOffset); put_uint64(p + 56, stream->event1.frameTimestamp); put_uint32(p + 64, stream->event1.dataSize); put_uint32(p + 68, stream->event1.dataSize2);
+            XedWriterPut(writer, p, 120);                   // (_unknownEvent0/1 = 0)
+            memset(p, 0, 48);
+            XedWriterPut(writer, p, 48);                    // Frame information for events 0 and 1 (none)
+            for (i = 0; i < stream->numIndexes; i++)
+            {
+                put_uint64(p, stream->indexOffsets[i]);
+                XedWriterPut(writer, p, 8);
+            }
+            memset(p, 0, 4);
+            XedWriterPut(writer, p, 4);                     // _unknown11
+        }
+        XedWriterFlush(writer);
+
+        // Point the header at the end information
+        put_uint64(p, indexFileOffset);
+#ifdef _WIN32
+        {
+            OVERLAPPED overlapped = {0};
+            DWORD count = 0;
+            overlapped.Offset = 16;
+            if (!WriteFile(writer->file, p, 8, &count, &overlapped) || count != 8) { writer->failed = 1; }
+        }
+#else
+        if (pwrite(writer->fd, p, 8, 16) != 8) { writer->failed = 1; }
+#endif
+    }
+
+    ret = writer->failed ? XED_E_ACCESS_DENIED : XED_OK;
+#ifdef _WIN32
+    if (writer->file != INVALID_HANDLE_VALUE && !CloseHandle(writer->file)) { ret = XED_E_ACCESS_DENIED; }
+#else
+    if (writer->fd >= 0 && close(writer->fd) != 0) { ret = XED_E_ACCESS_DENIED; }
+#endif
+    for (s = 0; s < XED_MAX_STREAMS; s++)
+    {
+        free(writer->streams[s].entries);
+        free(writer->streams[s].frameInfo);
+        free(writer->streams[s].indexOffsets);
+    }
+    free(writer->buffer);
+    free(writer);
+    return ret;
+}